@@ -18,6 +18,27 @@ set(Benchmark_FOUND false)
 
 find_package(Threads REQUIRED)
 
+# use the installed google/benchmark and googletest when there are both,
+# building them from source needs the network
+option(USE_SYSTEM_BENCHMARK "use the installed google/benchmark" ON)
+if(USE_SYSTEM_BENCHMARK)
+  find_package(benchmark CONFIG QUIET)
+  find_package(GTest CONFIG QUIET)
+endif()
+if(USE_SYSTEM_BENCHMARK AND benchmark_FOUND AND GTest_FOUND)
+  message(STATUS "use the installed google/benchmark ${benchmark_VERSION}")
+  foreach(lib benchmark benchmark_main)
+    add_library(${lib} INTERFACE)
+    target_link_libraries(${lib} INTERFACE benchmark::${lib})
+  endforeach()
+  foreach(lib gtest gtest_main gmock gmock_main)
+    add_library(${lib} INTERFACE)
+    target_link_libraries(${lib} INTERFACE GTest::${lib})
+  endforeach()
+  set(Benchmark_FOUND true)
+  return()
+endif()
+
 include(ExternalProject)
 
 # 1. set google/benchmark source code branch
@@ -16,19 +16,20 @@
 
 #include "stream/file-stream.h"
 
+#include <cerrno>
+
 namespace base {
 
-FileStream::FileStream(std::string_view filename, Stream *log_stream)
+FileStream::FileStream(const char *filename, Stream *log_stream)
     : Stream(log_stream), file_(nullptr), offset_(0), should_close_(false) {
-  std::string filename_str = filename.to_string();
-  file_ = fopen(filename_str.c_str(), "wb");
+  file_ = fopen(filename, "wb");
 
   // TODO(zhongxiao.yzx) : this is pretty cheesy, should come up with a better
   // API.
   if (file_) {
     should_close_ = true;
   } else {
-    ERROR("fopen name=\"%s\" failed, errno=%d\n", filename_str.c_str(), errno);
+    ERROR("fopen name=\"%s\" failed, errno=%d\n", filename, errno);
   }
 }
 
@@ -19,6 +19,7 @@
 #define BASE_STREAM_FILESTREAM_H_
 
 #include <cassert>
+#include <cstdio>
 #include <memory>
 #include <vector>
 
@@ -29,7 +30,7 @@ namespace base {
 
 class FileStream : public Stream {
 public:
-  explicit FileStream(std::string_view filename, Stream *log_stream = nullptr);
+  explicit FileStream(const char *filename, Stream *log_stream = nullptr);
   explicit FileStream(FILE *, Stream *log_stream = nullptr);
   FileStream(FileStream &&);
   FileStream &operator=(FileStream &&);
@@ -20,6 +20,7 @@
 #include <cctype>
 #include <cerrno>
 #include <cstdarg>
+#include <cstring>
 
 #define DUMP_OCTETS_PER_LINE 16
 #define DUMP_OCTETS_PER_GROUP 2
@@ -110,12 +111,11 @@ void Stream::WriteMemoryDump(const void *start, size_t size, size_t offset,
   }
 }
 
-Result OutputBuffer::WriteToFile(std::string_view filename) const {
+Result OutputBuffer::WriteToFile(const char *filename) const {
 #ifndef PLUGIN_SANDBOX
-  std::string filename_str = filename.to_string();
-  FILE *file = fopen(filename_str.c_str(), "wb");
+  FILE *file = fopen(filename, "wb");
   if (!file) {
-    ERROR("unable to open %s for writing\n", filename_str.c_str());
+    ERROR("unable to open %s for writing\n", filename);
     return Result::Error;
   }
 
@@ -127,7 +127,7 @@ Result OutputBuffer::WriteToFile(std::string_view filename) const {
   size_t bytes = fwrite(data.data(), 1, data.size(), file);
   if (bytes <= 0 || static_cast<size_t>(bytes) != data.size()) {
     ERROR("failed to write %" PRIzd " bytes to %s\n", data.size(),
-          filename_str.c_str());
+          filename);
     fclose(file);
     return Result::Error;
   }
@@ -19,6 +19,7 @@
 #define BASE_STREAM_STREAM_H_
 
 #include <cassert>
+#include <cstdio>
 #include <memory>
 #include <vector>
 
@@ -139,7 +140,7 @@ private:
 };
 
 struct OutputBuffer {
-  Result WriteToFile(std::string_view filename) const;
+  Result WriteToFile(const char *filename) const;
 
   void clear() { data.clear(); }
   size_t size() const { return data.size(); }
@@ -158,7 +159,7 @@ public:
 
   void Clear();
 
-  Result WriteToFile(std::string_view filename) {
+  Result WriteToFile(const char *filename) {
     return buf_->WriteToFile(filename);
   }
 
@@ -17,6 +17,9 @@
 #ifndef BASE_TYPES_TYPES_H_
 #define BASE_TYPES_TYPES_H_
 
+#include <inttypes.h>
+#include <stddef.h>
+
 #include <memory>
 #include <type_traits>
 #include <utility>
@@ -25,6 +28,8 @@ namespace base {
 #define PRIindex "u"
 #define PRIaddress "u"
 #define PRIoffset PRIzx
+#define PRIzd "zd"
+#define PRIzx "zx"
 
 typedef uint32_t Index;   // An index into one of the many index spaces.
 typedef uint32_t Address; // An address or size in linear memory.
@@ -34,6 +39,15 @@ struct v128 {
   uint32_t v[4];
 };
 
+// status of the operations which may fail, checked with Failed/Succeeded
+enum class Result {
+  Ok,
+  Error,
+};
+
+inline bool Succeeded(Result result) { return result == Result::Ok; }
+inline bool Failed(Result result) { return result == Result::Error; }
+
 static const Address kInvalidAddress = ~0;
 static const Index kInvalidIndex = ~0;
 static const Offset kInvalidOffset = ~0;
@@ -42,6 +42,8 @@ namespace base {
 #define SYMBOL_HIDDEN __attribute__((visibility("hidden")))
 #define ALWAYS_INLINE inline __attribute__((always_inline))
 #define PACKED_STRUCT(definition) definition __attribute__((packed));
+// check the arguments of printf like methods, the indexes count "this"
+#define X_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
 
 /**************************** auxiliary variadic parameters
  * ************************/
@@ -0,0 +1,429 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "common/allocator.h"
+#include "threads/spinlock.h"
+
+#define SIZE_CLASS_COUNT ALLOCATOR_SIZE_CLASSES
+// the blocks a cache takes from the pages or gives back at a time
+#define CACHE_BATCH 32
+// the blocks a cache holds before it gives a batch back
+#define CACHE_LIMIT (2 * CACHE_BATCH)
+
+// the blocks of a page start after its header, the bitmaps are only in the
+// header of an object page
+#define PAGE_HEADER(hasObjects)                                                \
+  ((((hasObjects) ? sizeof(Page) : offsetof(Page, marks)) + 7) & ~(size_t)7)
+
+typedef enum { SPACE_BLOCKS, SPACE_OBJECTS, SPACE_COUNT } Space;
+
+typedef struct {
+  base::SpinLock lock;
+  // the pages with blocks to hand out, the full ones are on no list
+  Page *partial;
+  size_t pages;
+  size_t usedBlocks;
+} SizeClass;
+
+// the blocks a thread freed, linked through their first word
+typedef struct {
+  void *blocks;
+  int count;
+} BlockCache;
+
+static SizeClass classes[SPACE_COUNT][SIZE_CLASS_COUNT];
+static thread_local BlockCache caches[SPACE_COUNT][SIZE_CLASS_COUNT];
+
+// taken after the lock of a size class, never before
+static base::SpinLock pageLock;
+static Page *emptyPages;
+static size_t emptyPageCount;
+static uint64_t pagesMapped;
+static uint64_t pagesUnmapped;
+static Page **objectPageArray;
+static int objectPageCount;
+static int objectPageCapacity;
+static void (*refillHook)(int sizeClass);
+
+static inline int sizeClassOf(size_t size) {
+  if (size <= 64)
+    return (int)((size - 1) >> 3);
+  if (size <= 128)
+    return 8 + (int)((size - 65) >> 4);
+  if (size <= 256)
+    return 12 + (int)((size - 129) >> 5);
+  return 16 + (int)((size - 257) >> 6);
+}
+
+static size_t classSize(int sizeClass) {
+  if (sizeClass < 8)
+    return (size_t)(sizeClass + 1) * 8;
+  if (sizeClass < 12)
+    return 64 + (size_t)(sizeClass - 7) * 16;
+  if (sizeClass < 16)
+    return 128 + (size_t)(sizeClass - 11) * 32;
+  return 256 + (size_t)(sizeClass - 15) * 64;
+}
+
+static Page *mapPage() {
+  pageLock.lock();
+  Page *page = emptyPages;
+  if (page != NULL) {
+    emptyPages = page->next;
+    emptyPageCount--;
+  }
+  pageLock.unlock();
+  if (page != NULL)
+    return page;
+
+  // twice the size, an aligned page is cut out of it
+  uint8_t *memory =
+      (uint8_t *)mmap(NULL, 2 * ALLOCATOR_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    exit(1);
+  uint8_t *start = (uint8_t *)(((uintptr_t)memory + ALLOCATOR_PAGE_SIZE - 1) &
+                               ~(uintptr_t)(ALLOCATOR_PAGE_SIZE - 1));
+  if (start > memory)
+    munmap(memory, start - memory);
+  uint8_t *end = start + ALLOCATOR_PAGE_SIZE;
+  if (end < memory + 2 * ALLOCATOR_PAGE_SIZE)
+    munmap(end, memory + 2 * ALLOCATOR_PAGE_SIZE - end);
+
+  pageLock.lock();
+  pagesMapped++;
+  pageLock.unlock();
+  return (Page *)start;
+}
+
+// kept mapped until trimPages()
+static void releasePage(Page *page) {
+  pageLock.lock();
+  page->next = emptyPages;
+  emptyPages = page;
+  emptyPageCount++;
+  pageLock.unlock();
+}
+
+static void addObjectPage(Page *page) {
+  pageLock.lock();
+  if (objectPageCapacity < objectPageCount + 1) {
+    objectPageCapacity =
+        objectPageCapacity < 8 ? 8 : objectPageCapacity * 2;
+    objectPageArray = (Page **)realloc(objectPageArray,
+                                       sizeof(Page *) * objectPageCapacity);
+    if (objectPageArray == NULL)
+      exit(1);
+  }
+  page->index = objectPageCount;
+  objectPageArray[objectPageCount++] = page;
+  pageLock.unlock();
+}
+
+static void removeObjectPage(Page *page) {
+  pageLock.lock();
+  Page *last = objectPageArray[--objectPageCount];
+  last->index = page->index;
+  objectPageArray[page->index] = last;
+  pageLock.unlock();
+}
+
+static Page *newPage(Space space, int sizeClass) {
+  bool hasObjects = space == SPACE_OBJECTS;
+  size_t size = classSize(sizeClass);
+  Page *page = mapPage();
+  page->freeList = NULL;
+  page->bump = (uint8_t *)page + PAGE_HEADER(hasObjects);
+  page->end = page->bump +
+              (ALLOCATOR_PAGE_SIZE - PAGE_HEADER(hasObjects)) / size * size;
+  page->used = 0;
+  page->sizeClass = sizeClass;
+  page->capacity = (int)((page->end - page->bump) / size);
+  page->blockSize = (int)size;
+  page->isListed = false;
+  page->hasObjects = hasObjects;
+  // a sweep still going through an old copy of the page list may look
+  __atomic_store_n(&page->unswept, false, __ATOMIC_RELAXED);
+  if (hasObjects) {
+    memset(page->marks, 0, sizeof(page->marks));
+    memset(page->objects, 0, sizeof(page->objects));
+    addObjectPage(page);
+  }
+  return page;
+}
+
+static bool isFull(Page *page) {
+  return page->freeList == NULL && page->bump == page->end;
+}
+
+static void linkPage(SizeClass *sizeClass, Page *page) {
+  page->isListed = true;
+  page->previous = NULL;
+  page->next = sizeClass->partial;
+  if (sizeClass->partial != NULL)
+    sizeClass->partial->previous = page;
+  sizeClass->partial = page;
+}
+
+static void unlinkPage(SizeClass *sizeClass, Page *page) {
+  page->isListed = false;
+  if (page->previous != NULL)
+    page->previous->next = page->next;
+  else
+    sizeClass->partial = page->next;
+  if (page->next != NULL)
+    page->next->previous = page->previous;
+}
+
+// blocks came back, under the lock of its size class
+static void updatePage(SizeClass *sizeClass, Page *page) {
+  if (page->used == 0) {
+    if (page->isListed)
+      unlinkPage(sizeClass, page);
+    sizeClass->pages--;
+    if (page->hasObjects)
+      removeObjectPage(page);
+    page->hasObjects = false;
+    releasePage(page);
+  } else if (!page->isListed && !isFull(page) &&
+             !__atomic_load_n(&page->unswept, __ATOMIC_RELAXED)) {
+    linkPage(sizeClass, page);
+  }
+}
+
+static void refillCache(Space space, int index) {
+  SizeClass *sizeClass = &classes[space][index];
+  BlockCache *cache = &caches[space][index];
+  size_t size = classSize(index);
+  void *batch[CACHE_BATCH];
+  int count = 0;
+  if (space == SPACE_OBJECTS && refillHook != NULL)
+    refillHook(index);
+  sizeClass->lock.lock();
+  while (count < CACHE_BATCH) {
+    Page *page = sizeClass->partial;
+    if (page == NULL) {
+      page = newPage(space, index);
+      sizeClass->pages++;
+      linkPage(sizeClass, page);
+    }
+    void *block;
+    if (page->freeList != NULL) {
+      block = page->freeList;
+      page->freeList = *(void **)block;
+    } else {
+      block = page->bump;
+      page->bump += size;
+    }
+    page->used++;
+    sizeClass->usedBlocks++;
+    if (isFull(page))
+      unlinkPage(sizeClass, page);
+    batch[count++] = block;
+  }
+  sizeClass->lock.unlock();
+
+  // handed out in address order
+  while (count > 0) {
+    void *block = batch[--count];
+    *(void **)block = cache->blocks;
+    cache->blocks = block;
+    cache->count++;
+  }
+}
+
+static void flushCache(Space space, int index, int count) {
+  SizeClass *sizeClass = &classes[space][index];
+  BlockCache *cache = &caches[space][index];
+  sizeClass->lock.lock();
+  for (int i = 0; i < count; i++) {
+    void *block = cache->blocks;
+    cache->blocks = *(void **)block;
+    cache->count--;
+
+    Page *page = pageOf(block);
+    *(void **)block = page->freeList;
+    page->freeList = block;
+    page->used--;
+    sizeClass->usedBlocks--;
+    updatePage(sizeClass, page);
+  }
+  sizeClass->lock.unlock();
+}
+
+void *allocateBlock(size_t size) {
+  if (size == 0)
+    return NULL;
+  if (size > ALLOCATOR_MAX_SIZE) {
+    void *block = malloc(size);
+    if (block == NULL)
+      exit(1);
+    return block;
+  }
+
+  int index = sizeClassOf(size);
+  BlockCache *cache = &caches[SPACE_BLOCKS][index];
+  if (cache->count == 0)
+    refillCache(SPACE_BLOCKS, index);
+  void *block = cache->blocks;
+  cache->blocks = *(void **)block;
+  cache->count--;
+  return block;
+}
+
+void freeBlock(void *block, size_t size) {
+  if (block == NULL)
+    return;
+  if (size > ALLOCATOR_MAX_SIZE) {
+    free(block);
+    return;
+  }
+
+  int index = sizeClassOf(size);
+  BlockCache *cache = &caches[SPACE_BLOCKS][index];
+  *(void **)block = cache->blocks;
+  cache->blocks = block;
+  cache->count++;
+  if (cache->count > CACHE_LIMIT)
+    flushCache(SPACE_BLOCKS, index, CACHE_BATCH);
+}
+
+void *reallocateBlock(void *block, size_t oldSize, size_t newSize) {
+  if (newSize == 0) {
+    freeBlock(block, oldSize);
+    return NULL;
+  }
+  if (block == NULL)
+    return allocateBlock(newSize);
+  if (oldSize > ALLOCATOR_MAX_SIZE && newSize > ALLOCATOR_MAX_SIZE) {
+    void *result = realloc(block, newSize);
+    if (result == NULL)
+      exit(1);
+    return result;
+  }
+  // the block has the room already
+  if (oldSize <= ALLOCATOR_MAX_SIZE && newSize <= ALLOCATOR_MAX_SIZE &&
+      sizeClassOf(oldSize) == sizeClassOf(newSize))
+    return block;
+
+  void *result = allocateBlock(newSize);
+  memcpy(result, block, oldSize < newSize ? oldSize : newSize);
+  freeBlock(block, oldSize);
+  return result;
+}
+
+void *allocateObjectBlock(size_t size) {
+  int index = sizeClassOf(size);
+  BlockCache *cache = &caches[SPACE_OBJECTS][index];
+  if (cache->count == 0)
+    refillCache(SPACE_OBJECTS, index);
+  void *block = cache->blocks;
+  cache->blocks = *(void **)block;
+  cache->count--;
+
+  size_t granule = granuleOf(block);
+  pageOf(block)->objects[granule / 64] |= (uint64_t)1 << (granule % 64);
+  return block;
+}
+
+void holdObjectPages() {
+  for (int index = 0; index < SIZE_CLASS_COUNT; index++) {
+    if (caches[SPACE_OBJECTS][index].count > 0)
+      flushCache(SPACE_OBJECTS, index, caches[SPACE_OBJECTS][index].count);
+  }
+  for (int index = 0; index < SIZE_CLASS_COUNT; index++) {
+    SizeClass *sizeClass = &classes[SPACE_OBJECTS][index];
+    sizeClass->lock.lock();
+    while (sizeClass->partial != NULL) {
+      unlinkPage(sizeClass, sizeClass->partial);
+    }
+    sizeClass->lock.unlock();
+  }
+  pageLock.lock();
+  for (int i = 0; i < objectPageCount; i++) {
+    __atomic_store_n(&objectPageArray[i]->unswept, true, __ATOMIC_RELAXED);
+  }
+  pageLock.unlock();
+}
+
+bool returnObjectBlocks(Page *page, void *blocks, void *last, int count) {
+  SizeClass *sizeClass = &classes[SPACE_OBJECTS][page->sizeClass];
+  sizeClass->lock.lock();
+  if (count > 0) {
+    *(void **)last = page->freeList;
+    page->freeList = blocks;
+    page->used -= count;
+    sizeClass->usedBlocks -= count;
+  }
+  bool listed = page->used > 0 && !isFull(page) &&
+                !__atomic_load_n(&page->unswept, __ATOMIC_RELAXED);
+  updatePage(sizeClass, page);
+  sizeClass->lock.unlock();
+  return listed;
+}
+
+void setObjectRefillHook(void (*hook)(int sizeClass)) { refillHook = hook; }
+
+Page **objectPages(int *count) {
+  *count = objectPageCount;
+  return objectPageArray;
+}
+
+void flushThreadCache() {
+  for (int space = 0; space < SPACE_COUNT; space++) {
+    for (int index = 0; index < SIZE_CLASS_COUNT; index++) {
+      if (caches[space][index].count > 0)
+        flushCache((Space)space, index, caches[space][index].count);
+    }
+  }
+}
+
+void trimPages(size_t keepBytes) {
+  size_t keep = keepBytes / ALLOCATOR_PAGE_SIZE;
+  pageLock.lock();
+  while (emptyPageCount > keep) {
+    Page *page = emptyPages;
+    emptyPages = page->next;
+    emptyPageCount--;
+    pagesUnmapped++;
+    munmap(page, ALLOCATOR_PAGE_SIZE);
+  }
+  pageLock.unlock();
+}
+
+AllocatorStats allocatorStats() {
+  AllocatorStats stats;
+  memset(&stats, 0, sizeof(stats));
+  for (int space = 0; space < SPACE_COUNT; space++) {
+    for (int index = 0; index < SIZE_CLASS_COUNT; index++) {
+      SizeClass *sizeClass = &classes[space][index];
+      sizeClass->lock.lock();
+      stats.pagesInUse += sizeClass->pages;
+      stats.bytesInUse += sizeClass->usedBlocks * classSize(index);
+      sizeClass->lock.unlock();
+    }
+  }
+  pageLock.lock();
+  stats.pagesCached = emptyPageCount;
+  stats.pagesMapped = pagesMapped;
+  stats.pagesUnmapped = pagesUnmapped;
+  pageLock.unlock();
+  return stats;
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMMON_ALLOCATOR_H_
+#define YSCRIPT_COMMON_ALLOCATOR_H_
+
+#include "common/config.h"
+
+/**
+ * the memory behind reallocate(). the blocks up to ALLOCATOR_MAX_SIZE come
+ * from pages that each hold blocks of one size class, the larger ones from
+ * malloc(). the caller always knows the size of a block, so the blocks
+ * carry no header, and a page is aligned to its size, so a block finds its
+ * page by masking its address.
+ *
+ * every thread keeps the blocks it freed in a cache per size class and
+ * allocates from there first, the pages behind the caches are shared under
+ * a lock per size class. a page whose blocks all came back stays mapped
+ * for the next pages until trimPages() returns it to the OS.
+ *
+ * the objects of the old generation get pages of their own, with two
+ * bitmaps in the header, a bit per PAGE_GRANULE bytes of the page: one set
+ * at the start of every object, and the marks of the collector. the
+ * collector frees the objects itself, it scans the bitmaps for the ones
+ * without a mark, see sweepPage() in memory.cc. no block of a page is
+ * handed out between the end of a marking and the sweep of the page.
+ */
+
+#define ALLOCATOR_PAGE_SIZE (64 * 1024)
+#define ALLOCATOR_MAX_SIZE 512
+// 8 byte steps up to 64, then 16, 32 and 64 byte steps up to 512
+#define ALLOCATOR_SIZE_CLASSES 20
+#define PAGE_GRANULE 8
+#define PAGE_BITMAP_WORDS (ALLOCATOR_PAGE_SIZE / PAGE_GRANULE / 64)
+
+typedef struct Page {
+  // the pages of the size class with blocks to hand out
+  struct Page *next;
+  struct Page *previous;
+  // the blocks that came back, linked through their first word
+  void *freeList;
+  // the blocks from bump on were never handed out
+  uint8_t *bump;
+  uint8_t *end;
+  int used;
+  int sizeClass;
+  // the blocks the page holds and their size
+  int capacity;
+  int blockSize;
+  // on the list of its size class
+  bool isListed;
+  // the rest is for the pages of objects only
+  bool hasObjects;
+  // held off the list until the collection in progress swept it, see
+  // holdObjectPages()
+  bool unswept;
+  // in the array objectPages() returns
+  int index;
+  uint64_t marks[PAGE_BITMAP_WORDS];
+  uint64_t objects[PAGE_BITMAP_WORDS];
+} Page;
+
+typedef struct {
+  // pages with blocks handed out, and empty ones kept mapped
+  size_t pagesInUse;
+  size_t pagesCached;
+  // the bytes of the blocks out of the pages, rounded up to their size
+  // class, the ones in the caches of the threads included
+  size_t bytesInUse;
+  uint64_t pagesMapped;
+  uint64_t pagesUnmapped;
+} AllocatorStats;
+
+// NULL for size 0, the process exits when the memory runs out
+void *allocateBlock(size_t size);
+// size is the one the block was allocated with
+void freeBlock(void *block, size_t size);
+void *reallocateBlock(void *block, size_t oldSize, size_t newSize);
+
+// a block of an object page with its bit set in page->objects
+void *allocateObjectBlock(size_t size);
+/**
+ * the marking is done, the object blocks the thread cached go back and
+ * every object page is held off the lists with page->unswept set.
+ */
+void holdObjectPages();
+/**
+ * the collector swept a held page, it freed the count objects from blocks
+ * to last, linked through their first word, and cleared their bits. the
+ * page goes back to its list, or away if it has no other blocks out. true
+ * if it is on the list.
+ */
+bool returnObjectBlocks(Page *page, void *blocks, void *last, int count);
+// called before a cache refills from the object pages of the size class,
+// the collector sweeps held pages of it then
+void setObjectRefillHook(void (*hook)(int sizeClass));
+// the object pages, the array changes as they come and go
+Page **objectPages(int *count);
+
+static inline Page *pageOf(const void *block) {
+  return (Page *)((uintptr_t)block & ~(uintptr_t)(ALLOCATOR_PAGE_SIZE - 1));
+}
+
+// the bit of block in the bitmaps of its page
+static inline size_t granuleOf(const void *block) {
+  return ((uintptr_t)block & (ALLOCATOR_PAGE_SIZE - 1)) / PAGE_GRANULE;
+}
+
+// hand the blocks the thread cached back to their pages, before it exits
+void flushThreadCache();
+
+// unmap the empty pages beyond keepBytes of them
+void trimPages(size_t keepBytes);
+
+AllocatorStats allocatorStats();
+
+#endif // YSCRIPT_COMMON_ALLOCATOR_H_
@@ -0,0 +1,122 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "common/arena.h"
+
+// enough for doubles and pointers
+#define ARENA_ALIGNMENT 8
+#define ALIGN_UP(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+static uint8_t *blockData(ArenaBlock *block) {
+  return (uint8_t *)block + ALIGN_UP(sizeof(ArenaBlock));
+}
+
+void initArena(Arena *arena) {
+  arena->current = NULL;
+  arena->spare = NULL;
+  arena->reserved = 0;
+}
+
+static void freeBlock(Arena *arena, ArenaBlock *block) {
+  arena->reserved -= block->capacity;
+  free(block);
+}
+
+void freeArena(Arena *arena) {
+  while (arena->current != NULL) {
+    ArenaBlock *previous = arena->current->previous;
+    freeBlock(arena, arena->current);
+    arena->current = previous;
+  }
+  if (arena->spare != NULL)
+    freeBlock(arena, arena->spare);
+  initArena(arena);
+}
+
+static ArenaBlock *newBlock(Arena *arena, size_t size) {
+  if (arena->spare != NULL && arena->spare->capacity >= size) {
+    ArenaBlock *block = arena->spare;
+    arena->spare = NULL;
+    return block;
+  }
+  size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+  ArenaBlock *block = (ArenaBlock *)malloc(ALIGN_UP(sizeof(ArenaBlock)) +
+                                           capacity);
+  if (block == NULL)
+    exit(1);
+  block->capacity = capacity;
+  arena->reserved += capacity;
+  return block;
+}
+
+void *arenaAllocate(Arena *arena, size_t size) {
+  size = ALIGN_UP(size);
+  ArenaBlock *block = arena->current;
+  if (block == NULL || block->capacity - block->used < size) {
+    block = newBlock(arena, size);
+    block->previous = arena->current;
+    block->used = 0;
+    arena->current = block;
+  }
+  void *result = blockData(block) + block->used;
+  block->used += size;
+  return result;
+}
+
+void *arenaGrow(Arena *arena, void *pointer, size_t oldSize, size_t newSize) {
+  if (newSize <= oldSize)
+    return pointer;
+  ArenaBlock *block = arena->current;
+  if (pointer != NULL && block != NULL) {
+    uint8_t *end = blockData(block) + block->used;
+    size_t extra = ALIGN_UP(newSize) - ALIGN_UP(oldSize);
+    if ((uint8_t *)pointer + ALIGN_UP(oldSize) == end &&
+        block->capacity - block->used >= extra) {
+      block->used += extra;
+      return pointer;
+    }
+  }
+  void *result = arenaAllocate(arena, newSize);
+  if (pointer != NULL)
+    memcpy(result, pointer, oldSize);
+  return result;
+}
+
+ArenaMark arenaMark(Arena *arena) {
+  ArenaMark mark;
+  mark.block = arena->current;
+  mark.used = arena->current != NULL ? arena->current->used : 0;
+  return mark;
+}
+
+void arenaRelease(Arena *arena, ArenaMark mark) {
+  while (arena->current != mark.block) {
+    ArenaBlock *block = arena->current;
+    arena->current = block->previous;
+    // keep one block around, build/release cycles would malloc every time.
+    if (arena->spare == NULL || arena->spare->capacity < block->capacity) {
+      if (arena->spare != NULL)
+        freeBlock(arena, arena->spare);
+      arena->spare = block;
+    } else {
+      freeBlock(arena, block);
+    }
+  }
+  if (mark.block != NULL)
+    mark.block->used = mark.used;
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMMON_ARENA_H_
+#define YSCRIPT_COMMON_ARENA_H_
+
+#include "common/config.h"
+
+/**
+ * bump allocator for data that dies all at once, like the tables of the
+ * compiler. the memory comes straight from malloc(), it is not counted in
+ * vm.bytesAllocated and allocating never runs the garbage collector.
+ * nothing is freed one by one, arenaRelease() drops everything allocated
+ * after a mark and freeArena() drops the rest.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *previous;
+  size_t capacity;
+  size_t used;
+} ArenaBlock;
+
+typedef struct {
+  // block allocations are served from, the older ones are chained behind it
+  ArenaBlock *current;
+  // an empty block kept by arenaRelease() for the next allocations
+  ArenaBlock *spare;
+  // bytes of all blocks, the spare one included
+  size_t reserved;
+} Arena;
+
+typedef struct {
+  ArenaBlock *block;
+  size_t used;
+} ArenaMark;
+
+#define ARENA_ALLOCATE(arena, type, count)                                     \
+  static_cast<type *>(arenaAllocate(arena, sizeof(type) * (count)))
+
+#define ARENA_GROW_ARRAY(arena, type, pointer, oldCount, newCount)             \
+  static_cast<type *>(arenaGrow(arena, pointer, sizeof(type) * (oldCount),     \
+                                sizeof(type) * (newCount)))
+
+void initArena(Arena *arena);
+void freeArena(Arena *arena);
+
+void *arenaAllocate(Arena *arena, size_t size);
+// grows the last allocation in place, copies anything else
+void *arenaGrow(Arena *arena, void *pointer, size_t oldSize, size_t newSize);
+
+ArenaMark arenaMark(Arena *arena);
+// free everything allocated since the mark was taken
+void arenaRelease(Arena *arena, ArenaMark mark);
+
+#endif // YSCRIPT_COMMON_ARENA_H_
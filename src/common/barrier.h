@@ -0,0 +1,87 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMMON_BARRIER_H_
+#define YSCRIPT_COMMON_BARRIER_H_
+
+#include "common/config.h"
+#include "common/hashtable.h"
+#include "common/memory.h"
+#include "common/nursery.h"
+#include "common/ysobject.h"
+#include "vm/interp/interp.h"
+
+/**
+ * what the mutator does around a store into an object its constructor is
+ * done with. the collectors need to hear of two things:
+ *
+ * - an old object that points at a young one goes to the remembered set of
+ *   the minor collection, writeBarrier().
+ * - the marking of the old generation, in slices or on the marker thread,
+ *   marks what was reachable when it started, see collectSlice(). the
+ *   reference a store overwrites is marked first, overwriteBarrier().
+ *
+ * while the marker thread runs it reads the objects too, the store and the
+ * barriers go between beginHeapWrite() and endHeapWrite() then.
+ */
+
+// owner is about to point at value
+static inline void writeBarrier(Obj *owner, Value value) {
+  if (IS_OBJ(value) && isYoung(AS_OBJ(value)) && !owner->isRemembered &&
+      !isYoung(owner))
+    rememberObject(owner);
+}
+
+// owner is about to point at values too many to check one by one
+static inline void writeBarrierAll(Obj *owner) {
+  if (nursery.capacity != 0 && !owner->isRemembered && !isYoung(owner))
+    rememberObject(owner);
+}
+
+// a reference to old is about to be overwritten
+static inline void overwriteBarrier(Value old) {
+  if (vm.gcPhase == GC_MARKING && IS_OBJ(old))
+    markObject(AS_OBJ(old));
+}
+
+// the value of key in table is about to be overwritten
+static inline void overwriteEntryBarrier(Table *table, ObjString *key) {
+  Value old;
+  if (vm.gcPhase == GC_MARKING && tableGet(table, key, &old))
+    overwriteBarrier(old);
+}
+
+static inline void beginHeapWrite() {
+  if (vm.markerRunning)
+    lockHeap();
+}
+
+static inline void endHeapWrite() {
+  if (vm.markerRunning)
+    unlockHeap();
+}
+
+// vm.strings gave out a string it only holds weakly, the marking may not
+// have seen it
+static inline void internBarrier(ObjString *string) {
+  if (vm.gcPhase == GC_MARKING) {
+    beginHeapWrite();
+    markObject((Obj *)string);
+    endHeapWrite();
+  }
+}
+
+#endif // YSCRIPT_COMMON_BARRIER_H_
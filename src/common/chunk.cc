@@ -15,9 +15,11 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "common/chunk.h"
 #include "common/memory.h"
+#include "common/ysobject.h"
 #include "vm/interp/interp.h"
 
 void initChunk(Chunk *chunk) {
@@ -25,32 +27,190 @@ void initChunk(Chunk *chunk) {
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->lineStarts = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
   initValueArray(&chunk->constants);
+  chunk->arena = NULL;
 }
 
 void freeChunk(Chunk *chunk) {
+  // arena memory goes away with the arena.
+  if (chunk->arena != NULL) {
+    initChunk(chunk);
+    return;
+  }
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lineStarts, chunk->lineCapacity);
   freeValueArray(&chunk->constants);
   initChunk(chunk);
 }
 
+static void addLine(Chunk *chunk, int offset, int line) {
+  if (chunk->lineCount > 0 &&
+      chunk->lineStarts[chunk->lineCount - 1].line == line)
+    return;
+  if (chunk->lineCapacity < chunk->lineCount + 1) {
+    int oldCapacity = chunk->lineCapacity;
+    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->lineStarts = GROW_ARRAY(LineStart, chunk->lineStarts, oldCapacity,
+                                   chunk->lineCapacity);
+  }
+  LineStart *start = &chunk->lineStarts[chunk->lineCount++];
+  start->offset = offset;
+  start->line = line;
+}
+
 void writeChunk(Chunk *chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     int oldCapacity = chunk->capacity;
     chunk->capacity = GROW_CAPACITY(oldCapacity);
-    chunk->code =
-        GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    if (chunk->arena != NULL) {
+      chunk->code = ARENA_GROW_ARRAY(chunk->arena, uint8_t, chunk->code,
+                                     oldCapacity, chunk->capacity);
+      chunk->lines = ARENA_GROW_ARRAY(chunk->arena, int, chunk->lines,
+                                      oldCapacity, chunk->capacity);
+    } else {
+      chunk->code =
+          GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+    }
   }
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
+  if (chunk->arena != NULL) {
+    chunk->lines[chunk->count] = line;
+  } else {
+    addLine(chunk, chunk->count, line);
+  }
   chunk->count++;
 }
 
 int addConstant(Chunk *chunk, Value value) {
+  ValueArray *constants = &chunk->constants;
+  if (chunk->arena != NULL) {
+    if (constants->capacity < constants->count + 1) {
+      int oldCapacity = constants->capacity;
+      constants->capacity = GROW_CAPACITY(oldCapacity);
+      constants->values = ARENA_GROW_ARRAY(chunk->arena, Value,
+                                           constants->values, oldCapacity,
+                                           constants->capacity);
+    }
+    constants->values[constants->count++] = value;
+    return constants->count - 1;
+  }
+
   push(value);
-  writeValueArray(&chunk->constants, value);
+  writeValueArray(constants, value);
   pop();
-  return chunk->constants.count - 1;
+  return constants->count - 1;
+}
+
+void finishChunk(Chunk *chunk) {
+  if (chunk->arena == NULL)
+    return;
+  int lineCount = 0;
+  for (int offset = 0; offset < chunk->count; offset++) {
+    if (offset == 0 || chunk->lines[offset] != chunk->lines[offset - 1])
+      lineCount++;
+  }
+
+  // allocating may collect, the constants are still marked from the arena.
+  uint8_t *code = ALLOCATE(uint8_t, chunk->count);
+  LineStart *lineStarts = ALLOCATE(LineStart, lineCount);
+  Value *values = ALLOCATE(Value, chunk->constants.count);
+  if (chunk->count > 0)
+    memcpy(code, chunk->code, sizeof(uint8_t) * chunk->count);
+  if (chunk->constants.count > 0) {
+    memcpy(values, chunk->constants.values,
+           sizeof(Value) * chunk->constants.count);
+  }
+
+  chunk->lineStarts = lineStarts;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = lineCount;
+  for (int offset = 0; offset < chunk->count; offset++) {
+    if (offset == 0 || chunk->lines[offset] != chunk->lines[offset - 1]) {
+      LineStart *start = &lineStarts[chunk->lineCount++];
+      start->offset = offset;
+      start->line = chunk->lines[offset];
+    }
+  }
+
+  chunk->code = code;
+  chunk->lines = NULL;
+  chunk->capacity = chunk->count;
+  chunk->constants.values = values;
+  chunk->constants.capacity = chunk->constants.count;
+  chunk->arena = NULL;
+}
+
+int getLine(Chunk *chunk, int offset) {
+  if (chunk->lines != NULL)
+    return chunk->lines[offset];
+
+  // the last run starting at or before offset.
+  int low = 0;
+  int high = chunk->lineCount - 1;
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    if (chunk->lineStarts[middle].offset <= offset) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return chunk->lineCount > 0 ? chunk->lineStarts[low].line : 0;
+}
+
+int instructionLength(Chunk *chunk, int offset) {
+  switch (chunk->code[offset]) {
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_GET_SUPER:
+  case OP_CONSTANT:
+  case OP_CALL:
+  case OP_CLASS:
+  case OP_METHOD:
+    return 2;
+
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_INVOKE:
+  case OP_SUPER_INVOKE:
+    return 3;
+
+  case OP_CLOSURE: {
+    uint8_t constant = chunk->code[offset + 1];
+    ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+    return 2 + function->upvalueCount * 2;
+  }
+
+  case OP_WIDE:
+    switch (chunk->code[offset + 1]) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+      return 6;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+      return 5;
+    case OP_CLOSURE: {
+      int constant = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+      ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+      return 4 + function->upvalueCount * 3;
+    }
+    default:
+      return 4;
+    }
+
+  default:
+    return 1;
+  }
 }
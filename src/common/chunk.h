@@ -17,10 +17,17 @@
 #ifndef YSCRIPT_COMMON_CHUNK_H_
 #define YSCRIPT_COMMON_CHUNK_H_
 
+#include "common/arena.h"
 #include "common/config.h"
 #include "common/opcode.h"
 #include "common/ysvalue.h"
 
+// the line of the code from offset on, up to the next LineStart
+typedef struct {
+  int offset;
+  int line;
+} LineStart;
+
 typedef struct {
   // count
   int count;
@@ -28,15 +35,28 @@ typedef struct {
   int capacity;
   // chunk data
   uint8_t *code;
-  // chunk-lines
+  // line of every byte while the function is compiled, the optimizers move
+  // code and lines together. NULL once finishChunk() encoded them below
   int *lines;
+  // the lines as runs of code sharing a line, sorted by offset
+  LineStart *lineStarts;
+  int lineCount;
+  int lineCapacity;
   // chunk-constants
   ValueArray constants;
+  // code and constants grow in this arena while the function is compiled,
+  // NULL once finishChunk() moved them to the heap
+  Arena *arena;
 } Chunk;
 
 void initChunk(Chunk *chunk);
 void freeChunk(Chunk *chunk);
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
 int addConstant(Chunk *chunk, Value value);
+// move the code and constants out of the arena into exactly sized arrays
+void finishChunk(Chunk *chunk);
+int instructionLength(Chunk *chunk, int offset);
+// source line of the byte at offset
+int getLine(Chunk *chunk, int offset);
 
 #endif // YSCRIPT_COMMON_CHUNK_H_
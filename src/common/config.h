@@ -21,6 +21,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 // #define ENABLE_NAN_TAGGING
 
@@ -29,10 +30,10 @@
 
 // #define ENABLE_LOGGING
 
-// #define ENABLE_INTERP_TRACE
 #define ENABLE_COMPILE_TRACE
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #define YSCRIPT_UNREACHABLE(msg) abort();
 
@@ -0,0 +1,181 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/allocator.h"
+#include "common/gcstats.h"
+#include "vm/interp/interp.h"
+
+GCStats gcStats;
+
+void initGCStats() {
+  GCListener listener = gcStats.listener;
+  memset(&gcStats, 0, sizeof(gcStats));
+  gcStats.listener = listener;
+  gcStats.startNs = gcClockNs();
+}
+
+uint64_t gcClockNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int pauseBucket(uint64_t pauseNs) {
+  uint64_t us = pauseNs / 1000;
+  int bucket = 0;
+  while (us > 0 && bucket < GC_PAUSE_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+uint64_t recordPause(uint64_t startNs) {
+  uint64_t pauseNs = gcClockNs() - startNs;
+  gcStats.pauseCount++;
+  gcStats.totalPauseNs += pauseNs;
+  if (pauseNs > gcStats.maxPauseNs)
+    gcStats.maxPauseNs = pauseNs;
+  gcStats.pauses[pauseBucket(pauseNs)]++;
+  return pauseNs;
+}
+
+void recordCollection(uint64_t pauseNs, size_t bytesBefore, bool isMinor) {
+  GCCollection collection;
+  collection.pauseNs = pauseNs;
+  collection.bytesBefore = bytesBefore;
+  collection.bytesAfter = vm.bytesAllocated;
+  collection.nextGC = vm.nextGC;
+  collection.isMinor = isMinor;
+
+  gcStats.collections++;
+  if (isMinor) {
+    gcStats.minorCollections++;
+  } else {
+    // the old generation keeps its garbage through a minor collection
+    gcStats.lastLiveBytes = collection.bytesAfter;
+    if (collection.bytesAfter > gcStats.maxLiveBytes)
+      gcStats.maxLiveBytes = collection.bytesAfter;
+    gcStats.totalLiveBytes += collection.bytesAfter;
+  }
+
+  if (gcStats.listener != NULL)
+    gcStats.listener(&collection);
+}
+
+const char *objTypeName(ObjType type) {
+  switch (type) {
+  case OBJ_BOUND_METHOD:
+    return "bound method";
+  case OBJ_CLASS:
+    return "class";
+  case OBJ_CLOSURE:
+    return "closure";
+  case OBJ_FUNCTION:
+    return "function";
+  case OBJ_INSTANCE:
+    return "instance";
+  case OBJ_NATIVE:
+    return "native";
+  case OBJ_STRING:
+    return "string";
+  case OBJ_UPVALUE:
+    return "upvalue";
+  }
+  return "unknown";
+}
+
+static double megabytes(uint64_t bytes) {
+  return (double)bytes / (1024.0 * 1024.0);
+}
+
+static double milliseconds(uint64_t ns) { return (double)ns / 1e6; }
+
+void printGCStats(FILE *file) {
+  uint64_t elapsedNs = gcClockNs() - gcStats.startNs;
+  uint64_t mutatorNs = elapsedNs - gcStats.totalPauseNs;
+  uint64_t collections = gcStats.collections;
+
+  uint64_t fullCollections = collections - gcStats.minorCollections;
+
+  fprintf(file, "== gc: %" PRIu64 " collections, %" PRIu64 " minor ==\n",
+          collections, gcStats.minorCollections);
+  fprintf(file,
+          "pauses      %" PRIu64 ", total %.3f ms, max %.3f ms, mean %.3f ms\n",
+          gcStats.pauseCount, milliseconds(gcStats.totalPauseNs),
+          milliseconds(gcStats.maxPauseNs),
+          gcStats.pauseCount > 0
+              ? milliseconds(gcStats.totalPauseNs) / (double)gcStats.pauseCount
+              : 0.0);
+  fprintf(file, "overdue     %" PRIu64 " slices past the pause target\n",
+          gcStats.overdueSlices);
+  fprintf(file, "mutator     %.1f%% of %.3f ms\n",
+          elapsedNs > 0 ? 100.0 * (double)mutatorNs / (double)elapsedNs : 0.0,
+          milliseconds(elapsedNs));
+  fprintf(file, "allocated   %.3f MB, %.1f MB/s of mutator time\n",
+          megabytes(vm.bytesAllocatedTotal),
+          mutatorNs > 0 ? megabytes(vm.bytesAllocatedTotal) /
+                              ((double)mutatorNs / 1e9)
+                        : 0.0);
+  fprintf(file, "freed       %.3f MB\n", megabytes(gcStats.bytesFreed));
+  fprintf(file, "promoted    %.3f MB\n", megabytes(gcStats.promotedBytes));
+  fprintf(file,
+          "compacted   %" PRIu64 " times, %.3f MB moved, %.3f MB reclaimed\n",
+          gcStats.compactions, megabytes(gcStats.compactedBytes),
+          megabytes(gcStats.reclaimedBytes));
+  fprintf(file, "live        %.3f MB now, after full gc %.3f MB last, "
+                "%.3f MB max, %.3f MB mean\n",
+          megabytes(vm.bytesAllocated), megabytes(gcStats.lastLiveBytes),
+          megabytes(gcStats.maxLiveBytes),
+          fullCollections > 0
+              ? megabytes(gcStats.totalLiveBytes) / (double)fullCollections
+              : 0.0);
+  fprintf(file, "next gc     at %.3f MB\n", megabytes(vm.nextGC));
+  AllocatorStats allocator = allocatorStats();
+  fprintf(file,
+          "pages       %zu in use, %zu empty, %.3f MB of small blocks, "
+          "%" PRIu64 " mapped, %" PRIu64 " unmapped\n",
+          allocator.pagesInUse, allocator.pagesCached,
+          megabytes(allocator.bytesInUse), allocator.pagesMapped,
+          allocator.pagesUnmapped);
+
+  fprintf(file, "== gc pauses ==\n");
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    if (gcStats.pauses[i] == 0)
+      continue;
+    char range[32];
+    if (i == 0) {
+      snprintf(range, sizeof(range), "< 1");
+    } else if (i == GC_PAUSE_BUCKETS - 1) {
+      snprintf(range, sizeof(range), ">= %d", 1 << (i - 1));
+    } else {
+      snprintf(range, sizeof(range), "%d - %d", 1 << (i - 1), 1 << i);
+    }
+    fprintf(file, "%18s us %10" PRIu64 "\n", range, gcStats.pauses[i]);
+  }
+
+  fprintf(file, "== objects ==\n");
+  fprintf(file, "%-14s %14s %14s\n", "type", "allocated", "live");
+  for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    fprintf(file, "%-14s %14" PRIu64 " %14" PRIu64 "\n",
+            objTypeName((ObjType)type), gcStats.allocatedObjects[type],
+            gcStats.liveObjects[type]);
+  }
+}
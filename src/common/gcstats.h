@@ -0,0 +1,96 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMMON_GCSTATS_H_
+#define YSCRIPT_COMMON_GCSTATS_H_
+
+#include <stdio.h>
+
+#include "common/config.h"
+#include "common/ysobject.h"
+
+/**
+ * counters of the garbage collector, always on. they are reset by initVM()
+ * and read by the embedder, or printed by ysrun --gc-stats.
+ */
+
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
+// bucket 0 counts the pauses below 1us, bucket i those below 2^i us, the
+// last one everything longer
+#define GC_PAUSE_BUCKETS 24
+
+// one collection, handed to the listener
+typedef struct {
+  // all of its pauses, an incremental collection has many
+  uint64_t pauseNs;
+  size_t bytesBefore;
+  // the live bytes the collection left
+  size_t bytesAfter;
+  size_t nextGC;
+  // a collection of the nursery only
+  bool isMinor;
+} GCCollection;
+
+typedef void (*GCListener)(const GCCollection *collection);
+
+typedef struct {
+  // all of them, the minor ones included
+  uint64_t collections;
+  uint64_t minorCollections;
+  // every time the mutator stood still, a slice of an incremental
+  // collection is one
+  uint64_t pauseCount;
+  uint64_t totalPauseNs;
+  uint64_t maxPauseNs;
+  uint64_t pauses[GC_PAUSE_BUCKETS];
+  // the slices that ignored the pause target, their cycle fell behind the
+  // allocations
+  uint64_t overdueSlices;
+  // vm.bytesAllocatedTotal counts the other direction
+  uint64_t bytesFreed;
+  // the young bytes minor collections copied to the old generation
+  uint64_t promotedBytes;
+  // the compactions of the old generation, the bytes they moved and the
+  // bytes of the object pages they emptied
+  uint64_t compactions;
+  uint64_t compactedBytes;
+  uint64_t reclaimedBytes;
+  // the live bytes after the full collections
+  size_t lastLiveBytes;
+  size_t maxLiveBytes;
+  uint64_t totalLiveBytes;
+  uint64_t allocatedObjects[OBJ_TYPE_COUNT];
+  uint64_t liveObjects[OBJ_TYPE_COUNT];
+  // when initGCStats() ran, the mutator time is the rest of the time since
+  uint64_t startNs;
+  // called after every collection, survives initGCStats()
+  GCListener listener;
+} GCStats;
+
+extern GCStats gcStats;
+
+void initGCStats();
+uint64_t gcClockNs();
+// count the pause that started at startNs, returns its length
+uint64_t recordPause(uint64_t startNs);
+// count the collection that paused for pauseNs with bytesBefore allocated
+void recordCollection(uint64_t pauseNs, size_t bytesBefore, bool isMinor);
+const char *objTypeName(ObjType type);
+
+void printGCStats(FILE *file);
+
+#endif // YSCRIPT_COMMON_GCSTATS_H_
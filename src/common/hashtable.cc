@@ -143,6 +143,15 @@ bool tableDelete(Table *table, ObjString *key) {
   return true;
 }
 
+void tableReplaceKey(Table *table, ObjString *key, ObjString *moved) {
+  if (table->count == 0)
+    return;
+
+  Entry *entry = findEntry(table->entries, table->capacity, key);
+  if (entry->key == key)
+    entry->key = moved;
+}
+
 void tableAddAll(Table *from, Table *to) {
   for (int i = 0; i < from->capacity; i++) {
     Entry *entry = &from->entries[i];
@@ -186,7 +195,7 @@ ObjString *tableFindString(Table *table, const char *chars, int length,
 void tableRemoveWhite(Table *table) {
   for (int i = 0; i < table->capacity; i++) {
     Entry *entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.isMarked) {
+    if (entry->key != NULL && !isMarked((Obj *)entry->key)) {
       tableDelete(table, entry->key);
     }
   }
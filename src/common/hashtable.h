@@ -37,6 +37,8 @@ void freeTable(Table* table);
 bool tableGet(Table* table, ObjString* key, Value* value);
 bool tableSet(Table* table, ObjString* key, Value value);
 bool tableDelete(Table* table, ObjString* key);
+// the entry of key keeps its slot under the moved copy of the key
+void tableReplaceKey(Table* table, ObjString* key, ObjString* moved);
 
 void tableAddAll(Table* from, Table* to);
 
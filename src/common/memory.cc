@@ -14,45 +14,240 @@
  * limitations under the License.
  */
 
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <atomic>
+#include <thread> // NOLINT
+
+#include "common/allocator.h"
+#include "common/barrier.h"
+#include "common/gcstats.h"
 #include "common/memory.h"
+#include "common/nursery.h"
 #include "compiler/parser.h"
+#include "threads/spinlock.h"
+#include "vm/interp/allocsites.h"
 #include "vm/interp/interp.h"
+#include "vm/interp/profiler.h"
+#include "vm/interp/stats.h"
 
 #ifdef ENABLE_GC_LOGGING
 #include "disassembler/disassembler.h"
 #endif
 
 #define GC_HEAP_GROW_FACTOR 2
+#define GC_NURSERY_SIZE (256 * 1024)
+// the allocation between two slices of an incremental collection
+#define GC_SLICE_BYTES (64 * 1024)
+// the objects a slice handles between two looks at the clock
+#define GC_SLICE_CHECK 32
+// the gray objects the marker thread takes at a time, under the heap lock
+#define GC_MARK_BATCH 64
+// the most threads a full collection runs on
+#define GC_MAX_THREADS 64
+// the object pages a slice of a lazy sweep gets through
+#define GC_SWEEP_PAGES 16
+// the free bytes of the object pages a compaction needs to pay off
+#define GC_COMPACT_MIN_BYTES (4 * ALLOCATOR_PAGE_SIZE)
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
-  vm.bytesAllocated += newSize - oldSize;
-  if (newSize > oldSize) {
+GCPolicy gcPolicy = {1024 * 1024, GC_HEAP_GROW_FACTOR, 0, SIZE_MAX, 0,
+                     GC_NURSERY_SIZE, 0, false, 1, false, false, 0};
+
+/**
+ * a thread of a parallel full collection. its gray stack is shared, the
+ * others steal from it once theirs run dry.
+ */
+typedef struct {
+  base::SpinLock lock;
+  Obj **gray;
+  int grayCount;
+  int grayCapacity;
+  // what its sweep freed, added to the heap counters after the sweep
+  size_t bytesFreed;
+  uint64_t freedObjects[OBJ_TYPE_COUNT];
+} GCWorker;
+
+static GCWorker workers[GC_MAX_THREADS];
+static int workerCount;
+// the workers that still find gray objects
+static std::atomic<int> activeWorkers;
+// the worker of this thread, NULL outside of a parallel collection
+static thread_local GCWorker *currentWorker;
+
+// sweeps the pages nobody else got to yet, see startSweeper()
+static GCWorker sweeper;
+static std::thread *sweeperThread;
+static std::atomic<bool> sweeperStop;
+static std::atomic<bool> sweeperDone;
+
+static base::SpinLock heapLock;
+// a pointer, a script that exits with the marker running leaves it be
+static std::thread *markerThread;
+static std::atomic<bool> markerStop;
+static std::atomic<bool> markerDone;
+
+void lockHeap() { heapLock.lock(); }
+
+void unlockHeap() { heapLock.unlock(); }
+
+// SIGPROF samples the frames of the mutator, a GC thread must never take it.
+// the thread inherits the signal mask it is created with, so it is blocked
+// before the thread runs at all.
+template <typename Function, typename... Args>
+static std::thread startGCThread(Function function, Args... args) {
+  sigset_t profile;
+  sigset_t saved;
+  sigemptyset(&profile);
+  sigaddset(&profile, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &profile, &saved);
+  std::thread thread(function, args...);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  return thread;
+}
+
+// the old generation is collected a slice at a time
+static bool isIncremental() {
+  return gcPolicy.pauseTargetNs != 0 || gcPolicy.concurrentMarking;
+}
+
+// the allocation still succeeds, the interpreter raises the error at its
+// next safepoint
+static void checkHeapLimit() {
+  if (gcPolicy.heapLimit != 0 && vm.bytesAllocated > gcPolicy.heapLimit) {
+    vm.outOfMemory = true;
+    vm.safepointRequested = true;
+  }
+}
+
+static void requestSlice() {
+  vm.sliceRequested = true;
+  vm.sliceBytes = 0;
+  vm.safepointRequested = true;
+}
+
+void heapGrew(size_t bytes) {
+  vm.bytesAllocatedTotal += bytes;
+  vm.allocationCount++;
 #ifdef ENABLE_FORCE_GC
+  // an incremental collection would never get past its first slice
+  if (isIncremental())
+    requestSlice();
+  else
     collectGarbage();
+  if (nursery.capacity != 0)
+    requestYoungCollection();
 #endif
-    if (vm.bytesAllocated > vm.nextGC) {
-      collectGarbage();
-    }
+  if (vm.gcPhase != GC_IDLE) {
+    // the collection keeps pace with the allocations
+    vm.sliceBytes += bytes;
+    if (vm.sliceBytes >= GC_SLICE_BYTES)
+      requestSlice();
+    return;
   }
-  if (newSize == 0) {
-    free(pointer);
+  if (vm.bytesAllocated > vm.nextGC) {
+    // most of the bytes are young garbage, see collectRequested()
+    if (nursery.capacity != 0)
+      requestYoungCollection();
+    if (isIncremental())
+      requestSlice();
+    if (nursery.capacity != 0 || isIncremental())
+      return;
+    collectGarbage();
+    checkHeapLimit();
+  }
+}
+
+void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+  // only the frees of a parallel sweep get here on a worker
+  if (currentWorker != NULL) {
+    currentWorker->bytesFreed += oldSize;
+    freeBlock(pointer, oldSize);
     return NULL;
   }
+  vm.bytesAllocated += newSize - oldSize;
+  if (newSize < oldSize)
+    gcStats.bytesFreed += oldSize - newSize;
+  if (newSize > oldSize)
+    heapGrew(newSize - oldSize);
+  return reallocateBlock(pointer, oldSize, newSize);
+}
 
-  void *result = realloc(pointer, newSize);
-  if (result == NULL)
-    exit(1);
-  return result;
+/**
+ * black while the old generation is marked, the marking only looks for the
+ * objects that were there when it started. the sweep never sees a new one,
+ * the pages it has yet to visit hand out no blocks.
+ */
+static Obj *shadeNew(Obj *object) {
+  if (vm.gcPhase == GC_MARKING)
+    setMarked(object);
+  return object;
+}
+
+Obj *allocateOld(size_t size) {
+  vm.bytesAllocated += size;
+  heapGrew(size);
+  Obj *object = (Obj *)allocateObjectBlock(size);
+  beginHeapWrite();
+  shadeNew(object);
+  endHeapWrite();
+  return object;
+}
+
+static void pushGray(Obj *object) {
+  if (vm.grayCapacity < vm.grayCount + 1) {
+    vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+    vm.grayStack =
+        (Obj **)realloc(vm.grayStack, sizeof(Obj *) * vm.grayCapacity);
+
+    if (vm.grayStack == NULL)
+      exit(1);
+  }
+  vm.grayStack[vm.grayCount++] = object;
+}
+
+static void pushWork(GCWorker *worker, Obj *object) {
+  worker->lock.lock();
+  if (worker->grayCapacity < worker->grayCount + 1) {
+    worker->grayCapacity = GROW_CAPACITY(worker->grayCapacity);
+    worker->gray =
+        (Obj **)realloc(worker->gray, sizeof(Obj *) * worker->grayCapacity);
+
+    if (worker->gray == NULL)
+      exit(1);
+  }
+  worker->gray[worker->grayCount++] = object;
+  worker->lock.unlock();
+}
+
+// the other workers may reach the object at the same time, one of them
+// gets to push it
+static void markShared(Obj *object, uint64_t *word, uint64_t bit) {
+  if (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit)
+    return;
+  pushWork(currentWorker, object);
 }
 
 void markObject(Obj *object) {
   if (object == NULL)
     return;
-  if (object->isMarked)
+  // the young objects all came after the marking started, see
+  // collectSlice()
+  if (vm.gcPhase == GC_MARKING && isYoung(object))
     return;
+  uint64_t bit;
+  uint64_t *word = markWord(object, &bit);
+  // most references lead to an object marked already
+  if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+    return;
+  if (currentWorker != NULL) {
+    markShared(object, word, bit);
+    return;
+  }
 
 #ifdef ENABLE_GC_LOGGING
   printf("%p mark ", (void *)object);
@@ -60,16 +255,8 @@ void markObject(Obj *object) {
   printf("\n");
 #endif
 
-  object->isMarked = true;
-  if (vm.grayCapacity < vm.grayCount + 1) {
-    vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-    vm.grayStack =
-        (Obj **)realloc(vm.grayStack, sizeof(Obj *) * vm.grayCapacity);
-
-    if (vm.grayStack == NULL)
-      exit(1);
-  }
-  vm.grayStack[vm.grayCount++] = object;
+  *word |= bit;
+  pushGray(object);
 }
 
 void markValue(Value value) {
@@ -138,61 +325,87 @@ static void blackenObject(Obj *object) {
   }
 }
 
-static void freeObject(Obj *object) {
-#ifdef ENABLE_GC_LOGGING
-  printf("%p free type %d\n", (void *)object, object->type);
-#endif
-
+// free what the object owns, not the object itself
+static void releaseObject(Obj *object) {
   switch (object->type) {
-  case OBJ_BOUND_METHOD:
-    FREE(ObjBoundMethod, object);
+  case OBJ_CLASS:
+    freeTable(&((ObjClass *)object)->methods);
     break;
 
-  case OBJ_CLASS: {
-    ObjClass *klass = (ObjClass *)object;
-    freeTable(&klass->methods);
-    FREE(ObjClass, object);
-    break;
-  } // [braces]
-
   case OBJ_CLOSURE: {
     ObjClosure *closure = (ObjClosure *)object;
     FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-    FREE(ObjClosure, object);
     break;
   }
 
   case OBJ_FUNCTION: {
     ObjFunction *function = (ObjFunction *)object;
+    if (function->statsIndex != -1)
+      forgetFunctionStats(function);
     freeChunk(&function->chunk);
-    FREE(ObjFunction, object);
-    break;
-  }
-
-  case OBJ_INSTANCE: {
-    ObjInstance *instance = (ObjInstance *)object;
-    freeTable(&instance->fields);
-    FREE(ObjInstance, object);
     break;
   }
 
-  case OBJ_NATIVE:
-    FREE(ObjNative, object);
+  case OBJ_INSTANCE:
+    freeTable(&((ObjInstance *)object)->fields);
     break;
 
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
     FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(ObjString, object);
     break;
   }
 
+  case OBJ_BOUND_METHOD:
+  case OBJ_NATIVE:
   case OBJ_UPVALUE:
-    FREE(ObjUpvalue, object);
     break;
   }
 }
 
+// the sweep gives its memory back to the page, see sweepPage()
+static void freeObject(Obj *object) {
+#ifdef ENABLE_GC_LOGGING
+  printf("%p free type %d\n", (void *)object, object->type);
+#endif
+  size_t size = objectSize(object->type);
+  releaseObject(object);
+  if (object->site != 0)
+    releaseSample(object);
+  if (currentWorker != NULL) {
+    currentWorker->freedObjects[object->type]++;
+    currentWorker->bytesFreed += size;
+    return;
+  }
+  gcStats.liveObjects[object->type]--;
+  vm.bytesAllocated -= size;
+  gcStats.bytesFreed += size;
+}
+
+// what the dead young objects have there, see promote()
+#define FORWARDING(object) (*(Obj **)((object) + 1))
+
+// the memory of a young object stays in the nursery until it starts over
+static void freeYoung(Obj *object) {
+#ifdef ENABLE_GC_LOGGING
+  printf("%p free young type %d\n", (void *)object, object->type);
+#endif
+  size_t size = objectSize(object->type);
+  gcStats.liveObjects[object->type]--;
+  releaseObject(object);
+  if (object->site != 0)
+    releaseSample(object);
+  vm.bytesAllocated -= size;
+  gcStats.bytesFreed += size;
+  object->isForwarded = true;
+  FORWARDING(object) = NULL;
+}
+
+#define FOR_EACH_YOUNG(object)                                                 \
+  for (Obj *object = (Obj *)nursery.start; (uint8_t *)object < nursery.top;   \
+       object = (Obj *)((uint8_t *)object +                                   \
+                        NURSERY_ALIGN(objectSize(object->type))))
+
 static void markRoots() {
   for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
     markValue(*slot);
@@ -209,6 +422,30 @@ static void markRoots() {
   markObject((Obj *)vm.initString);
 }
 
+void visitRoots(void (*visit)(RootKind kind, ObjString *name, Obj *object)) {
+  for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
+    if (IS_OBJ(*slot))
+      visit(ROOT_STACK, NULL, AS_OBJ(*slot));
+  }
+  for (int i = 0; i < vm.frameCount; i++) {
+    visit(ROOT_FRAME, NULL, (Obj *)vm.frames[i].closure);
+  }
+  for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL;
+       upvalue = upvalue->next) {
+    visit(ROOT_UPVALUE, NULL, (Obj *)upvalue);
+  }
+  for (int i = 0; i < vm.globals.capacity; i++) {
+    Entry *entry = &vm.globals.entries[i];
+    if (entry->key == NULL)
+      continue;
+    visit(ROOT_GLOBAL, entry->key, (Obj *)entry->key);
+    if (IS_OBJ(entry->value))
+      visit(ROOT_GLOBAL, entry->key, AS_OBJ(entry->value));
+  }
+  if (vm.initString != NULL)
+    visit(ROOT_VM, NULL, (Obj *)vm.initString);
+}
+
 static void traceReferences() {
   while (vm.grayCount > 0) {
     Obj *object = vm.grayStack[--vm.grayCount];
@@ -216,43 +453,471 @@ static void traceReferences() {
   }
 }
 
+/**
+ * the sweep goes through the object pages there were when the marking was
+ * done, the ones that came later hold nothing it could free. a page is
+ * swept by whoever claims it first: a slice of the collection, the
+ * allocator once it runs out of blocks of the size class of the page, see
+ * sweepForRefill(), or the sweeper thread. on a page it frees the objects
+ * whose bit in page->objects has none in page->marks, a word of the bitmaps
+ * at a time, and clears the marks for the next cycle.
+ */
+
+static Page **sweepPages;
+static int sweepPageCount;
+static int sweepPageCapacity;
+static std::atomic<int> nextSweepPage;
+// sweepPages again, by size class
+static Page **classPages;
+static int classNext[ALLOCATOR_SIZE_CLASSES];
+static int classEnd[ALLOCATOR_SIZE_CLASSES];
+// the dead functions the sweeper thread leaves to the mutator
+static Obj **deadFunctions;
+static int deadFunctionCount;
+static int deadFunctionCapacity;
+
+static void sweepForRefill(int sizeClass);
+
+static void startSweep() {
+  holdObjectPages();
+  setObjectRefillHook(sweepForRefill);
+  int count;
+  Page **pages = objectPages(&count);
+  if (sweepPageCapacity < count) {
+    sweepPageCapacity = count;
+    sweepPages =
+        (Page **)realloc(sweepPages, sizeof(Page *) * sweepPageCapacity);
+    classPages =
+        (Page **)realloc(classPages, sizeof(Page *) * sweepPageCapacity);
+    if (sweepPages == NULL || classPages == NULL)
+      exit(1);
+  }
+  memcpy(sweepPages, pages, sizeof(Page *) * count);
+  sweepPageCount = count;
+  nextSweepPage = 0;
+
+  memset(classEnd, 0, sizeof(classEnd));
+  for (int i = 0; i < count; i++) {
+    classEnd[pages[i]->sizeClass]++;
+  }
+  int first = 0;
+  for (int sizeClass = 0; sizeClass < ALLOCATOR_SIZE_CLASSES; sizeClass++) {
+    classNext[sizeClass] = first;
+    first += classEnd[sizeClass];
+    classEnd[sizeClass] = classNext[sizeClass];
+  }
+  for (int i = 0; i < count; i++) {
+    classPages[classEnd[pages[i]->sizeClass]++] = pages[i];
+  }
+}
+
+// true for the one thread that gets to sweep the page
+static bool claimPage(Page *page) {
+  return __atomic_exchange_n(&page->unswept, false, __ATOMIC_ACQ_REL);
+}
+
+static void deferFunction(Obj *function) {
+  if (deadFunctionCapacity < deadFunctionCount + 1) {
+    deadFunctionCapacity = GROW_CAPACITY(deadFunctionCapacity);
+    deadFunctions = (Obj **)realloc(deadFunctions,
+                                    sizeof(Obj *) * deadFunctionCapacity);
+    if (deadFunctions == NULL)
+      exit(1);
+  }
+  deadFunctions[deadFunctionCount++] = function;
+}
+
+// true if the page has blocks to hand out again
+static bool sweepPage(Page *page) {
+  void *freed = NULL;
+  void *last = NULL;
+  int count = 0;
+  // nothing past bump was ever handed out
+  size_t words =
+      ((size_t)(page->bump - (uint8_t *)page) / PAGE_GRANULE + 63) / 64;
+  for (size_t i = 0; i < words; i++) {
+    uint64_t dead = page->objects[i] & ~page->marks[i];
+    page->objects[i] &= page->marks[i];
+    page->marks[i] = 0;
+    while (dead != 0) {
+      int bit = __builtin_ctzll(dead);
+      dead &= dead - 1;
+      Obj *object =
+          (Obj *)((uint8_t *)page + (size_t)(i * 64 + bit) * PAGE_GRANULE);
+      // the stats and the profiler of the mutator know the functions
+      if (currentWorker == &sweeper && object->type == OBJ_FUNCTION) {
+        page->objects[i] |= (uint64_t)1 << bit;
+        deferFunction(object);
+        continue;
+      }
+      freeObject(object);
+      // in address order, the way the page hands them out again
+      if (last != NULL)
+        *(void **)last = object;
+      else
+        freed = object;
+      last = object;
+      count++;
+    }
+  }
+  return returnObjectBlocks(page, freed, last, count);
+}
+
+// true once every page is swept, budget pages at most
+static bool sweepSlice(uint64_t deadline, int budget) {
+  drainProfiler();
+  for (int swept = 0; swept < budget;) {
+    int index = nextSweepPage++;
+    if (index >= sweepPageCount)
+      return true;
+    if (!claimPage(sweepPages[index]))
+      continue;
+    sweepPage(sweepPages[index]);
+    swept++;
+    if (gcClockNs() >= deadline)
+      break;
+  }
+  return nextSweepPage >= sweepPageCount;
+}
+
+// the allocator ran out of blocks of the size class, its pages the sweep
+// has yet to visit may have some
+static void sweepForRefill(int sizeClass) {
+  if (vm.gcPhase != GC_SWEEPING)
+    return;
+  drainProfiler();
+  while (classNext[sizeClass] < classEnd[sizeClass]) {
+    Page *page = classPages[classNext[sizeClass]++];
+    if (claimPage(page) && sweepPage(page))
+      return;
+  }
+}
+
 static void sweep() {
-  Obj *previous = NULL;
-  Obj *object = vm.objects;
-  while (object != NULL) {
-    if (object->isMarked) {
-
-      object->isMarked = false;
-
-      previous = object;
-      object = object->next;
-    } else {
-      Obj *unreached = object;
-      object = object->next;
-      if (previous != NULL) {
-        previous->next = object;
-      } else {
-        vm.objects = object;
+  startSweep();
+  sweepSlice(UINT64_MAX, INT_MAX);
+}
+
+// an unfinished marking leaves its marks on the pages
+static void clearMarks() {
+  int count;
+  Page **pages = objectPages(&count);
+  for (int i = 0; i < count; i++) {
+    memset(pages[i]->marks, 0, sizeof(pages[i]->marks));
+  }
+}
+
+/**
+ * a full collection with gcPolicy.gcThreads > 1 marks and sweeps on that
+ * many threads, the mutator thread one of them. the gray objects of the
+ * roots are dealt out to the workers, each blackens from its own gray stack
+ * and pushes what it marks there. a worker that runs dry steals a batch
+ * from the top of another one's stack, the marking is done once all of
+ * them ran dry. the sweep hands out the object pages one at a time.
+ */
+
+static void workOn(void (*work)(GCWorker *), GCWorker *worker) {
+  currentWorker = worker;
+  work(worker);
+  currentWorker = NULL;
+  if (worker != &workers[0])
+    flushThreadCache();
+}
+
+static void runWorkers(void (*work)(GCWorker *)) {
+  std::thread threads[GC_MAX_THREADS];
+  for (int i = 1; i < workerCount; i++) {
+    threads[i] = startGCThread(workOn, work, &workers[i]);
+  }
+  workOn(work, &workers[0]);
+  for (int i = 1; i < workerCount; i++) {
+    threads[i].join();
+  }
+}
+
+// the whole batch from the own stack, half of another one's
+static int takeWork(GCWorker *worker, GCWorker *from, Obj **batch) {
+  from->lock.lock();
+  int count = from == worker ? from->grayCount : (from->grayCount + 1) / 2;
+  if (count > GC_MARK_BATCH)
+    count = GC_MARK_BATCH;
+  from->grayCount -= count;
+  memcpy(batch, from->gray + from->grayCount, sizeof(Obj *) * count);
+  from->lock.unlock();
+  return count;
+}
+
+static bool hasWork(GCWorker *worker) {
+  worker->lock.lock();
+  bool result = worker->grayCount > 0;
+  worker->lock.unlock();
+  return result;
+}
+
+/**
+ * false once all the workers ran dry. a worker only pushes to its own stack
+ * and empties it before it gets here, so none is left with gray objects
+ * once the last one is idle.
+ */
+static bool waitForWork() {
+  activeWorkers--;
+  for (;;) {
+    for (int i = 0; i < workerCount; i++) {
+      if (hasWork(&workers[i])) {
+        activeWorkers++;
+        return true;
       }
+    }
+    if (activeWorkers == 0)
+      return false;
+    std::this_thread::yield();
+  }
+}
 
-      freeObject(unreached);
+static void markWorker(GCWorker *worker) {
+  Obj *batch[GC_MARK_BATCH];
+  int self = (int)(worker - workers);
+  for (;;) {
+    int count = takeWork(worker, worker, batch);
+    for (int i = 1; count == 0 && i < workerCount; i++) {
+      count = takeWork(worker, &workers[(self + i) % workerCount], batch);
     }
+    if (count == 0) {
+      if (waitForWork())
+        continue;
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      blackenObject(batch[i]);
+    }
+  }
+}
+
+static void traceParallel() {
+  for (int i = 0; i < vm.grayCount; i++) {
+    pushWork(&workers[i % workerCount], vm.grayStack[i]);
+  }
+  vm.grayCount = 0;
+  activeWorkers = workerCount;
+  runWorkers(markWorker);
+}
+
+static void sweepWorker(GCWorker *) {
+  while (!sweeperStop) {
+    int index = nextSweepPage++;
+    if (index >= sweepPageCount)
+      return;
+    if (claimPage(sweepPages[index]))
+      sweepPage(sweepPages[index]);
+  }
+}
+
+// what the sweep of the worker freed comes off the heap
+static void collectWorker(GCWorker *worker) {
+  vm.bytesAllocated -= worker->bytesFreed;
+  gcStats.bytesFreed += worker->bytesFreed;
+  worker->bytesFreed = 0;
+  for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    gcStats.liveObjects[type] -= worker->freedObjects[type];
+    worker->freedObjects[type] = 0;
+  }
+}
+
+static void sweepParallel() {
+  startSweep();
+  runWorkers(sweepWorker);
+  for (int i = 0; i < workerCount; i++) {
+    collectWorker(&workers[i]);
+  }
+}
+
+/**
+ * with gcPolicy.sweepThread the sweeper thread takes the pages in order
+ * while the script runs, the mutator sweeps the ones of a size class it
+ * needs blocks of itself. the sweeper frees through a worker of its own,
+ * what it freed comes off the heap once it is done.
+ */
+
+static void sweepInBackground() {
+  workOn(sweepWorker, &sweeper);
+  sweeperDone = true;
+}
+
+static void startSweeper() {
+  sweeperStop = false;
+  sweeperDone = false;
+  sweeperThread = new std::thread(startGCThread(sweepInBackground));
+}
+
+static void stopSweeper() {
+  sweeperStop = true;
+  sweeperThread->join();
+  delete sweeperThread;
+  sweeperThread = NULL;
+  sweeperStop = false;
+  collectWorker(&sweeper);
+
+  drainProfiler();
+  for (int i = 0; i < deadFunctionCount; i++) {
+    Obj *function = deadFunctions[i];
+    Page *page = pageOf(function);
+    size_t granule = granuleOf(function);
+    page->objects[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+    freeObject(function);
+    returnObjectBlocks(page, function, function, 1);
   }
+  deadFunctionCount = 0;
+}
+
+// the rest of the sweep goes on while the script runs, see collectSlice()
+static void sweepLater() {
+  vm.gcPhase = GC_SWEEPING;
+  if (gcPolicy.sweepThread)
+    startSweeper();
+}
+
+// the heap grows back to the next threshold on the empty pages it keeps,
+// the ones beyond go back to the OS
+static void trimHeap() {
+  size_t room = 0;
+  if (vm.nextGC > vm.bytesAllocated)
+    room = vm.nextGC - vm.bytesAllocated;
+  trimPages(room);
+}
+
+// after a full collection swept every page, see compactHeap()
+static void checkFragmentation() {
+  if (gcPolicy.compactThreshold <= 0)
+    return;
+  int count;
+  Page **pages = objectPages(&count);
+  size_t freeBytes = 0;
+  for (int i = 0; i < count; i++) {
+    freeBytes += (size_t)(pages[i]->capacity - pages[i]->used) *
+                 (size_t)pages[i]->blockSize;
+  }
+  if (freeBytes >= GC_COMPACT_MIN_BYTES &&
+      (double)freeBytes >
+          gcPolicy.compactThreshold * (double)count * ALLOCATOR_PAGE_SIZE) {
+    vm.compactionRequested = true;
+    vm.safepointRequested = true;
+  }
+}
+
+// a full collection does not move anything, the dead young objects stay
+// where they are until the next minor collection
+static void sweepNursery() {
+  FOR_EACH_YOUNG(object) {
+    if (object->isForwarded)
+      continue;
+    if (!isMarked(object))
+      freeYoung(object);
+  }
+  if (nursery.marks != NULL)
+    memset(nursery.marks, 0, NURSERY_MARK_WORDS(nursery.capacity) * 8);
+}
+
+// before the sweep frees the dead ones
+static void pruneRemembered() {
+  int count = 0;
+  for (int i = 0; i < nursery.rememberedCount; i++) {
+    Obj *object = nursery.remembered[i];
+    if (isMarked(object))
+      nursery.remembered[count++] = object;
+  }
+  nursery.rememberedCount = count;
+}
+
+static size_t heapThreshold(size_t liveBytes) {
+  double grown = (double)liveBytes * gcPolicy.growFactor;
+  size_t threshold = grown >= (double)SIZE_MAX ? SIZE_MAX : (size_t)grown;
+  if (threshold < gcPolicy.minHeap)
+    threshold = gcPolicy.minHeap;
+  if (threshold > gcPolicy.maxHeap)
+    threshold = gcPolicy.maxHeap;
+  // collect before the heap crosses the limit, not after
+  if (gcPolicy.heapLimit != 0 && threshold > gcPolicy.heapLimit)
+    threshold = gcPolicy.heapLimit;
+  return threshold;
+}
+
+size_t initialHeapThreshold() {
+  size_t threshold = gcPolicy.initialHeap;
+  if (gcPolicy.heapLimit != 0 && threshold > gcPolicy.heapLimit)
+    threshold = gcPolicy.heapLimit;
+  return threshold;
+}
+
+static void stopMarker() {
+  markerStop = true;
+  markerThread->join();
+  delete markerThread;
+  markerThread = NULL;
+  vm.markerRunning = false;
+}
+
+// an atomic collection takes nothing over from an incremental one, it
+// finishes the sweep of one
+static void abandonCycle() {
+  if (vm.markerRunning)
+    stopMarker();
+  if (sweeperThread != NULL)
+    stopSweeper();
+  if (vm.gcPhase == GC_MARKING) {
+    clearMarks();
+    vm.grayCount = 0;
+  } else if (vm.gcPhase == GC_SWEEPING) {
+    sweepSlice(UINT64_MAX, INT_MAX);
+    recordCollection(vm.cyclePauseNs, vm.cycleBytesBefore, false);
+  }
+  vm.gcPhase = GC_IDLE;
 }
 
 void collectGarbage() {
 #ifdef ENABLE_GC_LOGGING
   printf("-- gc begin\n");
-  size_t before = vm.bytesAllocated;
 #endif
+  uint64_t start = gcClockNs();
+  size_t before = vm.bytesAllocated;
+  abandonCycle();
+
+  // resolve the profiler samples while every function they saw is alive.
+  drainProfiler();
+
+  workerCount = gcPolicy.gcThreads;
+  if (workerCount > GC_MAX_THREADS)
+    workerCount = GC_MAX_THREADS;
 
   markRoots();
-  traceReferences();
+  if (workerCount > 1)
+    traceParallel();
+  else
+    traceReferences();
   tableRemoveWhite(&vm.strings);
+  pruneRemembered();
+  sweepNursery();
 
-  sweep();
+  // over the limit the garbage has to go right away
+  if (gcPolicy.lazySweep &&
+      (gcPolicy.heapLimit == 0 || vm.bytesAllocated <= gcPolicy.heapLimit)) {
+    startSweep();
+    vm.cycleBytesBefore = before;
+    vm.cyclePauseNs = recordPause(start);
+    sweepLater();
+#ifdef ENABLE_GC_LOGGING
+    printf("-- gc end, the sweep goes on\n");
+#endif
+    return;
+  }
+  if (workerCount > 1)
+    sweepParallel();
+  else
+    sweep();
 
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  vm.nextGC = heapThreshold(vm.bytesAllocated);
+  trimHeap();
+  recordCollection(recordPause(start), before, false);
+  checkFragmentation();
 #ifdef ENABLE_GC_LOGGING
   printf("-- gc end\n");
   printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
@@ -260,12 +925,560 @@ void collectGarbage() {
 #endif
 }
 
+// set while compactHeap() fixes the references to the objects it moved
+static bool compacting;
+
+static Obj *moveObject(Obj *object, Obj *copy, size_t size) {
+  memcpy(copy, object, size);
+  if (object->type == OBJ_UPVALUE) {
+    ObjUpvalue *upvalue = (ObjUpvalue *)object;
+    if (upvalue->location == &upvalue->closed)
+      ((ObjUpvalue *)copy)->location = &((ObjUpvalue *)copy)->closed;
+  }
+
+  object->isForwarded = true;
+  // nothing reads the rest of the old copy again
+  FORWARDING(object) = copy;
+  return copy;
+}
+
+static Obj *promote(Obj *object) {
+  size_t size = objectSize(object->type);
+  Obj *copy =
+      moveObject(object, shadeNew((Obj *)allocateObjectBlock(size)), size);
+  gcStats.promotedBytes += size;
+  pushGray(copy);
+  return copy;
+}
+
+static Obj *forwardObject(Obj *object) {
+  if (!isYoung(object)) {
+    if (compacting && object != NULL && object->isForwarded)
+      return FORWARDING(object);
+    return object;
+  }
+  if (object->isForwarded)
+    return FORWARDING(object);
+  return promote(object);
+}
+
+#define FORWARD(type, pointer) (pointer = (type *)forwardObject((Obj *)pointer))
+
+static void forwardValue(Value *slot) {
+  if (IS_OBJ(*slot))
+    *slot = OBJ_VAL(forwardObject(AS_OBJ(*slot)));
+}
+
+static void forwardTable(Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    FORWARD(ObjString, entry->key);
+    forwardValue(&entry->value);
+  }
+}
+
+// the minor collection counterpart of blackenObject()
+static void scanObject(Obj *object) {
+  switch (object->type) {
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    forwardValue(&bound->receiver);
+    FORWARD(ObjClosure, bound->method);
+    break;
+  }
+
+  case OBJ_CLASS: {
+    ObjClass *klass = (ObjClass *)object;
+    FORWARD(ObjString, klass->name);
+    forwardTable(&klass->methods);
+    break;
+  }
+
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      FORWARD(ObjUpvalue, closure->upvalues[i]);
+    }
+    break;
+  }
+
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    FORWARD(ObjString, function->name);
+    ValueArray *constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+      forwardValue(&constants->values[i]);
+    }
+    break;
+  }
+
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)object;
+    FORWARD(ObjClass, instance->klass);
+    forwardTable(&instance->fields);
+    break;
+  }
+
+  case OBJ_UPVALUE:
+    forwardValue(&((ObjUpvalue *)object)->closed);
+    break;
+
+  case OBJ_NATIVE:
+  case OBJ_STRING:
+    break;
+  }
+}
+
+static void forwardRoots() {
+  for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
+    forwardValue(slot);
+  }
+  for (int i = 0; i < vm.frameCount; i++) {
+    FORWARD(ObjClosure, vm.frames[i].closure);
+  }
+  for (ObjUpvalue **upvalue = &vm.openUpvalues; *upvalue != NULL;
+       upvalue = &(*upvalue)->next) {
+    FORWARD(ObjUpvalue, *upvalue);
+  }
+  forwardTable(&vm.globals);
+  FORWARD(ObjString, vm.initString);
+}
+
+/**
+ * copy the young objects the roots and the remembered set reach to the old
+ * generation, the copies are scanned from the gray stack like a Cheney
+ * queue, above the gray objects of a marking. the compiler roots are left
+ * out, the interpreter only calls this at its safepoints, after the
+ * compiler is done.
+ */
+void collectYoung() {
+#ifdef ENABLE_GC_LOGGING
+  printf("-- minor gc begin\n");
+#endif
+  uint64_t start = gcClockNs();
+  size_t before = vm.bytesAllocated;
+  nursery.collectionRequested = false;
+  // it writes to the old objects of the remembered set
+  beginHeapWrite();
+  int marking = vm.grayCount;
+  // the frames point at the old copies of the closures for a while
+  suspendProfiler();
+
+  forwardRoots();
+  for (int i = 0; i < nursery.rememberedCount; i++) {
+    Obj *object = nursery.remembered[i];
+    object->isRemembered = false;
+    scanObject(object);
+  }
+  nursery.rememberedCount = 0;
+  for (int scanned = marking; scanned < vm.grayCount; scanned++) {
+    scanObject(vm.grayStack[scanned]);
+  }
+  vm.grayCount = marking;
+
+  // vm.strings holds its keys weakly, it follows the moved ones and drops
+  // the dead ones
+  FOR_EACH_YOUNG(object) {
+    if (object->isForwarded) {
+      if (FORWARDING(object) != NULL && object->type == OBJ_STRING)
+        tableReplaceKey(&vm.strings, (ObjString *)object,
+                        (ObjString *)FORWARDING(object));
+      continue;
+    }
+    if (object->type == OBJ_STRING)
+      tableDelete(&vm.strings, (ObjString *)object);
+    freeYoung(object);
+  }
+  nursery.top = nursery.start;
+  resumeProfiler();
+  endHeapWrite();
+
+  recordCollection(recordPause(start), before, true);
+#ifdef ENABLE_GC_LOGGING
+  printf("-- minor gc end\n");
+  printf("   collected %zu bytes (from %zu to %zu)\n",
+         before - vm.bytesAllocated, before, vm.bytesAllocated);
+#endif
+}
+
+/**
+ * a full collection leaves the live objects where they are, over time the
+ * object pages end up holding a few each. once a full collection leaves
+ * more than gcPolicy.compactThreshold of their bytes free, the next
+ * safepoint moves the objects of the sparsest pages of every size class to
+ * the free blocks of the others, and fixes the references to them the way
+ * a minor collection does. the emptied pages go back to the allocator.
+ *
+ * the functions stay where they are, the stats, the profiler and the
+ * compiler know them by their address. the compiler holds nothing else,
+ * and it is done at a safepoint.
+ */
+
+static int compareUsed(const void *a, const void *b) {
+  return (*(Page *const *)a)->used - (*(Page *const *)b)->used;
+}
+
+// the objects of an object page in address order, the body may clear the
+// bit of the one at hand
+#define FOR_EACH_OBJECT(page, object)                                          \
+  for (size_t word = 0;                                                        \
+       word < ((size_t)((page)->bump - (uint8_t *)(page)) / PAGE_GRANULE +    \
+               63) / 64;                                                       \
+       word++)                                                                 \
+    for (uint64_t bits = (page)->objects[word]; bits != 0; bits &= bits - 1)  \
+      for (Obj *object =                                                       \
+               (Obj *)((uint8_t *)(page) +                                     \
+                       (word * 64 + __builtin_ctzll(bits)) * PAGE_GRANULE);    \
+           object != NULL; object = NULL)
+
+// a page holds objects of one size class, the functions have one of their
+// own
+static bool holdsFunctions(Page *page) {
+  FOR_EACH_OBJECT(page, object) { return object->type == OBJ_FUNCTION; }
+  return false;
+}
+
+// the sparsest pages of the size class move out to the free blocks of the
+// others, they stay held at the front of its classPages and the others go
+// back to the allocator. returns how many move
+static int choosePages(int sizeClass) {
+  Page **pages = &classPages[classNext[sizeClass]];
+  int count = classEnd[sizeClass] - classNext[sizeClass];
+  qsort(pages, count, sizeof(Page *), compareUsed);
+  size_t room = 0;
+  for (int i = 0; i < count; i++) {
+    room += (size_t)(pages[i]->capacity - pages[i]->used);
+  }
+  size_t moving = 0;
+  int chosen = 0;
+  while (chosen < count) {
+    Page *page = pages[chosen];
+    room -= (size_t)(page->capacity - page->used);
+    if (moving + (size_t)page->used > room || holdsFunctions(page))
+      break;
+    moving += (size_t)page->used;
+    chosen++;
+  }
+  for (int i = chosen; i < count; i++) {
+    claimPage(pages[i]);
+    returnObjectBlocks(pages[i], NULL, NULL, 0);
+  }
+  return chosen;
+}
+
+// the references to the moved objects follow them
+static void forwardHeap() {
+  compacting = true;
+  forwardRoots();
+  forwardTable(&vm.strings);
+  int count;
+  Page **pages = objectPages(&count);
+  for (int i = 0; i < count; i++) {
+    FOR_EACH_OBJECT(pages[i], object) {
+      if (!object->isForwarded)
+        scanObject(object);
+    }
+  }
+  compacting = false;
+}
+
+// the blocks of the moved objects go back, and the page with them
+static void releaseMoved(Page *page) {
+  void *freed = NULL;
+  void *last = NULL;
+  int count = 0;
+  FOR_EACH_OBJECT(page, object) {
+    if (!object->isForwarded)
+      continue;
+    size_t granule = granuleOf(object);
+    page->objects[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+    if (last != NULL)
+      *(void **)last = object;
+    else
+      freed = object;
+    last = object;
+    count++;
+  }
+  claimPage(page);
+  returnObjectBlocks(page, freed, last, count);
+}
+
+static void compactHeap() {
+#ifdef ENABLE_GC_LOGGING
+  printf("-- compact begin\n");
+#endif
+  // nothing else may touch the pages or the objects while they move
+  if (vm.markerRunning)
+    stopMarker();
+  if (sweeperThread != NULL)
+    stopSweeper();
+  // the young objects may point at the old ones that move
+  if (nursery.top != nursery.start)
+    collectYoung();
+  uint64_t start = gcClockNs();
+  // held like for a sweep, so the moved objects only go to the pages that
+  // stay
+  startSweep();
+  suspendProfiler();
+  int pagesBefore = sweepPageCount;
+  size_t moved = 0;
+  for (int sizeClass = 0; sizeClass < ALLOCATOR_SIZE_CLASSES; sizeClass++) {
+    classEnd[sizeClass] = classNext[sizeClass] + choosePages(sizeClass);
+    for (int i = classNext[sizeClass]; i < classEnd[sizeClass]; i++) {
+      FOR_EACH_OBJECT(classPages[i], object) {
+        size_t size = objectSize(object->type);
+        moveObject(object, (Obj *)allocateObjectBlock(size), size);
+        moved += size;
+      }
+    }
+  }
+  forwardHeap();
+  resumeProfiler();
+  for (int sizeClass = 0; sizeClass < ALLOCATOR_SIZE_CLASSES; sizeClass++) {
+    for (int i = classNext[sizeClass]; i < classEnd[sizeClass]; i++) {
+      releaseMoved(classPages[i]);
+    }
+  }
+
+  int pagesAfter;
+  objectPages(&pagesAfter);
+  gcStats.compactions++;
+  gcStats.compactedBytes += moved;
+  if (pagesAfter < pagesBefore)
+    gcStats.reclaimedBytes +=
+        (uint64_t)(pagesBefore - pagesAfter) * ALLOCATOR_PAGE_SIZE;
+  trimHeap();
+  recordPause(start);
+#ifdef ENABLE_GC_LOGGING
+  printf("-- compact end\n");
+  printf("   moved %zu bytes, %d object pages left of %d\n", moved,
+         pagesAfter, pagesBefore);
+#endif
+}
+
+/**
+ * with gcPolicy.pauseTargetNs the old generation is collected in slices at
+ * the safepoints, one every GC_SLICE_BYTES of allocation, each working
+ * until the target is up. with gcPolicy.concurrentMarking the marker thread
+ * does the marking instead, and the slices only start and finish it.
+ *
+ * the marking is tri-color, the gray objects are the ones on the gray
+ * stack, and it marks a snapshot of the heap at its start: the roots are
+ * grayed in the first slice, after a minor collection empties the nursery.
+ * the mutator marks every reference it overwrites in an object before it
+ * lets go of it, see overwriteBarrier(). whatever is allocated or promoted
+ * later starts out black, the young objects stay out of it. so once the
+ * gray stack runs empty every object of the snapshot that is still alive
+ * is marked, and the roots need no second look. the sweep then frees the
+ * dead ones a page at a time, see startSweep().
+ *
+ * with gcPolicy.lazySweep a full collection only marks, and leaves the
+ * sweep to the slices that follow, GC_SWEEP_PAGES pages each.
+ */
+
+static void startCycle() {
+  vm.gcPhase = GC_MARKING;
+  vm.cycleBytesBefore = vm.bytesAllocated;
+  vm.cyclePauseNs = 0;
+  markRoots();
+}
+
+// blacken the gray objects a batch at a time, the mutator gets the heap
+// between the batches
+static void markConcurrently() {
+  while (!markerStop) {
+    lockHeap();
+    for (int work = 0; work < GC_MARK_BATCH && vm.grayCount > 0; work++) {
+      blackenObject(vm.grayStack[--vm.grayCount]);
+    }
+    bool empty = vm.grayCount == 0;
+    unlockHeap();
+    if (empty)
+      break;
+  }
+  markerDone = true;
+}
+
+static void startMarker() {
+  markerStop = false;
+  markerDone = false;
+  vm.markerRunning = true;
+  markerThread = new std::thread(startGCThread(markConcurrently));
+}
+
+// true once the gray stack is empty
+static bool markSlice(uint64_t deadline) {
+  for (int work = 1; vm.grayCount > 0; work++) {
+    blackenObject(vm.grayStack[--vm.grayCount]);
+    if (work % GC_SLICE_CHECK == 0 && gcClockNs() >= deadline)
+      return vm.grayCount == 0;
+  }
+  return true;
+}
+
+// vm.strings holds its keys weakly, the young ones are not marked but the
+// next minor collection sees to them
+static void removeWhiteStrings() {
+  for (int i = 0; i < vm.strings.capacity; i++) {
+    ObjString *key = vm.strings.entries[i].key;
+    if (key != NULL && !isYoung((Obj *)key) && !isMarked((Obj *)key))
+      tableDelete(&vm.strings, key);
+  }
+}
+
+static void finishMarking() {
+  traceReferences();
+  removeWhiteStrings();
+  pruneRemembered();
+  startSweep();
+  sweepLater();
+}
+
+// the sweeper thread may still be on the last pages it claimed, what they
+// free counts for the next threshold
+static void finishCycle() {
+  if (sweeperThread != NULL)
+    stopSweeper();
+  vm.gcPhase = GC_IDLE;
+  vm.nextGC = heapThreshold(vm.bytesAllocated);
+  trimHeap();
+  checkHeapLimit();
+  checkFragmentation();
+}
+
+// the marking falls behind the allocations, the slice runs to the end
+static bool cycleOverdue() {
+  return vm.bytesAllocated / 2 > vm.cycleBytesBefore ||
+         (gcPolicy.heapLimit != 0 && vm.bytesAllocated > gcPolicy.heapLimit);
+}
+
+static void collectSlice() {
+  if (vm.markerRunning) {
+    // the mutator goes on while the marker thread is at it
+    if (!markerDone && !cycleOverdue())
+      return;
+    stopMarker();
+  }
+  if (sweeperThread != NULL) {
+    if (!sweeperDone && !cycleOverdue())
+      return;
+    stopSweeper();
+  }
+  // a minor collection of its own, the snapshot has no young objects
+  if (vm.gcPhase == GC_IDLE && nursery.top != nursery.start)
+    collectYoung();
+#ifdef ENABLE_GC_LOGGING
+  printf("-- gc slice begin\n");
+#endif
+  uint64_t start = gcClockNs();
+  // before the deadline, a new cycle is not overdue
+  if (vm.gcPhase == GC_IDLE) {
+    startCycle();
+    if (gcPolicy.concurrentMarking && vm.grayCount > 0)
+      startMarker();
+  }
+  uint64_t deadline = start + gcPolicy.pauseTargetNs;
+  if (gcPolicy.pauseTargetNs == 0) {
+    deadline = UINT64_MAX;
+  } else if (cycleOverdue()) {
+    deadline = UINT64_MAX;
+    gcStats.overdueSlices++;
+  }
+  // the lazy sweep keeps ahead of the allocations a few pages at a time
+  int budget = INT_MAX;
+  if (gcPolicy.lazySweep && gcPolicy.pauseTargetNs == 0 && !cycleOverdue())
+    budget = GC_SWEEP_PAGES;
+  // what the marker thread left, the barriers may have grayed more since
+  if (vm.gcPhase == GC_MARKING && !vm.markerRunning &&
+      markSlice(gcPolicy.concurrentMarking ? UINT64_MAX : deadline))
+    finishMarking();
+  if (vm.gcPhase == GC_SWEEPING && sweepSlice(deadline, budget))
+    finishCycle();
+
+  vm.cyclePauseNs += recordPause(start);
+  if (vm.gcPhase == GC_IDLE)
+    recordCollection(vm.cyclePauseNs, vm.cycleBytesBefore, false);
+#ifdef ENABLE_GC_LOGGING
+  printf("-- gc slice end\n");
+#endif
+}
+
+void finishSweep() {
+  if (vm.gcPhase != GC_SWEEPING)
+    return;
+  if (sweeperThread != NULL)
+    stopSweeper();
+  uint64_t start = gcClockNs();
+  sweepSlice(UINT64_MAX, INT_MAX);
+  finishCycle();
+  vm.cyclePauseNs += recordPause(start);
+  recordCollection(vm.cyclePauseNs, vm.cycleBytesBefore, false);
+}
+
+/**
+ * a minor collection first, a full one only follows if the heap is still
+ * over the threshold. the full collection then finds no young objects to
+ * sweep. an incremental one gets its slice after the minor collection.
+ */
+void collectRequested() {
+  if (nursery.collectionRequested) {
+    collectYoung();
+    if (!isIncremental() && vm.gcPhase == GC_IDLE &&
+        vm.bytesAllocated > vm.nextGC) {
+      collectGarbage();
+      checkHeapLimit();
+    }
+  }
+  if (vm.compactionRequested) {
+    vm.compactionRequested = false;
+    // a collection started since, it knows the objects by their addresses
+    if (vm.gcPhase == GC_IDLE)
+      compactHeap();
+  }
+  if (vm.sliceRequested) {
+    vm.sliceRequested = false;
+    // a lazy sweep was all there was to do
+    if (vm.gcPhase == GC_IDLE && !isIncremental())
+      return;
+#ifndef ENABLE_FORCE_GC
+    // the minor collection was enough
+    if (vm.gcPhase == GC_IDLE && vm.bytesAllocated <= vm.nextGC)
+      return;
+#endif
+    collectSlice();
+  }
+}
+
 void freeObjects() {
-  Obj *object = vm.objects;
-  while (object != NULL) {
-    Obj *next = object->next;
-    freeObject(object);
-    object = next;
+  if (vm.markerRunning)
+    stopMarker();
+  if (sweeperThread != NULL)
+    stopSweeper();
+  FOR_EACH_YOUNG(object) {
+    if (!object->isForwarded)
+      freeYoung(object);
   }
+  nursery.top = nursery.start;
+  nursery.rememberedCount = 0;
+
+  // no marks, the sweep frees them all
+  clearMarks();
+  sweep();
   free(vm.grayStack);
+  for (int i = 0; i < GC_MAX_THREADS; i++) {
+    free(workers[i].gray);
+    workers[i].gray = NULL;
+    workers[i].grayCapacity = 0;
+  }
+  free(sweepPages);
+  free(classPages);
+  sweepPages = NULL;
+  classPages = NULL;
+  sweepPageCapacity = 0;
+  free(deadFunctions);
+  deadFunctions = NULL;
+  deadFunctionCapacity = 0;
+  // the pages the script emptied go back to the OS
+  flushThreadCache();
+  trimPages(0);
 }
@@ -17,7 +17,9 @@
 #ifndef YSCRIPT_COMMON_MEMORY_H_
 #define YSCRIPT_COMMON_MEMORY_H_
 
+#include "common/allocator.h"
 #include "common/config.h"
+#include "common/nursery.h"
 #include "common/ysobject.h"
 
 #define ALLOCATE(type, count)                                                  \
@@ -34,13 +36,107 @@
 #define FREE_ARRAY(type, pointer, oldCount)                                    \
   reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+/**
+ * how the heap grows between collections, set it before initVM(). a
+ * collection runs once the heap outgrows the threshold, the next threshold
+ * is growFactor times the bytes the collection left, clamped to minHeap and
+ * maxHeap.
+ */
+typedef struct {
+  // the threshold of the first collection
+  size_t initialHeap;
+  double growFactor;
+  size_t minHeap;
+  size_t maxHeap;
+  // the heap may not stay above it after a collection, the running script
+  // fails with "Out of memory." instead. 0 for no limit
+  size_t heapLimit;
+  // bytes of the young generation, 0 for none
+  size_t nurserySize;
+  // how long a slice of an incremental collection of the old generation
+  // should take, 0 collects it in one pause
+  uint64_t pauseTargetNs;
+  // mark the old generation on a thread of its own while the script runs
+  bool concurrentMarking;
+  // the threads a full collection marks and sweeps on, the script's one of
+  // them
+  int gcThreads;
+  // leave the sweep of a full collection to the allocations after it
+  bool lazySweep;
+  // and to a thread of its own, implies lazySweep
+  bool sweepThread;
+  // compact the old generation once this share of its pages is free after
+  // a full collection, 0 never
+  double compactThreshold;
+} GCPolicy;
+
+extern GCPolicy gcPolicy;
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+// the memory of an object of the old generation, see allocateObject()
+Obj *allocateOld(size_t size);
+// the heap just grew by bytes, this may run a collection
+void heapGrew(size_t bytes);
 
 void markObject(Obj *object);
 
+typedef enum {
+  ROOT_STACK,
+  ROOT_FRAME,
+  ROOT_UPVALUE,
+  ROOT_GLOBAL,
+  // vm.initString
+  ROOT_VM,
+} RootKind;
+
+/**
+ * the roots markRoots() marks but the compiler's, for a walk of the heap
+ * between two interpret() calls or at a safepoint. a global comes with its
+ * name, the key and the value are roots both.
+ */
+void visitRoots(void (*visit)(RootKind kind, ObjString *name, Obj *object));
+
+// the word of the mark bitmap that holds the mark of object, bit is set to
+// its bit in there
+static inline uint64_t *markWord(const Obj *object, uint64_t *bit) {
+  uint64_t *marks;
+  size_t granule;
+  if (isYoung(object)) {
+    marks = nursery.marks;
+    granule = ((const uint8_t *)object - nursery.start) / 8;
+  } else {
+    marks = pageOf(object)->marks;
+    granule = granuleOf(object);
+  }
+  *bit = (uint64_t)1 << (granule % 64);
+  return &marks[granule / 64];
+}
+
+static inline bool isMarked(const Obj *object) {
+  uint64_t bit;
+  return (*markWord(object, &bit) & bit) != 0;
+}
+
+static inline void setMarked(Obj *object) {
+  uint64_t bit;
+  *markWord(object, &bit) |= bit;
+}
+
 void markValue(Value value);
+// held by the marker thread while it scans, see beginHeapWrite()
+void lockHeap();
+void unlockHeap();
 
 void collectGarbage();
+// the rest of the sweep a lazy or incremental collection left, if any
+void finishSweep();
+// a minor collection, only at a safepoint of the interpreter
+void collectYoung();
+// what the allocations asked for, at a safepoint of the interpreter
+void collectRequested();
+
+// where initVM() sets vm.nextGC
+size_t initialHeapThreshold();
 
 void freeObjects();
 
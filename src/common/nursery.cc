@@ -0,0 +1,81 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "common/memory.h"
+#include "common/nursery.h"
+#include "vm/interp/interp.h"
+
+Nursery nursery;
+
+void initNursery(size_t capacity) {
+  capacity = NURSERY_ALIGN(capacity);
+  nursery.start = NULL;
+  nursery.marks = NULL;
+  if (capacity != 0) {
+    nursery.start = (uint8_t *)malloc(capacity);
+    nursery.marks = (uint64_t *)calloc(NURSERY_MARK_WORDS(capacity), 8);
+    if (nursery.start == NULL || nursery.marks == NULL)
+      exit(1);
+  }
+  nursery.top = nursery.start;
+  nursery.capacity = capacity;
+  nursery.collectionRequested = false;
+  nursery.remembered = NULL;
+  nursery.rememberedCount = 0;
+  nursery.rememberedCapacity = 0;
+}
+
+void freeNursery() {
+  free(nursery.start);
+  free(nursery.marks);
+  free(nursery.remembered);
+  initNursery(0);
+}
+
+Obj *allocateYoung(size_t size) {
+  size_t room = (size_t)(nursery.start + nursery.capacity - nursery.top);
+  if (NURSERY_ALIGN(size) > room) {
+    if (nursery.capacity != 0)
+      requestYoungCollection();
+    return NULL;
+  }
+  // may collect, which leaves the nursery as it is, before the object exists
+  vm.bytesAllocated += size;
+  heapGrew(size);
+
+  Obj *object = (Obj *)nursery.top;
+  nursery.top += NURSERY_ALIGN(size);
+  return object;
+}
+
+void requestYoungCollection() {
+  nursery.collectionRequested = true;
+  vm.safepointRequested = true;
+}
+
+void rememberObject(Obj *object) {
+  if (nursery.rememberedCapacity < nursery.rememberedCount + 1) {
+    nursery.rememberedCapacity = GROW_CAPACITY(nursery.rememberedCapacity);
+    nursery.remembered = (Obj **)realloc(
+        nursery.remembered, sizeof(Obj *) * nursery.rememberedCapacity);
+    if (nursery.remembered == NULL)
+      exit(1);
+  }
+  object->isRemembered = true;
+  nursery.remembered[nursery.rememberedCount++] = object;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMMON_NURSERY_H_
+#define YSCRIPT_COMMON_NURSERY_H_
+
+#include "common/config.h"
+#include "common/ysobject.h"
+
+/**
+ * the young generation. new objects are bump allocated in one block, a
+ * minor collection copies the reachable ones out to the old generation, the
+ * object pages of allocator.h, and starts the block over.
+ *
+ * copying moves objects, and the C code holds them in locals across its
+ * allocations everywhere. so an allocation only asks for the collection
+ * once the nursery is full, the interpreter runs it at its next safepoint,
+ * see collectYoung(). until then the new objects go to the old generation.
+ *
+ * a minor collection only looks at the young objects reachable from the
+ * roots and from the old objects in the remembered set. every store of a
+ * young reference into an old object passes writeBarrier() to get the old
+ * one in there, see barrier.h.
+ */
+
+#define NURSERY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define NURSERY_MARK_WORDS(capacity) (((capacity) / 8 + 63) / 64)
+
+typedef struct {
+  uint8_t *start;
+  uint8_t *top;
+  size_t capacity;
+  // the marks of a full collection, a bit per 8 bytes like on the pages
+  uint64_t *marks;
+  // waiting for the next safepoint to run collectYoung()
+  bool collectionRequested;
+  // old objects that may point into the nursery
+  Obj **remembered;
+  int rememberedCount;
+  int rememberedCapacity;
+} Nursery;
+
+extern Nursery nursery;
+
+// a capacity of 0 allocates every object in the old generation
+void initNursery(size_t capacity);
+void freeNursery();
+
+// NULL if the nursery is full or disabled
+Obj *allocateYoung(size_t size);
+void requestYoungCollection();
+
+void rememberObject(Obj *object);
+
+static inline bool isYoung(const Obj *object) {
+  return (uintptr_t)object - (uintptr_t)nursery.start < nursery.capacity;
+}
+
+#endif // YSCRIPT_COMMON_NURSERY_H_
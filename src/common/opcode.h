@@ -48,6 +48,10 @@ typedef enum {
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
+  // Peephole fused comparison-ops, replace `OP_EQUAL/OP_LESS/OP_GREATER; OP_NOT`
+  OP_NOT_EQUAL,
+  OP_GREATER_EQUAL,
+  OP_LESS_EQUAL,
   // A Virtual Machine binary-ops
   OP_ADD,
   OP_SUBTRACT,
@@ -57,6 +61,16 @@ typedef enum {
   OP_NOT,
   // A Virtual Machine negate-op
   OP_NEGATE,
+  // Type inference unchecked number-ops, the operands are proven numbers
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_EQUAL_NUM,
+  OP_LESS_EQUAL_NUM,
+  OP_NEGATE_NUM,
   // Global Variables op-print
   OP_PRINT,
   // Jumping Back and Forth jump-op
@@ -82,7 +96,10 @@ typedef enum {
   // Superclasses inherit-op
   OP_INHERIT,
   // Methods and Initializers method-op
-  OP_METHOD
+  OP_METHOD,
+  // Wide operands prefix-op, the next instruction has 16 bit constant/slot
+  // operands and a 32 bit jump offset
+  OP_WIDE
 } OpCode;
 
 #endif // YSCRIPT_COMMON_OPCODE_H_
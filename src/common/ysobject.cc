@@ -17,21 +17,37 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "common/barrier.h"
+#include "common/gcstats.h"
 #include "common/memory.h"
 #include "common/ysobject.h"
 #include "common/hashtable.h"
+#include "common/nursery.h"
 #include "common/ysvalue.h"
+#include "stream/stream.h"
+#include "vm/interp/allocsites.h"
 #include "vm/interp/interp.h"
 
 #define ALLOCATE_OBJ(type, objectType)                                         \
   (type *)allocateObject(sizeof(type), objectType)
 
 static Obj *allocateObject(size_t size, ObjType type) {
-  Obj *object = (Obj *)reallocate(NULL, 0, size);
+  // functions never move, the stats and the profiler keep pointers to them
+  Obj *object = type == OBJ_FUNCTION ? NULL : allocateYoung(size);
+  bool isOld = object == NULL;
+  if (isOld)
+    object = allocateOld(size);
   object->type = type;
-  object->isMarked = false;
-  object->next = vm.objects;
-  vm.objects = object;
+  object->isRemembered = false;
+  object->isForwarded = false;
+  object->site = 0;
+  // the constructors and the compiler fill it in without a barrier
+  if (isOld)
+    writeBarrierAll(object);
+  gcStats.allocatedObjects[type]++;
+  gcStats.liveObjects[type]++;
+  if (allocSampler.enabled && (allocSampler.countdown -= (int64_t)size) <= 0)
+    sampleAllocation(object);
 
 #ifdef ENABLE_GC_LOGGING
   printf("%p allocate %zu for %d\n", (void *)object, size, type);
@@ -76,6 +92,10 @@ ObjFunction *newFunction() {
   function->arity = 0;
 
   function->upvalueCount = 0;
+  function->localCount = 0;
+  function->statsIndex = -1;
+  function->traceId = -1;
+  function->line = 0;
 
   function->name = NULL;
   initChunk(&function->chunk);
@@ -126,6 +146,7 @@ ObjString *takeString(char *chars, int length) {
   ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
   if (interned != NULL) {
     FREE_ARRAY(char, chars, length + 1);
+    internBarrier(interned);
     return interned;
   }
 
@@ -135,8 +156,10 @@ ObjString *takeString(char *chars, int length) {
 ObjString *copyString(const char *chars, int length) {
   uint32_t hash = hashString(chars, length);
   ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL)
+  if (interned != NULL) {
+    internBarrier(interned);
     return interned;
+  }
 
   char *heapChars = ALLOCATE(char, length + 1);
   memcpy(heapChars, chars, length);
@@ -152,47 +175,77 @@ ObjUpvalue *newUpvalue(Value *slot) {
   return upvalue;
 }
 
-static void printFunction(ObjFunction *function) {
+size_t objectSize(ObjType type) {
+  switch (type) {
+  case OBJ_BOUND_METHOD:
+    return sizeof(ObjBoundMethod);
+  case OBJ_CLASS:
+    return sizeof(ObjClass);
+  case OBJ_CLOSURE:
+    return sizeof(ObjClosure);
+  case OBJ_FUNCTION:
+    return sizeof(ObjFunction);
+  case OBJ_INSTANCE:
+    return sizeof(ObjInstance);
+  case OBJ_NATIVE:
+    return sizeof(ObjNative);
+  case OBJ_STRING:
+    return sizeof(ObjString);
+  case OBJ_UPVALUE:
+    return sizeof(ObjUpvalue);
+  }
+  return 0;
+}
+
+// Writef truncates long strings, write them as they are
+static void writeString(base::Stream &out, ObjString *string) {
+  out.WriteData(string->chars, string->length);
+}
+
+static void writeFunction(base::Stream &out, ObjFunction *function) {
   if (function->name == NULL) {
-    printf("<script>");
+    out.Writef("<script>");
     return;
   }
 
-  printf("<fn %s>", function->name->chars);
+  out.Writef("<fn ");
+  writeString(out, function->name);
+  out.Writef(">");
 }
 
-void printObject(Value value) {
+void writeObject(base::Stream &out, Value value) {
   switch (OBJ_TYPE(value)) {
   case OBJ_BOUND_METHOD:
-    printFunction(AS_BOUND_METHOD(value)->method->function);
+    writeFunction(out, AS_BOUND_METHOD(value)->method->function);
     break;
 
   case OBJ_CLASS:
-    printf("%s", AS_CLASS(value)->name->chars);
+    writeString(out, AS_CLASS(value)->name);
     break;
 
   case OBJ_CLOSURE:
-    printFunction(AS_CLOSURE(value)->function);
+    writeFunction(out, AS_CLOSURE(value)->function);
     break;
 
   case OBJ_FUNCTION:
-    printFunction(AS_FUNCTION(value));
+    writeFunction(out, AS_FUNCTION(value));
     break;
 
   case OBJ_INSTANCE:
-    printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+    writeString(out, AS_INSTANCE(value)->klass->name);
+    out.Writef(" instance");
     break;
 
   case OBJ_NATIVE:
-    printf("<native fn>");
+    out.Writef("<native fn>");
     break;
 
   case OBJ_STRING:
-    printf("%s", AS_CSTRING(value));
+    writeString(out, AS_STRING(value));
     break;
 
   case OBJ_UPVALUE:
-    printf("upvalue");
+    out.Writef("upvalue");
     break;
   }
 }
@@ -53,16 +53,31 @@ typedef enum {
   OBJ_UPVALUE
 } ObjType;
 
+// the mark of an object is in a bitmap beside it, see isMarked()
 struct Obj {
   ObjType type;
-  bool isMarked;
-  struct Obj *next;
+  // an old object in nursery.remembered
+  bool isRemembered;
+  // a nursery object that moved, the address of the copy follows the
+  // header, or that a full collection found dead with NULL there
+  bool isForwarded;
+  // the allocation site of a sampled object, 0 for the others, see
+  // allocsites.h
+  uint16_t site;
 };
 
 typedef struct {
   Obj obj;
   int arity;
   int upvalueCount;
+  // most locals alive at once, the stack room a call needs for them
+  int localCount;
+  // entry in vmStats.functions, -1 until the function ran with --stats
+  int statsIndex;
+  // id in the --trace file, -1 until the function ran while tracing
+  int traceId;
+  // line the function is declared at, 0 for the script
+  int line;
   Chunk chunk;
   ObjString *name;
 } ObjFunction;
@@ -123,7 +138,9 @@ ObjString *takeString(char *chars, int length);
 ObjString *copyString(const char *chars, int length);
 ObjUpvalue *newUpvalue(Value *slot);
 
-void printObject(Value value);
+size_t objectSize(ObjType type);
+
+void writeObject(base::Stream &out, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -20,6 +20,7 @@
 #include "common/memory.h"
 #include "common/ysobject.h"
 #include "common/ysvalue.h"
+#include "stream/file-stream.h"
 
 void initValueArray(ValueArray *array) {
   array->values = NULL;
@@ -43,31 +44,38 @@ void freeValueArray(ValueArray *array) {
   initValueArray(array);
 }
 
-void printValue(Value value) {
+base::Stream &stdoutStream() {
+  static base::FileStream stream(stdout);
+  return stream;
+}
+
+void printValue(Value value) { writeValue(stdoutStream(), value); }
+
+void writeValue(base::Stream &out, Value value) {
 #ifdef ENABLE_NAN_TAGGING
   if (IS_BOOL(value)) {
-    printf(AS_BOOL(value) ? "true" : "false");
+    out.Writef(AS_BOOL(value) ? "true" : "false");
   } else if (IS_NIL(value)) {
-    printf("nil");
+    out.Writef("nil");
   } else if (IS_NUMBER(value)) {
-    printf("%g", AS_NUMBER(value));
+    out.Writef("%g", AS_NUMBER(value));
   } else if (IS_OBJ(value)) {
-    printObject(value);
+    writeObject(out, value);
   }
 #else
   switch (value.type) {
   case VAL_BOOL:
-    printf(AS_BOOL(value) ? "true" : "false");
+    out.Writef(AS_BOOL(value) ? "true" : "false");
     break;
   case VAL_NIL:
-    printf("nil");
+    out.Writef("nil");
     break;
   case VAL_NUMBER:
-    printf("%g", AS_NUMBER(value));
+    out.Writef("%g", AS_NUMBER(value));
     break;
 
   case VAL_OBJ:
-    printObject(value);
+    writeObject(out, value);
     break;
   }
 #endif
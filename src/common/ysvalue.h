@@ -21,6 +21,10 @@
 
 #include "common/config.h"
 
+namespace base {
+class Stream;
+}
+
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
@@ -99,5 +103,8 @@ void initValueArray(ValueArray *array);
 void writeValueArray(ValueArray *array, Value value);
 void freeValueArray(ValueArray *array);
 void printValue(Value value);
+void writeValue(base::Stream &out, Value value);
+// the stream printValue writes to
+base::Stream &stdoutStream();
 
 #endif // YSCRIPT_COMPILER_YSVALUE_H_
@@ -0,0 +1,898 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common/memory.h"
+#include "compiler/ir/ir.h"
+#include "disassembler/disassembler.h"
+
+static bool isJump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP;
+}
+
+static bool endsBlock(uint8_t op) { return isJump(op) || op == OP_RETURN; }
+
+bool isConstantLoad(uint8_t op) {
+  return op == OP_CONSTANT || op == OP_NIL || op == OP_TRUE || op == OP_FALSE;
+}
+
+uint8_t checkedOp(uint8_t op) {
+  switch (op) {
+  case OP_ADD_NUM:
+    return OP_ADD;
+  case OP_SUBTRACT_NUM:
+    return OP_SUBTRACT;
+  case OP_MULTIPLY_NUM:
+    return OP_MULTIPLY;
+  case OP_DIVIDE_NUM:
+    return OP_DIVIDE;
+  case OP_GREATER_NUM:
+    return OP_GREATER;
+  case OP_LESS_NUM:
+    return OP_LESS;
+  case OP_GREATER_EQUAL_NUM:
+    return OP_GREATER_EQUAL;
+  case OP_LESS_EQUAL_NUM:
+    return OP_LESS_EQUAL;
+  case OP_NEGATE_NUM:
+    return OP_NEGATE;
+  default:
+    return op;
+  }
+}
+
+bool isPurePush(uint8_t op) {
+  return isConstantLoad(op) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE;
+}
+
+void killInstr(IrInstr *instr) { instr->live = false; }
+
+static int addValue(IrFunction *ir, IrValueKind kind, int block, int def) {
+  if (ir->valueCount == ir->valueCapacity) {
+    int oldCapacity = ir->valueCapacity;
+    ir->valueCapacity = GROW_CAPACITY(oldCapacity);
+    ir->values = ARENA_GROW_ARRAY(ir->arena, IrValue, ir->values, oldCapacity,
+                                  ir->valueCapacity);
+  }
+  IrValue *value = &ir->values[ir->valueCount];
+  value->kind = kind;
+  value->block = block;
+  value->def = def;
+  value->firstInput = -1;
+  return ir->valueCount++;
+}
+
+// reserve count entries at the end of a pool, returns the first one
+static int reserve(Arena *arena, int **pool, int *count, int *capacity,
+                   int size) {
+  if (*count + size > *capacity) {
+    int oldCapacity = *capacity;
+    while (*count + size > *capacity) {
+      *capacity = GROW_CAPACITY(*capacity);
+    }
+    *pool = ARENA_GROW_ARRAY(arena, int, *pool, oldCapacity, *capacity);
+  }
+  int first = *count;
+  *count += size;
+  return first;
+}
+
+int resolveValue(IrFunction *ir, int value) {
+  while (value != -1 && ir->forward[value] != value) {
+    value = ir->forward[value];
+  }
+  return value;
+}
+
+int instrArg(IrFunction *ir, IrInstr *instr, int index) {
+  return resolveValue(ir, ir->args[instr->firstArg + index]);
+}
+
+// values an instruction pops (or peeks) and pushes
+static bool stackEffect(Chunk *chunk, int offset, int *pops, int *pushes) {
+  *pops = 0;
+  *pushes = 0;
+  switch (chunk->code[offset]) {
+  case OP_CONSTANT:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_GET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_CLOSURE:
+  case OP_CLASS:
+    *pushes = 1;
+    return true;
+
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_PRINT:
+  case OP_CLOSE_UPVALUE:
+  case OP_RETURN:
+  case OP_INHERIT:
+  case OP_METHOD:
+    *pops = 1;
+    return true;
+
+  // read the top of the stack and leave it there
+  case OP_SET_LOCAL:
+  case OP_SET_GLOBAL:
+  case OP_SET_UPVALUE:
+  case OP_JUMP_IF_FALSE:
+    *pops = 1;
+    *pushes = 1;
+    return true;
+
+  case OP_GET_PROPERTY:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_NEGATE_NUM:
+    *pops = 1;
+    *pushes = 1;
+    return true;
+
+  case OP_SET_PROPERTY:
+  case OP_GET_SUPER:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_NOT_EQUAL:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_ADD_NUM:
+  case OP_SUBTRACT_NUM:
+  case OP_MULTIPLY_NUM:
+  case OP_DIVIDE_NUM:
+  case OP_GREATER_NUM:
+  case OP_LESS_NUM:
+  case OP_GREATER_EQUAL_NUM:
+  case OP_LESS_EQUAL_NUM:
+    *pops = 2;
+    *pushes = 1;
+    return true;
+
+  case OP_JUMP:
+  case OP_LOOP:
+    return true;
+
+  case OP_CALL:
+    *pops = chunk->code[offset + 1] + 1;
+    *pushes = 1;
+    return true;
+  case OP_INVOKE:
+    *pops = chunk->code[offset + 2] + 1;
+    *pushes = 1;
+    return true;
+  case OP_SUPER_INVOKE:
+    *pops = chunk->code[offset + 2] + 2;
+    *pushes = 1;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+static bool decode(IrFunction *ir, int *indexOf) {
+  Chunk *chunk = ir->chunk;
+  for (int offset = 0; offset <= chunk->count; offset++) {
+    indexOf[offset] = -1;
+  }
+  for (int offset = 0; offset < chunk->count;) {
+    IrInstr *instr = &ir->instrs[ir->instrCount];
+    instr->op = chunk->code[offset];
+    instr->offset = offset;
+    instr->length = instructionLength(chunk, offset);
+    instr->line = chunk->lines[offset];
+    instr->live = true;
+    instr->operand = -1;
+    instr->target = -1;
+    instr->firstArg = 0;
+    instr->argCount = 0;
+    instr->result = -1;
+    indexOf[offset] = ir->instrCount++;
+    offset += instr->length;
+    // the IR only models the compact operands.
+    if (instr->op == OP_WIDE)
+      return false;
+
+    if (instr->op == OP_CLOSURE) {
+      for (int i = instr->offset + 2; i < offset; i += 2) {
+        if (chunk->code[i]) {
+          ir->captured[chunk->code[i + 1]] = true;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < ir->instrCount; i++) {
+    IrInstr *instr = &ir->instrs[i];
+    if (!isJump(instr->op))
+      continue;
+    uint16_t jump = (uint16_t)((chunk->code[instr->offset + 1] << 8) |
+                               chunk->code[instr->offset + 2]);
+    int target = instr->op == OP_LOOP ? instr->offset + 3 - jump
+                                      : instr->offset + 3 + jump;
+    // running off the end or into the middle of an instruction.
+    if (target < 0 || target >= chunk->count || indexOf[target] == -1)
+      return false;
+    // the instruction index for now, blocks are not known yet.
+    instr->target = indexOf[target];
+  }
+  return true;
+}
+
+static void buildBlocks(IrFunction *ir) {
+  bool *leader = ARENA_ALLOCATE(ir->arena, bool, ir->instrCount + 1);
+  for (int i = 0; i <= ir->instrCount; i++) {
+    leader[i] = i == 0;
+  }
+  for (int i = 0; i < ir->instrCount; i++) {
+    IrInstr *instr = &ir->instrs[i];
+    if (instr->target != -1)
+      leader[instr->target] = true;
+    if (endsBlock(instr->op))
+      leader[i + 1] = true;
+  }
+
+  // block 0 is an empty entry block, so the first real block may be a loop
+  // header like any other.
+  int *blockOf = ARENA_ALLOCATE(ir->arena, int, ir->instrCount);
+  ir->blockCount = 1;
+  for (int i = 0; i < ir->instrCount; i++) {
+    if (leader[i])
+      ir->blockCount++;
+    blockOf[i] = ir->blockCount - 1;
+  }
+
+  ir->blocks = ARENA_ALLOCATE(ir->arena, IrBlock, ir->blockCount);
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    block->start = block->end = 0;
+    block->succs[0] = block->succs[1] = -1;
+    block->firstPred = block->predCount = 0;
+    block->reachable = false;
+    block->depth = block->exitDepth = -1;
+    block->entrySlots = block->exitSlots = -1;
+    block->idom = -1;
+    block->loop = -1;
+    block->loopDepth = 0;
+  }
+  for (int i = ir->instrCount - 1; i >= 0; i--) {
+    ir->blocks[blockOf[i]].start = i;
+  }
+  for (int i = 0; i < ir->instrCount; i++) {
+    ir->blocks[blockOf[i]].end = i + 1;
+    if (ir->instrs[i].target != -1)
+      ir->instrs[i].target = blockOf[ir->instrs[i].target];
+  }
+
+  // successors and predecessors
+  ir->blocks[0].succs[0] = ir->blockCount > 1 ? 1 : -1;
+  for (int b = 1; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    IrInstr *last = &ir->instrs[block->end - 1];
+    int next = b + 1 < ir->blockCount ? b + 1 : -1;
+    switch (last->op) {
+    case OP_JUMP:
+    case OP_LOOP:
+      block->succs[0] = last->target;
+      break;
+    case OP_JUMP_IF_FALSE:
+      block->succs[0] = next;
+      block->succs[1] = last->target;
+      break;
+    case OP_RETURN:
+      break;
+    default:
+      block->succs[0] = next;
+      break;
+    }
+  }
+
+  for (int b = 0; b < ir->blockCount; b++) {
+    for (int s = 0; s < 2; s++) {
+      if (ir->blocks[b].succs[s] != -1)
+        ir->blocks[ir->blocks[b].succs[s]].predCount++;
+    }
+  }
+  int first = 0;
+  for (int b = 0; b < ir->blockCount; b++) {
+    ir->blocks[b].firstPred = first;
+    first += ir->blocks[b].predCount;
+    ir->blocks[b].predCount = 0;
+  }
+  ir->predCount = first;
+  ir->preds = ARENA_ALLOCATE(ir->arena, int, first);
+  for (int b = 0; b < ir->blockCount; b++) {
+    for (int s = 0; s < 2; s++) {
+      int succ = ir->blocks[b].succs[s];
+      if (succ != -1) {
+        IrBlock *to = &ir->blocks[succ];
+        ir->preds[to->firstPred + to->predCount++] = b;
+      }
+    }
+  }
+}
+
+static void computeOrder(IrFunction *ir) {
+  int *stack = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  int *nextSucc = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  int *postorder = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  int postCount = 0;
+  int top = 0;
+
+  stack[top++] = 0;
+  nextSucc[0] = 0;
+  ir->blocks[0].reachable = true;
+  while (top > 0) {
+    int b = stack[top - 1];
+    if (nextSucc[b] < 2) {
+      int succ = ir->blocks[b].succs[nextSucc[b]++];
+      if (succ != -1 && !ir->blocks[succ].reachable) {
+        ir->blocks[succ].reachable = true;
+        nextSucc[succ] = 0;
+        stack[top++] = succ;
+      }
+    } else {
+      postorder[postCount++] = b;
+      top--;
+    }
+  }
+
+  ir->order = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  ir->orderCount = postCount;
+  for (int i = 0; i < postCount; i++) {
+    ir->order[i] = postorder[postCount - 1 - i];
+  }
+}
+
+// "A Simple, Fast Dominance Algorithm", Cooper, Harvey and Kennedy.
+static void computeDominators(IrFunction *ir) {
+  int *rank = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  for (int i = 0; i < ir->orderCount; i++) {
+    rank[ir->order[i]] = i;
+  }
+  ir->blocks[0].idom = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < ir->orderCount; i++) {
+      IrBlock *block = &ir->blocks[ir->order[i]];
+      int idom = -1;
+      for (int p = 0; p < block->predCount; p++) {
+        int pred = ir->preds[block->firstPred + p];
+        if (ir->blocks[pred].idom == -1)
+          continue;
+        if (idom == -1) {
+          idom = pred;
+          continue;
+        }
+        int a = pred;
+        int b = idom;
+        while (a != b) {
+          while (rank[a] > rank[b])
+            a = ir->blocks[a].idom;
+          while (rank[b] > rank[a])
+            b = ir->blocks[b].idom;
+        }
+        idom = a;
+      }
+      if (block->idom != idom) {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  ir->blocks[0].idom = -1;
+}
+
+bool dominates(IrFunction *ir, int a, int b) {
+  while (b != -1 && b != a) {
+    b = ir->blocks[b].idom;
+  }
+  return b == a;
+}
+
+// only the dump shows the loops, they are computed on its first call
+static void computeLoops(IrFunction *ir) {
+  ir->loops = ARENA_ALLOCATE(ir->arena, IrLoop, ir->blockCount);
+  ir->loopCount = 0;
+  ArenaMark mark = arenaMark(ir->arena);
+  // membership of every block in every loop, headers are at most blockCount
+  bool *body = ARENA_ALLOCATE(ir->arena, bool, ir->blockCount * ir->blockCount);
+  int *work = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+
+  for (int i = 0; i < ir->orderCount; i++) {
+    int header = ir->order[i];
+    IrBlock *block = &ir->blocks[header];
+    bool *members = &body[ir->loopCount * ir->blockCount];
+    int count = 0;
+    int top = 0;
+    for (int p = 0; p < block->predCount; p++) {
+      int pred = ir->preds[block->firstPred + p];
+      if (!ir->blocks[pred].reachable || !dominates(ir, header, pred))
+        continue;
+      if (count == 0) {
+        memset(members, 0, sizeof(bool) * ir->blockCount);
+        members[header] = true;
+        count = 1;
+      }
+      if (!members[pred]) {
+        members[pred] = true;
+        count++;
+        work[top++] = pred;
+      }
+    }
+    if (count == 0)
+      continue;
+
+    // every block that reaches a back edge without passing the header
+    while (top > 0) {
+      IrBlock *member = &ir->blocks[work[--top]];
+      for (int p = 0; p < member->predCount; p++) {
+        int pred = ir->preds[member->firstPred + p];
+        if (ir->blocks[pred].reachable && !members[pred]) {
+          members[pred] = true;
+          count++;
+          work[top++] = pred;
+        }
+      }
+    }
+
+    IrLoop *loop = &ir->loops[ir->loopCount++];
+    loop->header = header;
+    loop->parent = -1;
+    loop->blockCount = count;
+  }
+
+  // natural loops with distinct headers nest or are disjoint, the innermost
+  // loop of a block is the smallest one containing it.
+  for (int l = 0; l < ir->loopCount; l++) {
+    IrLoop *loop = &ir->loops[l];
+    for (int o = 0; o < ir->loopCount; o++) {
+      IrLoop *outer = &ir->loops[o];
+      if (o == l || !body[o * ir->blockCount + loop->header] ||
+          outer->blockCount <= loop->blockCount)
+        continue;
+      if (loop->parent == -1 ||
+          outer->blockCount < ir->loops[loop->parent].blockCount)
+        loop->parent = o;
+    }
+  }
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    for (int l = 0; l < ir->loopCount; l++) {
+      if (body[l * ir->blockCount + b] &&
+          (block->loop == -1 ||
+           ir->loops[l].blockCount < ir->loops[block->loop].blockCount))
+        block->loop = l;
+    }
+    for (int l = block->loop; l != -1; l = ir->loops[l].parent) {
+      block->loopDepth++;
+    }
+  }
+  arenaRelease(ir->arena, mark);
+}
+
+// simulate the stack of one block, the slots start with its entry values
+static bool buildBlockSsa(IrFunction *ir, int b, int *stack) {
+  Chunk *chunk = ir->chunk;
+  IrBlock *block = &ir->blocks[b];
+  int top = block->depth;
+  for (int s = 0; s < top; s++) {
+    stack[s] = ir->slots[block->entrySlots + s];
+  }
+
+  for (int n = block->start; n < block->end; n++) {
+    IrInstr *instr = &ir->instrs[n];
+    int pops, pushes;
+    if (!stackEffect(chunk, instr->offset, &pops, &pushes) || pops > top)
+      return false;
+
+    if (instr->op == OP_GET_LOCAL || instr->op == OP_SET_LOCAL) {
+      uint8_t slot = chunk->code[instr->offset + 1];
+      if (slot >= top)
+        return false;
+      instr->argCount = 1;
+      instr->firstArg =
+          reserve(ir->arena, &ir->args, &ir->argCount, &ir->argCapacity, 1);
+      if (instr->op == OP_GET_LOCAL) {
+        ir->args[instr->firstArg] = stack[slot];
+        // a captured slot may be written through an upvalue by any call.
+        instr->result = ir->captured[slot] ? addValue(ir, IR_VALUE_INSTR, b, n)
+                                           : stack[slot];
+        stack[top++] = instr->result;
+      } else {
+        ir->args[instr->firstArg] = stack[top - 1];
+        instr->result = stack[top - 1];
+        stack[slot] = stack[top - 1];
+      }
+      continue;
+    }
+
+    instr->argCount = pops;
+    instr->firstArg =
+        reserve(ir->arena, &ir->args, &ir->argCount, &ir->argCapacity, pops);
+    for (int a = 0; a < pops; a++) {
+      ir->args[instr->firstArg + a] = stack[top - pops + a];
+    }
+    if (instr->op == OP_SET_GLOBAL || instr->op == OP_SET_UPVALUE ||
+        instr->op == OP_JUMP_IF_FALSE) {
+      // peeks at the top only.
+      instr->result = stack[top - 1];
+      continue;
+    }
+    top -= pops;
+    if (pushes == 1) {
+      instr->result = addValue(ir, IR_VALUE_INSTR, b, n);
+      stack[top++] = instr->result;
+    }
+  }
+
+  block->exitDepth = top;
+  block->exitSlots =
+      reserve(ir->arena, &ir->slots, &ir->slotCount, &ir->slotCapacity, top);
+  memcpy(&ir->slots[block->exitSlots], stack, sizeof(int) * top);
+  return true;
+}
+
+static bool buildSsa(IrFunction *ir) {
+  // no instruction pushes more than one value
+  int maxDepth = ir->function->arity + 1 + ir->instrCount;
+  int *stack = ARENA_ALLOCATE(ir->arena, int, maxDepth);
+  bool ok = true;
+
+  for (int i = 0; i < ir->orderCount && ok; i++) {
+    int b = ir->order[i];
+    IrBlock *block = &ir->blocks[b];
+
+    if (b == 0) {
+      block->depth = ir->function->arity + 1;
+      block->entrySlots = reserve(ir->arena, &ir->slots, &ir->slotCount,
+                                  &ir->slotCapacity, block->depth);
+      for (int s = 0; s < block->depth; s++) {
+        ir->slots[block->entrySlots + s] = addValue(ir, IR_VALUE_ENTRY, b, s);
+      }
+    } else {
+      // in reverse post order the dfs parent is visited before the block.
+      int from = -1;
+      int reachablePreds = 0;
+      for (int p = 0; p < block->predCount; p++) {
+        int pred = ir->preds[block->firstPred + p];
+        if (!ir->blocks[pred].reachable)
+          continue;
+        reachablePreds++;
+        if (from == -1 && ir->blocks[pred].exitSlots != -1)
+          from = pred;
+      }
+      block->depth = ir->blocks[from].exitDepth;
+      block->entrySlots = reserve(ir->arena, &ir->slots, &ir->slotCount,
+                                  &ir->slotCapacity, block->depth);
+      for (int s = 0; s < block->depth; s++) {
+        ir->slots[block->entrySlots + s] =
+            reachablePreds == 1 ? ir->slots[ir->blocks[from].exitSlots + s]
+                                : addValue(ir, IR_VALUE_PHI, b, s);
+      }
+    }
+    ok = buildBlockSsa(ir, b, stack);
+  }
+  if (!ok)
+    return false;
+
+  // every edge has to agree on the stack depth
+  for (int i = 0; i < ir->orderCount; i++) {
+    IrBlock *block = &ir->blocks[ir->order[i]];
+    for (int p = 0; p < block->predCount; p++) {
+      IrBlock *pred = &ir->blocks[ir->preds[block->firstPred + p]];
+      if (pred->reachable && pred->exitDepth != block->depth)
+        return false;
+    }
+  }
+
+  for (int v = 0; v < ir->valueCount; v++) {
+    IrValue *value = &ir->values[v];
+    if (value->kind != IR_VALUE_PHI)
+      continue;
+    IrBlock *block = &ir->blocks[value->block];
+    value->firstInput = reserve(ir->arena, &ir->args, &ir->argCount,
+                                &ir->argCapacity, block->predCount);
+    for (int p = 0; p < block->predCount; p++) {
+      IrBlock *pred = &ir->blocks[ir->preds[block->firstPred + p]];
+      ir->args[value->firstInput + p] =
+          pred->reachable ? ir->slots[pred->exitSlots + value->def] : -1;
+    }
+  }
+
+  // a phi whose inputs are all the same value (or itself) is that value.
+  ir->forward = ARENA_ALLOCATE(ir->arena, int, ir->valueCount);
+  for (int v = 0; v < ir->valueCount; v++) {
+    ir->forward[v] = v;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int v = 0; v < ir->valueCount; v++) {
+      IrValue *value = &ir->values[v];
+      if (value->kind != IR_VALUE_PHI || ir->forward[v] != v)
+        continue;
+      int same = -1;
+      bool trivial = true;
+      int inputs = ir->blocks[value->block].predCount;
+      for (int p = 0; p < inputs && trivial; p++) {
+        int input = resolveValue(ir, ir->args[value->firstInput + p]);
+        if (input == -1 || input == v)
+          continue;
+        if (same == -1) {
+          same = input;
+        } else if (same != input) {
+          trivial = false;
+        }
+      }
+      if (trivial && same != -1) {
+        ir->forward[v] = same;
+        changed = true;
+      }
+    }
+  }
+  return true;
+}
+
+static void initIr(IrFunction *ir, ObjFunction *function, Arena *arena) {
+  ir->arena = arena;
+  ir->mark = arenaMark(arena);
+  ir->function = function;
+  ir->chunk = &function->chunk;
+  ir->instrs = NULL;
+  ir->instrCount = 0;
+  ir->codeCount = function->chunk.count;
+  ir->blocks = NULL;
+  ir->blockCount = 0;
+  ir->order = NULL;
+  ir->orderCount = 0;
+  ir->loops = NULL;
+  ir->loopCount = 0;
+  ir->values = NULL;
+  ir->valueCount = 0;
+  ir->valueCapacity = 0;
+  ir->preds = NULL;
+  ir->predCount = 0;
+  ir->args = NULL;
+  ir->argCount = 0;
+  ir->argCapacity = 0;
+  ir->slots = NULL;
+  ir->slotCount = 0;
+  ir->slotCapacity = 0;
+  ir->forward = NULL;
+  memset(ir->captured, 0, sizeof(ir->captured));
+}
+
+bool buildIr(IrFunction *ir, ObjFunction *function, Arena *arena) {
+  initIr(ir, function, arena);
+  if (ir->chunk->count == 0)
+    return false;
+
+  ir->instrs = ARENA_ALLOCATE(ir->arena, IrInstr, ir->codeCount);
+  int *indexOf = ARENA_ALLOCATE(ir->arena, int, ir->codeCount + 1);
+  bool ok = decode(ir, indexOf);
+
+  if (ok) {
+    buildBlocks(ir);
+    computeOrder(ir);
+    computeDominators(ir);
+    ok = buildSsa(ir);
+  }
+  if (!ok) {
+    freeIr(ir);
+    initIr(ir, function, arena);
+  }
+  return ok;
+}
+
+void freeIr(IrFunction *ir) { arenaRelease(ir->arena, ir->mark); }
+
+bool sameConstant(Value a, Value b) {
+  // 0 and -0 are equal but print differently.
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    return memcmp(&x, &y, sizeof(double)) == 0;
+  }
+  return valuesEqual(a, b);
+}
+
+Value loadedConstant(IrFunction *ir, IrInstr *instr) {
+  switch (instr->op) {
+  case OP_NIL:
+    return NIL_VAL;
+  case OP_TRUE:
+    return BOOL_VAL(true);
+  case OP_FALSE:
+    return BOOL_VAL(false);
+  default: {
+    int constant = instr->operand != -1 ? instr->operand
+                                        : ir->chunk->code[instr->offset + 1];
+    return ir->chunk->constants.values[constant];
+  }
+  }
+}
+
+bool rewriteAsConstant(IrFunction *ir, IrInstr *instr, Value value) {
+  if (IS_NIL(value) || IS_BOOL(value)) {
+    instr->op = IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+    instr->length = 1;
+    instr->operand = -1;
+    return true;
+  }
+
+  ValueArray *constants = &ir->chunk->constants;
+  int constant = -1;
+  for (int i = 0; i < constants->count; i++) {
+    if (sameConstant(constants->values[i], value)) {
+      constant = i;
+      break;
+    }
+  }
+  if (constant == -1) {
+    if (constants->count > UINT8_MAX)
+      return false;
+    constant = addConstant(ir->chunk, value);
+  }
+  instr->op = OP_CONSTANT;
+  instr->length = 2;
+  instr->operand = constant;
+  return true;
+}
+
+bool lowerIr(IrFunction *ir) {
+  Chunk *chunk = ir->chunk;
+  ArenaMark mark = arenaMark(ir->arena);
+  int *newOffsets = ARENA_ALLOCATE(ir->arena, int, ir->instrCount + 1);
+  int *jumps = ARENA_ALLOCATE(ir->arena, int, ir->instrCount);
+  bool ok = true;
+  int offset = 0;
+  for (int i = 0; i < ir->instrCount; i++) {
+    IrInstr *instr = &ir->instrs[i];
+    newOffsets[i] = offset;
+    if (!instr->live)
+      continue;
+    offset += instr->length;
+    // compacting in place must not overwrite code not moved yet.
+    if (offset > instr->offset + instructionLength(chunk, instr->offset))
+      ok = false;
+  }
+  newOffsets[ir->instrCount] = offset;
+
+  // a block whose instructions were removed starts at the next live one.
+  for (int i = 0; i < ir->instrCount && ok; i++) {
+    IrInstr *instr = &ir->instrs[i];
+    if (!instr->live || instr->target == -1)
+      continue;
+    int from = newOffsets[i] + 3;
+    int to = newOffsets[ir->blocks[instr->target].start];
+    if (to >= from) {
+      if (instr->op == OP_LOOP)
+        instr->op = OP_JUMP;
+      jumps[i] = to - from;
+    } else if (instr->op == OP_JUMP_IF_FALSE) {
+      ok = false;
+    } else {
+      instr->op = OP_LOOP;
+      jumps[i] = from - to;
+    }
+    if (ok && jumps[i] > UINT16_MAX)
+      ok = false;
+  }
+
+  if (ok) {
+    // instructions only move towards the start, compact in place.
+    for (int i = 0; i < ir->instrCount; i++) {
+      IrInstr *instr = &ir->instrs[i];
+      if (!instr->live)
+        continue;
+      int to = newOffsets[i];
+      if (instr->target != -1) {
+        chunk->code[to + 1] = (jumps[i] >> 8) & 0xff;
+        chunk->code[to + 2] = jumps[i] & 0xff;
+      } else if (instr->operand != -1) {
+        chunk->code[to + 1] = (uint8_t)instr->operand;
+      } else if (instr->length > 1) {
+        memmove(chunk->code + to, chunk->code + instr->offset, instr->length);
+      }
+      chunk->code[to] = instr->op;
+      for (int k = 0; k < instr->length; k++) {
+        chunk->lines[to + k] = instr->line;
+      }
+    }
+    chunk->count = newOffsets[ir->instrCount];
+  }
+
+  arenaRelease(ir->arena, mark);
+  return ok;
+}
+
+static void dumpValue(IrFunction *ir, int value) {
+  value = resolveValue(ir, value);
+  if (value == -1) {
+    fprintf(stderr, " -");
+  } else {
+    fprintf(stderr, " v%d", value);
+  }
+}
+
+void dumpIr(IrFunction *ir) {
+  ObjFunction *function = ir->function;
+  fprintf(stderr, "== ir %s ==\n",
+          function->name != NULL ? function->name->chars : "<script>");
+  if (ir->loops == NULL)
+    computeLoops(ir);
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    if (!block->reachable)
+      continue;
+    fprintf(stderr, "b%d depth %d", b, block->depth);
+    if (block->idom != -1)
+      fprintf(stderr, " idom b%d", block->idom);
+    if (block->loop != -1) {
+      fprintf(stderr, " loop b%d depth %d", ir->loops[block->loop].header,
+              block->loopDepth);
+    }
+    fprintf(stderr, " preds");
+    for (int p = 0; p < block->predCount; p++) {
+      fprintf(stderr, " b%d", ir->preds[block->firstPred + p]);
+    }
+    fprintf(stderr, "\n");
+
+    for (int s = 0; s < block->depth; s++) {
+      int v = ir->slots[block->entrySlots + s];
+      if (ir->values[v].kind != IR_VALUE_PHI || ir->values[v].block != b ||
+          resolveValue(ir, v) != v)
+        continue;
+      fprintf(stderr, "  v%d = phi", v);
+      for (int p = 0; p < block->predCount; p++) {
+        dumpValue(ir, ir->args[ir->values[v].firstInput + p]);
+      }
+      fprintf(stderr, "\n");
+    }
+
+    for (int n = block->start; n < block->end; n++) {
+      IrInstr *instr = &ir->instrs[n];
+      if (!instr->live)
+        continue;
+      fprintf(stderr, "  %04d %-16s", instr->offset, opcodeName(instr->op));
+      if (instr->target != -1)
+        fprintf(stderr, " b%d", instr->target);
+      for (int a = 0; a < instr->argCount; a++) {
+        dumpValue(ir, ir->args[instr->firstArg + a]);
+      }
+      if (instr->result != -1 && instr->op != OP_SET_LOCAL &&
+          instr->op != OP_SET_GLOBAL && instr->op != OP_SET_UPVALUE &&
+          instr->op != OP_JUMP_IF_FALSE) {
+        fprintf(stderr, " ->");
+        dumpValue(ir, instr->result);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+}
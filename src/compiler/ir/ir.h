@@ -0,0 +1,184 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMPILER_IR_IR_H_
+#define YSCRIPT_COMPILER_IR_IR_H_
+
+#include "common/arena.h"
+#include "common/chunk.h"
+#include "common/ysobject.h"
+
+/**
+ * mid-level IR of one function.
+ *
+ * the bytecode is split into basic blocks at jump targets and after
+ * OP_JUMP/OP_JUMP_IF_FALSE/OP_LOOP/OP_RETURN. every stack slot, the locals
+ * included, is an SSA value: an instruction pushes a new value, OP_GET_LOCAL
+ * pushes the value of the slot it reads and OP_SET_LOCAL rebinds the slot.
+ * blocks that join control flow start with a phi per stack slot, the trivial
+ * ones are folded into their single input.
+ *
+ * passes edit the instructions in place (op, operand, live, target) and
+ * lowerIr() encodes them back into the chunk, the SSA form is stale after
+ * that and the IR has to be built again.
+ */
+
+typedef enum {
+  // a stack slot on entry of the function, the callee and its arguments
+  IR_VALUE_ENTRY,
+  // pushed by an instruction
+  IR_VALUE_INSTR,
+  // merge of a stack slot at the start of a block
+  IR_VALUE_PHI,
+} IrValueKind;
+
+typedef struct {
+  IrValueKind kind;
+  int block;
+  // defining instruction of IR_VALUE_INSTR, stack slot of ENTRY/PHI
+  int def;
+  // phi inputs in IrFunction.args, one per predecessor of the block
+  int firstInput;
+} IrValue;
+
+typedef struct {
+  uint8_t op;
+  // position in the original code, the operands not rewritten by a pass are
+  // read from there
+  int offset;
+  // encoded length of the (possibly rewritten) instruction
+  int length;
+  int line;
+  bool live;
+  // rewritten one byte operand, -1 to keep the original operands
+  int operand;
+  // target block of OP_JUMP/OP_JUMP_IF_FALSE/OP_LOOP, -1 otherwise
+  int target;
+  // values it pops or reads, in IrFunction.args, deepest one first
+  int firstArg;
+  int argCount;
+  // value it pushes, -1 if none
+  int result;
+} IrInstr;
+
+typedef struct {
+  // instructions [start, end)
+  int start;
+  int end;
+  // fall through successor first, -1 for unused entries
+  int succs[2];
+  // predecessors in IrFunction.preds
+  int firstPred;
+  int predCount;
+  // reachable from the entry along the control flow graph
+  bool reachable;
+  // stack depth on entry and exit
+  int depth;
+  int exitDepth;
+  // values of the stack slots on entry and exit, in IrFunction.slots
+  int entrySlots;
+  int exitSlots;
+  // immediate dominator, -1 for the entry and unreachable blocks
+  int idom;
+  // innermost loop the block belongs to, -1 if none or not computed
+  int loop;
+  int loopDepth;
+} IrBlock;
+
+typedef struct {
+  int header;
+  // enclosing loop, -1 for outermost loops
+  int parent;
+  int blockCount;
+} IrLoop;
+
+typedef struct {
+  // everything below lives in the arena, freeIr() releases it to the mark
+  Arena *arena;
+  ArenaMark mark;
+  ObjFunction *function;
+  Chunk *chunk;
+
+  IrInstr *instrs;
+  int instrCount;
+  // size of the code the IR was built from
+  int codeCount;
+  IrBlock *blocks;
+  int blockCount;
+  // blocks in reverse post order, reachable ones only
+  int *order;
+  int orderCount;
+  // natural loops, NULL until dumpIr() needs them
+  IrLoop *loops;
+  int loopCount;
+
+  IrValue *values;
+  int valueCount;
+  int valueCapacity;
+
+  // pools indexed from the blocks, instructions and values
+  int *preds;
+  int predCount;
+  int *args;
+  int argCount;
+  int argCapacity;
+  int *slots;
+  int slotCount;
+  int slotCapacity;
+
+  // forwarding of trivial phis, see resolveValue()
+  int *forward;
+  // local slots captured by a closure, they can change behind our back
+  bool captured[UINT8_COUNT];
+} IrFunction;
+
+/**
+ * build the CFG, the SSA form and the dominator/loop analysis of the function.
+ * returns false (and leaves an empty IR) when the code has a shape the IR
+ * does not model, the caller should leave such a chunk alone.
+ */
+bool buildIr(IrFunction *ir, ObjFunction *function, Arena *arena);
+void freeIr(IrFunction *ir);
+
+// value a (possibly trivial) phi stands for
+int resolveValue(IrFunction *ir, int value);
+int instrArg(IrFunction *ir, IrInstr *instr, int index);
+// block a dominates block b, a block dominates itself
+bool dominates(IrFunction *ir, int a, int b);
+
+// identical constants, unlike valuesEqual() 0 and -0 differ
+bool sameConstant(Value a, Value b);
+bool isConstantLoad(uint8_t op);
+// an instruction that only pushes a value, removing it has no side effect
+bool isPurePush(uint8_t op);
+// the type checked operator an unchecked number operator stands for
+uint8_t checkedOp(uint8_t op);
+// value pushed by a constant load
+Value loadedConstant(IrFunction *ir, IrInstr *instr);
+// turn a live instruction into a load of the constant value, false if the
+// constant table is full
+bool rewriteAsConstant(IrFunction *ir, IrInstr *instr, Value value);
+void killInstr(IrInstr *instr);
+
+/**
+ * encode the live instructions back into the chunk. returns false and keeps
+ * the chunk untouched if a jump does not fit its operand anymore.
+ */
+bool lowerIr(IrFunction *ir);
+
+void dumpIr(IrFunction *ir);
+
+#endif // YSCRIPT_COMPILER_IR_IR_H_
@@ -0,0 +1,448 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "compiler/ir/passes.h"
+
+const IrPass irPipeline[] = {
+    {"sccp", propagateConstants},
+    {"fold", foldConstants},
+    {"unreachable", removeUnreachableBlocks},
+    {"jumps", removeNopJumps},
+    {"types", inferNumberTypes},
+};
+const int irPipelineLength = sizeof(irPipeline) / sizeof(irPipeline[0]);
+
+static bool isFalseyConstant(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// evaluate an operator on constants, false if it would be a runtime error
+static bool evaluateBinary(uint8_t op, Value a, Value b, Value *result) {
+  op = checkedOp(op);
+  if (op == OP_EQUAL || op == OP_NOT_EQUAL) {
+    *result = BOOL_VAL(valuesEqual(a, b) == (op == OP_EQUAL));
+    return true;
+  }
+  // string concatenation allocates, the interpreter does it.
+  if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    return false;
+
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  switch (op) {
+  case OP_GREATER:
+    *result = BOOL_VAL(x > y);
+    return true;
+  case OP_LESS:
+    *result = BOOL_VAL(x < y);
+    return true;
+  case OP_GREATER_EQUAL:
+    *result = BOOL_VAL(!(x < y));
+    return true;
+  case OP_LESS_EQUAL:
+    *result = BOOL_VAL(!(x > y));
+    return true;
+  case OP_ADD:
+    *result = NUMBER_VAL(x + y);
+    return true;
+  case OP_SUBTRACT:
+    *result = NUMBER_VAL(x - y);
+    return true;
+  case OP_MULTIPLY:
+    *result = NUMBER_VAL(x * y);
+    return true;
+  case OP_DIVIDE:
+    *result = NUMBER_VAL(x / y);
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool evaluateUnary(uint8_t op, Value value, Value *result) {
+  op = checkedOp(op);
+  if (op == OP_NOT) {
+    *result = BOOL_VAL(isFalseyConstant(value));
+    return true;
+  }
+  if (op == OP_NEGATE && IS_NUMBER(value)) {
+    *result = NUMBER_VAL(-AS_NUMBER(value));
+    return true;
+  }
+  return false;
+}
+
+static bool isBinary(uint8_t op) {
+  switch (checkedOp(op)) {
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_NOT_EQUAL:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isUnary(uint8_t op) {
+  op = checkedOp(op);
+  return op == OP_NOT || op == OP_NEGATE;
+}
+
+typedef enum {
+  // no value seen yet, the definition may be unreachable
+  LATTICE_UNDEFINED,
+  LATTICE_CONSTANT,
+  LATTICE_VARYING,
+} LatticeState;
+
+typedef struct {
+  LatticeState state;
+  Value value;
+} Lattice;
+
+typedef struct {
+  IrFunction *ir;
+  Lattice *values;
+  bool *blocks;
+  // one flag per entry of IrFunction.preds
+  bool *edges;
+  bool changed;
+} Propagation;
+
+static Lattice latticeOf(Propagation *prop, int value) {
+  value = resolveValue(prop->ir, value);
+  return prop->values[value];
+}
+
+// move a value down the lattice, never back up
+static void lower(Propagation *prop, int value, Lattice lattice) {
+  Lattice *current = &prop->values[value];
+  if (lattice.state == LATTICE_UNDEFINED ||
+      current->state == LATTICE_VARYING)
+    return;
+  if (current->state == LATTICE_CONSTANT &&
+      lattice.state == LATTICE_CONSTANT &&
+      sameConstant(current->value, lattice.value))
+    return;
+
+  if (current->state == LATTICE_UNDEFINED) {
+    *current = lattice;
+  } else {
+    current->state = LATTICE_VARYING;
+  }
+  prop->changed = true;
+}
+
+static Lattice constantLattice(Value value) {
+  Lattice lattice = {LATTICE_CONSTANT, value};
+  return lattice;
+}
+
+static Lattice varyingLattice() {
+  Lattice lattice = {LATTICE_VARYING, NIL_VAL};
+  return lattice;
+}
+
+static void visitInstr(Propagation *prop, int n) {
+  IrFunction *ir = prop->ir;
+  IrInstr *instr = &ir->instrs[n];
+  int result = instr->result;
+  // instructions that push a value of another instruction define nothing.
+  if (result == -1 || ir->values[result].kind != IR_VALUE_INSTR ||
+      ir->values[result].def != n)
+    return;
+
+  if (isConstantLoad(instr->op)) {
+    lower(prop, result, constantLattice(loadedConstant(ir, instr)));
+  } else if (isBinary(instr->op)) {
+    Lattice a = latticeOf(prop, instrArg(ir, instr, 0));
+    Lattice b = latticeOf(prop, instrArg(ir, instr, 1));
+    Value value;
+    if (a.state == LATTICE_UNDEFINED || b.state == LATTICE_UNDEFINED)
+      return;
+    if (a.state == LATTICE_CONSTANT && b.state == LATTICE_CONSTANT &&
+        evaluateBinary(instr->op, a.value, b.value, &value)) {
+      lower(prop, result, constantLattice(value));
+    } else {
+      lower(prop, result, varyingLattice());
+    }
+  } else if (isUnary(instr->op)) {
+    Lattice a = latticeOf(prop, instrArg(ir, instr, 0));
+    Value value;
+    if (a.state == LATTICE_UNDEFINED)
+      return;
+    if (a.state == LATTICE_CONSTANT &&
+        evaluateUnary(instr->op, a.value, &value)) {
+      lower(prop, result, constantLattice(value));
+    } else {
+      lower(prop, result, varyingLattice());
+    }
+  } else {
+    lower(prop, result, varyingLattice());
+  }
+}
+
+static void markEdges(Propagation *prop, int from, int to) {
+  IrBlock *block = &prop->ir->blocks[to];
+  for (int p = 0; p < block->predCount; p++) {
+    if (prop->ir->preds[block->firstPred + p] == from &&
+        !prop->edges[block->firstPred + p]) {
+      prop->edges[block->firstPred + p] = true;
+      prop->blocks[to] = true;
+      prop->changed = true;
+    }
+  }
+}
+
+static void visitBlock(Propagation *prop, int b) {
+  IrFunction *ir = prop->ir;
+  IrBlock *block = &ir->blocks[b];
+
+  for (int s = 0; s < block->depth; s++) {
+    int phi = ir->slots[block->entrySlots + s];
+    IrValue *value = &ir->values[phi];
+    if (value->kind != IR_VALUE_PHI || value->block != b ||
+        resolveValue(ir, phi) != phi)
+      continue;
+    for (int p = 0; p < block->predCount; p++) {
+      int input = ir->args[value->firstInput + p];
+      if (prop->edges[block->firstPred + p] && input != -1)
+        lower(prop, phi, latticeOf(prop, input));
+    }
+  }
+
+  for (int n = block->start; n < block->end; n++) {
+    visitInstr(prop, n);
+  }
+
+  if (block->end > block->start &&
+      ir->instrs[block->end - 1].op == OP_JUMP_IF_FALSE) {
+    IrInstr *jump = &ir->instrs[block->end - 1];
+    Lattice condition = latticeOf(prop, instrArg(ir, jump, 0));
+    if (condition.state == LATTICE_UNDEFINED)
+      return;
+    if (condition.state == LATTICE_CONSTANT) {
+      markEdges(prop, b,
+                block->succs[isFalseyConstant(condition.value) ? 1 : 0]);
+      return;
+    }
+  }
+  for (int s = 0; s < 2; s++) {
+    if (block->succs[s] != -1)
+      markEdges(prop, b, block->succs[s]);
+  }
+}
+
+int propagateConstants(IrFunction *ir) {
+  Propagation prop;
+  ArenaMark mark = arenaMark(ir->arena);
+  prop.ir = ir;
+  prop.values = ARENA_ALLOCATE(ir->arena, Lattice, ir->valueCount);
+  prop.blocks = ARENA_ALLOCATE(ir->arena, bool, ir->blockCount);
+  prop.edges = ARENA_ALLOCATE(ir->arena, bool, ir->predCount);
+  for (int v = 0; v < ir->valueCount; v++) {
+    prop.values[v].state = ir->values[v].kind == IR_VALUE_ENTRY
+                               ? LATTICE_VARYING
+                               : LATTICE_UNDEFINED;
+    prop.values[v].value = NIL_VAL;
+  }
+  for (int b = 0; b < ir->blockCount; b++) {
+    prop.blocks[b] = b == 0;
+  }
+  for (int p = 0; p < ir->predCount; p++) {
+    prop.edges[p] = false;
+  }
+
+  do {
+    prop.changed = false;
+    for (int i = 0; i < ir->orderCount; i++) {
+      if (prop.blocks[ir->order[i]])
+        visitBlock(&prop, ir->order[i]);
+    }
+  } while (prop.changed);
+
+  int changes = 0;
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    for (int n = block->start; n < block->end; n++) {
+      IrInstr *instr = &ir->instrs[n];
+      if (!instr->live)
+        continue;
+      if (!prop.blocks[b]) {
+        killInstr(instr);
+        changes++;
+        continue;
+      }
+
+      if (instr->op == OP_GET_LOCAL) {
+        Lattice lattice = latticeOf(&prop, instr->result);
+        if (lattice.state == LATTICE_CONSTANT &&
+            rewriteAsConstant(ir, instr, lattice.value))
+          changes++;
+      } else if (instr->op == OP_JUMP_IF_FALSE) {
+        Lattice lattice = latticeOf(&prop, instrArg(ir, instr, 0));
+        if (lattice.state != LATTICE_CONSTANT)
+          continue;
+        // the condition stays on the stack either way.
+        if (isFalseyConstant(lattice.value)) {
+          instr->op = OP_JUMP;
+        } else {
+          killInstr(instr);
+          instr->target = -1;
+        }
+        changes++;
+      }
+    }
+  }
+
+  arenaRelease(ir->arena, mark);
+  return changes;
+}
+
+// the live instruction before n in its block, -1 if none
+static int previousLive(IrFunction *ir, IrBlock *block, int n) {
+  for (int i = n - 1; i >= block->start; i--) {
+    if (ir->instrs[i].live)
+      return i;
+  }
+  return -1;
+}
+
+int foldConstants(IrFunction *ir) {
+  int changes = 0;
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    for (int n = block->start; n < block->end; n++) {
+      IrInstr *instr = &ir->instrs[n];
+      if (!instr->live)
+        continue;
+
+      int right = previousLive(ir, block, n);
+      if (right == -1)
+        continue;
+      IrInstr *operand = &ir->instrs[right];
+
+      if (instr->op == OP_POP && isPurePush(operand->op)) {
+        killInstr(operand);
+        killInstr(instr);
+        changes += 2;
+      } else if (isUnary(instr->op) && isConstantLoad(operand->op)) {
+        Value value;
+        if (evaluateUnary(instr->op, loadedConstant(ir, operand), &value) &&
+            rewriteAsConstant(ir, instr, value)) {
+          killInstr(operand);
+          changes += 2;
+        }
+      } else if (isBinary(instr->op) && isConstantLoad(operand->op)) {
+        int left = previousLive(ir, block, right);
+        if (left == -1 || !isConstantLoad(ir->instrs[left].op))
+          continue;
+        Value value;
+        if (evaluateBinary(instr->op, loadedConstant(ir, &ir->instrs[left]),
+                           loadedConstant(ir, operand), &value) &&
+            rewriteAsConstant(ir, instr, value)) {
+          killInstr(&ir->instrs[left]);
+          killInstr(operand);
+          changes += 3;
+        }
+      }
+    }
+  }
+  return changes;
+}
+
+int removeUnreachableBlocks(IrFunction *ir) {
+  int changes = 0;
+  for (int b = 0; b < ir->blockCount; b++) {
+    IrBlock *block = &ir->blocks[b];
+    if (block->reachable)
+      continue;
+    for (int n = block->start; n < block->end; n++) {
+      if (ir->instrs[n].live) {
+        killInstr(&ir->instrs[n]);
+        changes++;
+      }
+    }
+  }
+  return changes;
+}
+
+int removeNopJumps(IrFunction *ir) {
+  int changes = 0;
+  for (int n = 0; n < ir->instrCount; n++) {
+    IrInstr *instr = &ir->instrs[n];
+    if (!instr->live || instr->op != OP_JUMP)
+      continue;
+    int next = n + 1;
+    while (next < ir->instrCount && !ir->instrs[next].live)
+      next++;
+    int target = ir->blocks[instr->target].start;
+    while (target < ir->instrCount && !ir->instrs[target].live)
+      target++;
+    if (target == next) {
+      killInstr(instr);
+      changes++;
+    }
+  }
+  return changes;
+}
+
+bool runIrPasses(ObjFunction *function, Arena *arena, const IrPass *passes,
+                 int passCount, int *changes, bool dump) {
+  IrFunction ir;
+  if (!buildIr(&ir, function, arena))
+    return false;
+
+  for (int round = 0; round < IR_MAX_ROUNDS; round++) {
+    bool changed = false;
+    for (int p = 0; p < passCount; p++) {
+      int count = passes[p].run(&ir);
+      if (count == 0)
+        continue;
+      // a jump that no longer fits, keep the code of the previous pass.
+      if (!lowerIr(&ir)) {
+        freeIr(&ir);
+        return true;
+      }
+      changes[p] += count;
+      changed = true;
+
+      freeIr(&ir);
+      if (!buildIr(&ir, function, arena))
+        return true;
+    }
+    if (!changed)
+      break;
+  }
+
+  if (dump) {
+    dumpIr(&ir);
+    for (int p = 0; p < passCount; p++) {
+      fprintf(stderr, "-- %-12s %d changes\n", passes[p].name, changes[p]);
+    }
+  }
+  freeIr(&ir);
+  return true;
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMPILER_IR_PASSES_H_
+#define YSCRIPT_COMPILER_IR_PASSES_H_
+
+#include "compiler/ir/ir.h"
+
+// a pipeline is repeated until it reaches a fixpoint, but not forever
+#define IR_MAX_ROUNDS 4
+#define IR_MAX_PASSES 16
+// inferNumberTypes() leaves functions with more instructions alone
+#define IR_MAX_TYPED_INSTRS 32768
+
+typedef struct {
+  const char *name;
+  // returns the number of instructions it rewrote or removed
+  int (*run)(IrFunction *ir);
+} IrPass;
+
+/**
+ * sparse conditional constant propagation over the SSA values. locals that
+ * only ever hold one constant are loaded as that constant and branches on
+ * a constant condition become unconditional. blocks it proves unreachable
+ * are dropped.
+ */
+int propagateConstants(IrFunction *ir);
+
+/**
+ * fold operators whose operands are constant loads right before them in the
+ * same block, and drop values that are pushed only to be popped again.
+ */
+int foldConstants(IrFunction *ir);
+
+// drop blocks the control flow graph can't reach
+int removeUnreachableBlocks(IrFunction *ir);
+
+// drop OP_JUMPs to the next live instruction, so their blocks can merge
+int removeNopJumps(IrFunction *ir);
+
+/**
+ * infer which values can only be numbers and switch the arithmetic and
+ * comparisons on them to the unchecked OP_*_NUM operators. a value is a
+ * number when it is a number constant or the result of -, *, / or unary -
+ * (those fail on anything else), a + of numbers or a phi of numbers. a
+ * checked operator that succeeded also proves its operands are numbers in
+ * the code it dominates.
+ */
+int inferNumberTypes(IrFunction *ir);
+
+/**
+ * run the passes over the function, rebuilding the IR after every pass that
+ * changed the code, until none of them changes anything (or IR_MAX_ROUNDS).
+ * changes[i] accumulates the work of passes[i]. returns false if the
+ * function can't be lifted into the IR, its chunk is left untouched then.
+ * the IR is built in the arena, it is released again before returning.
+ */
+bool runIrPasses(ObjFunction *function, Arena *arena, const IrPass *passes,
+                 int passCount, int *changes, bool dump);
+
+// the pipeline the compiler runs over every function
+extern const IrPass irPipeline[];
+extern const int irPipelineLength;
+
+#endif // YSCRIPT_COMPILER_IR_PASSES_H_
@@ -0,0 +1,294 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "compiler/ir/passes.h"
+
+// the types a value may have at runtime, none for values never defined
+typedef uint8_t TypeSet;
+
+#define TYPE_NONE 0
+#define TYPE_NUMBER (1 << 0)
+#define TYPE_BOOL (1 << 1)
+#define TYPE_NIL (1 << 2)
+#define TYPE_STRING (1 << 3)
+#define TYPE_OBJECT (1 << 4)
+#define TYPE_ANY                                                               \
+  (TYPE_NUMBER | TYPE_BOOL | TYPE_NIL | TYPE_STRING | TYPE_OBJECT)
+
+typedef struct {
+  IrFunction *ir;
+  TypeSet *types;
+  // per entry of IrFunction.args, an earlier instruction checked the value is
+  // a number on every path to the one reading it
+  bool *proven;
+  bool changed;
+} Inference;
+
+static TypeSet typeOfConstant(Value value) {
+  if (IS_NUMBER(value))
+    return TYPE_NUMBER;
+  if (IS_BOOL(value))
+    return TYPE_BOOL;
+  if (IS_NIL(value))
+    return TYPE_NIL;
+  return IS_STRING(value) ? TYPE_STRING : TYPE_OBJECT;
+}
+
+// the runtime error of these operators on anything but numbers guards the
+// code after them
+static bool checksNumbers(uint8_t op) {
+  switch (checkedOp(op)) {
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NEGATE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static uint8_t uncheckedOp(uint8_t op) {
+  switch (op) {
+  case OP_ADD:
+    return OP_ADD_NUM;
+  case OP_SUBTRACT:
+    return OP_SUBTRACT_NUM;
+  case OP_MULTIPLY:
+    return OP_MULTIPLY_NUM;
+  case OP_DIVIDE:
+    return OP_DIVIDE_NUM;
+  case OP_GREATER:
+    return OP_GREATER_NUM;
+  case OP_LESS:
+    return OP_LESS_NUM;
+  case OP_GREATER_EQUAL:
+    return OP_GREATER_EQUAL_NUM;
+  case OP_LESS_EQUAL:
+    return OP_LESS_EQUAL_NUM;
+  case OP_NEGATE:
+    return OP_NEGATE_NUM;
+  default:
+    return op;
+  }
+}
+
+static void proveArgs(Inference *inf, IrBlock *block, bool *checked,
+                      int *undo, int *undoCount) {
+  IrFunction *ir = inf->ir;
+  for (int n = block->start; n < block->end; n++) {
+    IrInstr *instr = &ir->instrs[n];
+    for (int a = 0; a < instr->argCount; a++) {
+      int value = instrArg(ir, instr, a);
+      inf->proven[instr->firstArg + a] = value != -1 && checked[value];
+    }
+    if (!instr->live || !checksNumbers(instr->op))
+      continue;
+    for (int a = 0; a < instr->argCount; a++) {
+      int value = instrArg(ir, instr, a);
+      if (value != -1 && !checked[value]) {
+        checked[value] = true;
+        undo[(*undoCount)++] = value;
+      }
+    }
+  }
+}
+
+// walk the dominator tree with the values checked so far, a block drops the
+// ones it added once its subtree is done
+static void findProvenArgs(Inference *inf) {
+  IrFunction *ir = inf->ir;
+  bool *checked = ARENA_ALLOCATE(ir->arena, bool, ir->valueCount);
+  // every argument adds at most one value
+  int *undo = ARENA_ALLOCATE(ir->arena, int, ir->argCount);
+  int *undoMark = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  int *firstChild = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  int *nextChild = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  // -1 - b once the children of b are pushed
+  int *stack = ARENA_ALLOCATE(ir->arena, int, ir->blockCount);
+  memset(checked, 0, sizeof(bool) * ir->valueCount);
+  memset(inf->proven, 0, sizeof(bool) * ir->argCount);
+  for (int b = 0; b < ir->blockCount; b++) {
+    firstChild[b] = -1;
+  }
+  for (int i = 1; i < ir->orderCount; i++) {
+    int b = ir->order[i];
+    int parent = ir->blocks[b].idom;
+    nextChild[b] = firstChild[parent];
+    firstChild[parent] = b;
+  }
+
+  int undoCount = 0;
+  int top = 0;
+  if (ir->orderCount > 0)
+    stack[top++] = ir->order[0];
+  while (top > 0) {
+    int b = stack[top - 1];
+    if (b < 0) {
+      top--;
+      while (undoCount > undoMark[-1 - b]) {
+        checked[undo[--undoCount]] = false;
+      }
+      continue;
+    }
+    stack[top - 1] = -1 - b;
+    undoMark[b] = undoCount;
+    proveArgs(inf, &ir->blocks[b], checked, undo, &undoCount);
+    for (int c = firstChild[b]; c != -1; c = nextChild[c]) {
+      stack[top++] = c;
+    }
+  }
+}
+
+static TypeSet argType(Inference *inf, int n, int index) {
+  IrFunction *ir = inf->ir;
+  IrInstr *instr = &ir->instrs[n];
+  int value = instrArg(ir, instr, index);
+  if (value == -1)
+    return TYPE_ANY;
+  TypeSet type = inf->types[value];
+  if (type != TYPE_NUMBER && inf->proven[instr->firstArg + index])
+    type &= TYPE_NUMBER;
+  return type;
+}
+
+static void widen(Inference *inf, int value, TypeSet type) {
+  if ((inf->types[value] | type) != inf->types[value]) {
+    inf->types[value] |= type;
+    inf->changed = true;
+  }
+}
+
+static void inferInstr(Inference *inf, int n) {
+  IrFunction *ir = inf->ir;
+  IrInstr *instr = &ir->instrs[n];
+  int result = instr->result;
+  // instructions that push a value of another instruction define nothing.
+  if (result == -1 || ir->values[result].kind != IR_VALUE_INSTR ||
+      ir->values[result].def != n)
+    return;
+
+  switch (checkedOp(instr->op)) {
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_CONSTANT:
+    widen(inf, result, typeOfConstant(loadedConstant(ir, instr)));
+    break;
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NEGATE:
+    widen(inf, result, TYPE_NUMBER);
+    break;
+  case OP_ADD: {
+    TypeSet a = argType(inf, n, 0);
+    TypeSet b = argType(inf, n, 1);
+    // numbers or strings on both sides, anything else is a runtime error.
+    widen(inf, result, a & b & (TYPE_NUMBER | TYPE_STRING));
+    break;
+  }
+  case OP_EQUAL:
+  case OP_NOT_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_NOT:
+    widen(inf, result, TYPE_BOOL);
+    break;
+  default:
+    widen(inf, result, TYPE_ANY);
+    break;
+  }
+}
+
+static void inferBlock(Inference *inf, int b) {
+  IrFunction *ir = inf->ir;
+  IrBlock *block = &ir->blocks[b];
+
+  for (int s = 0; s < block->depth; s++) {
+    int phi = ir->slots[block->entrySlots + s];
+    IrValue *value = &ir->values[phi];
+    if (value->kind != IR_VALUE_PHI || value->block != b ||
+        resolveValue(ir, phi) != phi)
+      continue;
+    for (int p = 0; p < block->predCount; p++) {
+      int input = ir->args[value->firstInput + p];
+      if (input != -1)
+        widen(inf, phi, inf->types[resolveValue(ir, input)]);
+    }
+  }
+
+  for (int n = block->start; n < block->end; n++) {
+    if (ir->instrs[n].live)
+      inferInstr(inf, n);
+  }
+}
+
+int inferNumberTypes(IrFunction *ir) {
+  // the fixpoint below revisits the whole function, huge ones keep their
+  // checked arithmetic
+  if (ir->instrCount > IR_MAX_TYPED_INSTRS)
+    return 0;
+
+  Inference inf;
+  ArenaMark mark = arenaMark(ir->arena);
+  inf.ir = ir;
+  inf.types = ARENA_ALLOCATE(ir->arena, TypeSet, ir->valueCount);
+  inf.proven = ARENA_ALLOCATE(ir->arena, bool, ir->argCount);
+  for (int v = 0; v < ir->valueCount; v++) {
+    inf.types[v] =
+        ir->values[v].kind == IR_VALUE_ENTRY ? TYPE_ANY : TYPE_NONE;
+  }
+  findProvenArgs(&inf);
+
+  // types only grow, the loop ends once the phis of the loops are stable.
+  do {
+    inf.changed = false;
+    for (int i = 0; i < ir->orderCount; i++) {
+      inferBlock(&inf, ir->order[i]);
+    }
+  } while (inf.changed);
+
+  int changes = 0;
+  for (int i = 0; i < ir->orderCount; i++) {
+    IrBlock *block = &ir->blocks[ir->order[i]];
+    for (int n = block->start; n < block->end; n++) {
+      IrInstr *instr = &ir->instrs[n];
+      uint8_t unchecked = uncheckedOp(instr->op);
+      if (!instr->live || unchecked == instr->op)
+        continue;
+      bool numbers = true;
+      for (int a = 0; a < instr->argCount; a++) {
+        numbers = numbers && argType(&inf, n, a) == TYPE_NUMBER;
+      }
+      if (numbers) {
+        instr->op = unchecked;
+        changes++;
+      }
+    }
+  }
+
+  arenaRelease(ir->arena, mark);
+  return changes;
+}
@@ -20,7 +20,9 @@
 
 #include "common/config.h"
 #include "common/memory.h"
+#include "compiler/ir/passes.h"
 #include "compiler/parser.h"
+#include "compiler/peephole.h"
 #include "compiler/scanner.h"
 
 #ifdef ENABLE_COMPILE_TRACE
@@ -63,7 +65,7 @@ typedef struct {
 } Local;
 
 typedef struct {
-  uint8_t index;
+  uint16_t index;
   bool isLocal;
 } Upvalue;
 
@@ -75,14 +77,35 @@ typedef enum {
   TYPE_SCRIPT
 } FunctionType;
 
+// constant loads at the end of the chunk we may still fold away
+#define FOLD_WINDOW 16
+
+typedef struct {
+  int offset;
+  // constant table index, -1 for OP_NIL/OP_TRUE/OP_FALSE
+  int constant;
+  Value value;
+} FoldOperand;
+
 typedef struct Compiler {
   struct Compiler *enclosing;
   ObjFunction *function;
   FunctionType type;
-  Local locals[UINT8_COUNT];
+  // grown in the compiler arena, up to UINT8_COUNT entries
+  Local *locals;
   int localCount;
-  Upvalue upvalues[UINT8_COUNT];
+  int localCapacity;
+  Upvalue *upvalues;
+  int upvalueCapacity;
   int scopeDepth;
+  FoldOperand folds[FOLD_WINDOW];
+  int foldCount;
+  // code before this offset is a jump target or jumps, never fold across it
+  int foldBarrier;
+  // forward jumps are emitted with OP_WIDE
+  bool wideJumps;
+  // a compact forward jump did not fit, the function is compiled again
+  bool jumpOverflow;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -95,6 +118,16 @@ Parser parser;
 Compiler *current = NULL;
 ClassCompiler *currentClass = NULL;
 
+// the compiler tables and the code of the functions not finished yet, all
+// dropped at the end of compile()
+static Arena compilerArena;
+// working memory of the optimizer passes, released after every pass
+static Arena scratchArena;
+
+CompilerOptions compilerOptions = {true, false, true, true, true, false, true};
+
+PeepholeStats peepholeStats;
+
 static Chunk *currentChunk() { return &current->function->chunk; }
 
 static void errorAt(Token *token, const char *message) {
@@ -155,18 +188,40 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
   emitByte(byte2);
 }
 
-static void emitLoop(int loopStart) {
-  emitByte(OP_LOOP);
+static void markJumpTarget(int offset) { current->foldBarrier = offset; }
 
-  int offset = currentChunk()->count - loopStart + 2;
-  if (offset > UINT16_MAX)
-    error("Loop body too large.");
+// the compact form when the operand fits in a byte, OP_WIDE otherwise
+static void emitOperand(uint8_t instruction, int operand) {
+  if (operand <= UINT8_MAX) {
+    emitBytes(instruction, (uint8_t)operand);
+    return;
+  }
+  emitBytes(OP_WIDE, instruction);
+  emitBytes((operand >> 8) & 0xff, operand & 0xff);
+}
 
-  emitByte((offset >> 8) & 0xff);
-  emitByte(offset & 0xff);
+static void emitLoop(int loopStart) {
+  // +3 for the OP_LOOP and its own offset.
+  int offset = currentChunk()->count + 3 - loopStart;
+  if (offset <= UINT16_MAX) {
+    emitByte(OP_LOOP);
+    emitBytes((offset >> 8) & 0xff, offset & 0xff);
+    return;
+  }
+
+  offset = currentChunk()->count + 6 - loopStart;
+  emitBytes(OP_WIDE, OP_LOOP);
+  emitBytes((offset >> 24) & 0xff, (offset >> 16) & 0xff);
+  emitBytes((offset >> 8) & 0xff, offset & 0xff);
 }
 
 static int emitJump(uint8_t instruction) {
+  if (current->wideJumps) {
+    emitBytes(OP_WIDE, instruction);
+    emitBytes(0xff, 0xff);
+    emitBytes(0xff, 0xff);
+    return currentChunk()->count - 4;
+  }
   emitByte(instruction);
   emitByte(0xff);
   emitByte(0xff);
@@ -182,44 +237,159 @@ static void emitReturn() {
   emitByte(OP_RETURN);
 }
 
-static uint8_t makeConstant(Value value) {
+static int makeConstant(Value value) {
   int constant = addConstant(currentChunk(), value);
-  if (constant > UINT8_MAX) {
+  if (constant > UINT16_MAX) {
     error("Too many constants in one chunk.");
     return 0;
   }
-  return (uint8_t)constant;
+  return constant;
+}
+
+static void recordConstant(int offset, int constant, Value value) {
+  if (!compilerOptions.constantFolding)
+    return;
+  if (current->foldCount == FOLD_WINDOW) {
+    memmove(current->folds, current->folds + 1,
+            sizeof(FoldOperand) * (FOLD_WINDOW - 1));
+    current->foldCount--;
+  }
+  FoldOperand *operand = &current->folds[current->foldCount++];
+  operand->offset = offset;
+  operand->constant = constant;
+  operand->value = value;
 }
 
 static void emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+  int offset = currentChunk()->count;
+  int constant = makeConstant(value);
+  emitOperand(OP_CONSTANT, constant);
+  recordConstant(offset, constant, value);
+}
+
+static void emitLiteral(uint8_t instruction, Value value) {
+  int offset = currentChunk()->count;
+  emitByte(instruction);
+  recordConstant(offset, -1, value);
+}
+
+// emit a folded value with the cheapest instruction that loads it
+static void emitFolded(Value value) {
+  if (IS_NIL(value)) {
+    emitLiteral(OP_NIL, value);
+  } else if (IS_BOOL(value)) {
+    emitLiteral(AS_BOOL(value) ? OP_TRUE : OP_FALSE, value);
+  } else {
+    emitConstant(value);
+  }
+}
+
+/**
+ * the last `count` constant loads, operands[0] being the first one. they must
+ * be back-to-back at the end of the chunk with no jump target in between, so
+ * replacing them with a single load can not change the meaning of the code.
+ */
+static bool foldOperands(FoldOperand **operands, int count) {
+  if (current->foldCount < count)
+    return false;
+
+  int end = currentChunk()->count;
+  for (int i = count - 1; i >= 0; i--) {
+    FoldOperand *operand = &current->folds[current->foldCount - count + i];
+    int length = operand->constant == -1          ? 1
+                 : operand->constant > UINT8_MAX ? 4
+                                                 : 2;
+    if (operand->offset < current->foldBarrier ||
+        operand->offset + length != end)
+      return false;
+    end = operand->offset;
+    operands[i] = operand;
+  }
+  return true;
+}
+
+// remove the last `count` constant loads and their unshared constants
+static void dropOperands(int count) {
+  Chunk *chunk = currentChunk();
+  for (int i = 0; i < count; i++) {
+    FoldOperand *operand = &current->folds[--current->foldCount];
+    chunk->count = operand->offset;
+    if (operand->constant != -1 &&
+        operand->constant == chunk->constants.count - 1) {
+      chunk->constants.count--;
+    }
+  }
+}
+
+// throw away the code and constants emitted since a previous count
+static void rewindChunk(int code, int constants) {
+  Chunk *chunk = currentChunk();
+  chunk->count = code;
+  chunk->constants.count = constants;
+  while (current->foldCount > 0 &&
+         current->folds[current->foldCount - 1].offset >= code) {
+    current->foldCount--;
+  }
+  markJumpTarget(code);
 }
 
 static void patchJump(int offset) {
-  // -2 to adjust for the bytecode for the jump offset itself.
-  int jump = currentChunk()->count - offset - 2;
+  Chunk *chunk = currentChunk();
+  if (current->wideJumps) {
+    // -4 to adjust for the bytecode for the jump offset itself.
+    int jump = chunk->count - offset - 4;
+    chunk->code[offset] = (jump >> 24) & 0xff;
+    chunk->code[offset + 1] = (jump >> 16) & 0xff;
+    chunk->code[offset + 2] = (jump >> 8) & 0xff;
+    chunk->code[offset + 3] = jump & 0xff;
+  } else {
+    // -2 to adjust for the bytecode for the jump offset itself.
+    int jump = chunk->count - offset - 2;
+    if (jump > UINT16_MAX)
+      current->jumpOverflow = true;
+    chunk->code[offset] = (jump >> 8) & 0xff;
+    chunk->code[offset + 1] = jump & 0xff;
+  }
+  markJumpTarget(chunk->count);
+}
 
-  if (jump > UINT16_MAX) {
-    error("Too much code to jump over.");
+static Local *pushLocal() {
+  if (current->localCapacity < current->localCount + 1) {
+    int oldCapacity = current->localCapacity;
+    current->localCapacity = GROW_CAPACITY(oldCapacity);
+    current->locals = ARENA_GROW_ARRAY(&compilerArena, Local, current->locals,
+                                       oldCapacity, current->localCapacity);
   }
-  currentChunk()->code[offset] = (jump >> 8) & 0xff;
-  currentChunk()->code[offset + 1] = jump & 0xff;
+  Local *local = &current->locals[current->localCount++];
+  if (current->localCount > current->function->localCount)
+    current->function->localCount = current->localCount;
+  return local;
 }
 
 static void initCompiler(Compiler *compiler, FunctionType type) {
   compiler->enclosing = current;
   compiler->function = NULL;
   compiler->type = type;
+  compiler->locals = NULL;
   compiler->localCount = 0;
+  compiler->localCapacity = 0;
+  compiler->upvalues = NULL;
+  compiler->upvalueCapacity = 0;
   compiler->scopeDepth = 0;
+  compiler->foldCount = 0;
+  compiler->foldBarrier = 0;
+  compiler->wideJumps = false;
+  compiler->jumpOverflow = false;
   compiler->function = newFunction();
+  compiler->function->chunk.arena = &compilerArena;
   current = compiler;
   if (type != TYPE_SCRIPT) {
     current->function->name =
         copyString(parser.previous.start, parser.previous.length);
+    current->function->line = parser.previous.line;
   }
 
-  Local *local = &current->locals[current->localCount++];
+  Local *local = pushLocal();
   local->depth = 0;
   local->isCaptured = false;
 
@@ -232,12 +402,52 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
   }
 }
 
+static void reportPeephole(const char *name, PeepholeStats *stats) {
+  fprintf(stderr,
+          "-- peephole %-16s %5d -> %5d instructions %6d -> %6d bytes\n",
+          name, stats->instructionsBefore, stats->instructionsAfter,
+          stats->bytesBefore, stats->bytesAfter);
+}
+
+static void optimizeFunction(ObjFunction *function) {
+  PeepholeStats stats;
+  initPeepholeStats(&stats);
+  optimizeChunk(&function->chunk, &scratchArena, &stats);
+
+  if (compilerOptions.peepholeReport) {
+    reportPeephole(function->name != NULL ? function->name->chars
+                                          : "<script>",
+                   &stats);
+  }
+  peepholeStats.instructionsBefore += stats.instructionsBefore;
+  peepholeStats.instructionsAfter += stats.instructionsAfter;
+  peepholeStats.bytesBefore += stats.bytesBefore;
+  peepholeStats.bytesAfter += stats.bytesAfter;
+}
+
 static ObjFunction *endCompiler() {
   emitReturn();
   ObjFunction *function = current->function;
 
+  if (compilerOptions.ir && !parser.hadError) {
+    IrPass passes[IR_MAX_PASSES];
+    int passCount = 0;
+    for (int p = 0; p < irPipelineLength; p++) {
+      if (irPipeline[p].run != inferNumberTypes ||
+          compilerOptions.typeInference)
+        passes[passCount++] = irPipeline[p];
+    }
+    int changes[IR_MAX_PASSES] = {0};
+    runIrPasses(function, &scratchArena, passes, passCount, changes,
+                compilerOptions.dumpIr);
+  }
+  if (compilerOptions.peephole && !parser.hadError) {
+    optimizeFunction(function);
+  }
+  finishChunk(&function->chunk);
+
 #ifdef ENABLE_COMPILE_TRACE
-  if (!parser.hadError) {
+  if (compilerOptions.printCode && !parser.hadError) {
     disassembleChunk(currentChunk(), function->name != NULL
                                          ? function->name->chars
                                          : "<script>");
@@ -268,7 +478,7 @@ static void declaration();
 static ParseRule *getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
-static uint8_t identifierConstant(Token *name) {
+static int identifierConstant(Token *name) {
   return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
@@ -291,7 +501,7 @@ static int resolveLocal(Compiler *compiler, Token *name) {
   return -1;
 }
 
-static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal) {
+static int addUpvalue(Compiler *compiler, uint16_t index, bool isLocal) {
   int upvalueCount = compiler->function->upvalueCount;
   for (int i = 0; i < upvalueCount; i++) {
     Upvalue *upvalue = &compiler->upvalues[i];
@@ -300,11 +510,18 @@ static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal) {
     }
   }
 
-  if (upvalueCount == UINT8_COUNT) {
+  if (upvalueCount == UINT16_COUNT) {
     error("Too many closure variables in function.");
     return 0;
   }
 
+  if (compiler->upvalueCapacity < upvalueCount + 1) {
+    int oldCapacity = compiler->upvalueCapacity;
+    compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+    compiler->upvalues =
+        ARENA_GROW_ARRAY(&compilerArena, Upvalue, compiler->upvalues,
+                         oldCapacity, compiler->upvalueCapacity);
+  }
   compiler->upvalues[upvalueCount].isLocal = isLocal;
   compiler->upvalues[upvalueCount].index = index;
   return compiler->function->upvalueCount++;
@@ -317,23 +534,23 @@ static int resolveUpvalue(Compiler *compiler, Token *name) {
   int local = resolveLocal(compiler->enclosing, name);
   if (local != -1) {
     compiler->enclosing->locals[local].isCaptured = true;
-    return addUpvalue(compiler, (uint8_t)local, true);
+    return addUpvalue(compiler, (uint16_t)local, true);
   }
 
   int upvalue = resolveUpvalue(compiler->enclosing, name);
   if (upvalue != -1) {
-    return addUpvalue(compiler, (uint8_t)upvalue, false);
+    return addUpvalue(compiler, (uint16_t)upvalue, false);
   }
   return -1;
 }
 
 static void addLocal(Token name) {
-  if (current->localCount == UINT8_COUNT) {
+  if (current->localCount == UINT16_COUNT) {
     error("Too many local variables in function.");
     return;
   }
 
-  Local *local = &current->locals[current->localCount++];
+  Local *local = pushLocal();
   local->name = name;
   /* Local Variables add-local < Local Variables declare-undefined
     local->depth = current->scopeDepth;
@@ -361,7 +578,7 @@ static void declareVariable() {
   addLocal(*name);
 }
 
-static uint8_t parseVariable(const char *errorMessage) {
+static int parseVariable(const char *errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
   declareVariable();
   if (current->scopeDepth > 0)
@@ -376,13 +593,13 @@ static void markInitialized() {
   current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(int global) {
   if (current->scopeDepth > 0) {
     markInitialized();
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitOperand(OP_DEFINE_GLOBAL, global);
 }
 
 static uint8_t argumentList() {
@@ -409,11 +626,115 @@ static void and_(bool canAssign) {
   patchJump(endJump);
 }
 
+static bool isFalseyConstant(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static Value concatenateConstants(ObjString *a, ObjString *b) {
+  int length = a->length + b->length;
+  char *chars = ALLOCATE(char, length + 1);
+  memcpy(chars, a->chars, a->length);
+  memcpy(chars + a->length, b->chars, b->length);
+  chars[length] = '\0';
+  return OBJ_VAL(takeString(chars, length));
+}
+
+// evaluate a binary operator on two constant operands at compile time, the
+// operators that would raise a runtime error are left to the interpreter.
+static bool foldBinary(TokenType operatorType) {
+  FoldOperand *operands[2];
+  if (!foldOperands(operands, 2))
+    return false;
+
+  Value a = operands[0]->value;
+  Value b = operands[1]->value;
+  Value result;
+  if (operatorType == TOKEN_EQUAL_EQUAL) {
+    result = BOOL_VAL(valuesEqual(a, b));
+  } else if (operatorType == TOKEN_BANG_EQUAL) {
+    result = BOOL_VAL(!valuesEqual(a, b));
+  } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (operatorType) {
+    case TOKEN_GREATER:
+      result = BOOL_VAL(x > y);
+      break;
+    case TOKEN_GREATER_EQUAL:
+      result = BOOL_VAL(!(x < y));
+      break;
+    case TOKEN_LESS:
+      result = BOOL_VAL(x < y);
+      break;
+    case TOKEN_LESS_EQUAL:
+      result = BOOL_VAL(!(x > y));
+      break;
+    case TOKEN_PLUS:
+      result = NUMBER_VAL(x + y);
+      break;
+    case TOKEN_MINUS:
+      result = NUMBER_VAL(x - y);
+      break;
+    case TOKEN_STAR:
+      result = NUMBER_VAL(x * y);
+      break;
+    case TOKEN_SLASH:
+      result = NUMBER_VAL(x / y);
+      break;
+    default:
+      return false;
+    }
+  } else if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+    // the operands stay in the constant table until the result is interned.
+    result = concatenateConstants(AS_STRING(a), AS_STRING(b));
+  } else {
+    return false;
+  }
+
+  dropOperands(2);
+  emitFolded(result);
+  return true;
+}
+
+static bool foldUnary(TokenType operatorType) {
+  FoldOperand *operands[1];
+  if (!foldOperands(operands, 1))
+    return false;
+
+  Value value = operands[0]->value;
+  Value result;
+  if (operatorType == TOKEN_BANG) {
+    result = BOOL_VAL(isFalseyConstant(value));
+  } else if (operatorType == TOKEN_MINUS && IS_NUMBER(value)) {
+    result = NUMBER_VAL(-AS_NUMBER(value));
+  } else {
+    return false;
+  }
+
+  dropOperands(1);
+  emitFolded(result);
+  return true;
+}
+
+// take the value of a condition that compiled to a single constant load
+static bool constantCondition(int conditionStart, Value *value) {
+  FoldOperand *operands[1];
+  if (!foldOperands(operands, 1) || operands[0]->offset != conditionStart)
+    return false;
+
+  *value = operands[0]->value;
+  dropOperands(1);
+  return true;
+}
+
 static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
   ParseRule *rule = getRule(operatorType);
   parsePrecedence((Precedence)(rule->precedence + 1));
 
+  if (foldBinary(operatorType))
+    return;
+
   switch (operatorType) {
   case TOKEN_BANG_EQUAL:
     emitBytes(OP_EQUAL, OP_NOT);
@@ -458,32 +779,32 @@ static void call(bool canAssign) {
 
 static void dot(bool canAssign) {
   consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-  uint8_t name = identifierConstant(&parser.previous);
+  int name = identifierConstant(&parser.previous);
 
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(OP_SET_PROPERTY, name);
+    emitOperand(OP_SET_PROPERTY, name);
 
   } else if (match(TOKEN_LEFT_PAREN)) {
     uint8_t argCount = argumentList();
-    emitBytes(OP_INVOKE, name);
+    emitOperand(OP_INVOKE, name);
     emitByte(argCount);
 
   } else {
-    emitBytes(OP_GET_PROPERTY, name);
+    emitOperand(OP_GET_PROPERTY, name);
   }
 }
 
 static void literal(bool canAssign) {
   switch (parser.previous.type) {
   case TOKEN_FALSE:
-    emitByte(OP_FALSE);
+    emitLiteral(OP_FALSE, BOOL_VAL(false));
     break;
   case TOKEN_NIL:
-    emitByte(OP_NIL);
+    emitLiteral(OP_NIL, NIL_VAL);
     break;
   case TOKEN_TRUE:
-    emitByte(OP_TRUE);
+    emitLiteral(OP_TRUE, BOOL_VAL(true));
     break;
   default:
     return; // Unreachable.
@@ -536,9 +857,9 @@ static void namedVariable(Token name, bool canAssign) {
 
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(setOp, (uint8_t)arg);
+    emitOperand(setOp, arg);
   } else {
-    emitBytes(getOp, (uint8_t)arg);
+    emitOperand(getOp, arg);
   }
 }
 
@@ -562,18 +883,18 @@ static void super_(bool canAssign) {
 
   consume(TOKEN_DOT, "Expect '.' after 'super'.");
   consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-  uint8_t name = identifierConstant(&parser.previous);
+  int name = identifierConstant(&parser.previous);
 
   namedVariable(syntheticToken("this"), false);
 
   if (match(TOKEN_LEFT_PAREN)) {
     uint8_t argCount = argumentList();
     namedVariable(syntheticToken("super"), false);
-    emitBytes(OP_SUPER_INVOKE, name);
+    emitOperand(OP_SUPER_INVOKE, name);
     emitByte(argCount);
   } else {
     namedVariable(syntheticToken("super"), false);
-    emitBytes(OP_GET_SUPER, name);
+    emitOperand(OP_GET_SUPER, name);
   }
 }
 
@@ -590,6 +911,9 @@ static void unary(bool canAssign) {
 
   parsePrecedence(PREC_UNARY);
 
+  if (foldUnary(operatorType))
+    return;
+
   // Emit the operator instruction.
   switch (operatorType) {
   case TOKEN_BANG:
@@ -605,46 +929,47 @@ static void unary(bool canAssign) {
 }
 
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
-    [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE}, // [big]
-    [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT] = {NULL, dot, PREC_CALL},
-    [TOKEN_MINUS] = {unary, binary, PREC_TERM},
-    [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
-    [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
-    [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
-    [TOKEN_BANG] = {unary, NULL, PREC_NONE},
-    [TOKEN_BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
-    [TOKEN_EQUAL] = {NULL, NULL, PREC_NONE},
-    [TOKEN_EQUAL_EQUAL] = {NULL, binary, PREC_EQUALITY},
-    [TOKEN_GREATER] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
-    [TOKEN_STRING] = {string, NULL, PREC_NONE},
-    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
-    [TOKEN_AND] = {NULL, and_, PREC_AND},
-    [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
-    [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
-    [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
-    [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_IF] = {NULL, NULL, PREC_NONE},
-    [TOKEN_NIL] = {literal, NULL, PREC_NONE},
-    [TOKEN_OR] = {NULL, or_, PREC_OR},
-    [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
-    [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
-    [TOKEN_THIS] = {this_, NULL, PREC_NONE},
-    [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
-    [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
-    [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
-    [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
+    /* TOKEN_LEFT_PAREN */ {grouping, call, PREC_CALL},
+    /* TOKEN_RIGHT_PAREN */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_LEFT_BRACE */ {NULL, NULL, PREC_NONE}, // [big]
+    /* TOKEN_RIGHT_BRACE */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_COMMA */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_DOT */ {NULL, dot, PREC_CALL},
+    /* TOKEN_MINUS */ {unary, binary, PREC_TERM},
+    /* TOKEN_PLUS */ {NULL, binary, PREC_TERM},
+    /* TOKEN_SEMICOLON */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_SLASH */ {NULL, binary, PREC_FACTOR},
+    /* TOKEN_STAR */ {NULL, binary, PREC_FACTOR},
+    /* TOKEN_BANG */ {unary, NULL, PREC_NONE},
+    /* TOKEN_BANG_EQUAL */ {NULL, binary, PREC_EQUALITY},
+    /* TOKEN_EQUAL */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_EQUAL_EQUAL */ {NULL, binary, PREC_EQUALITY},
+    /* TOKEN_GREATER */ {NULL, binary, PREC_COMPARISON},
+    /* TOKEN_GREATER_EQUAL */ {NULL, binary, PREC_COMPARISON},
+    /* TOKEN_LESS */ {NULL, binary, PREC_COMPARISON},
+    /* TOKEN_LESS_EQUAL */ {NULL, binary, PREC_COMPARISON},
+    /* TOKEN_COLON */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_IDENTIFIER */ {variable, NULL, PREC_NONE},
+    /* TOKEN_STRING */ {string, NULL, PREC_NONE},
+    /* TOKEN_NUMBER */ {number, NULL, PREC_NONE},
+    /* TOKEN_AND */ {NULL, and_, PREC_AND},
+    /* TOKEN_CLASS */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_ELSE */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_FALSE */ {literal, NULL, PREC_NONE},
+    /* TOKEN_FOR */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_FUN */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_IF */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_NIL */ {literal, NULL, PREC_NONE},
+    /* TOKEN_OR */ {NULL, or_, PREC_OR},
+    /* TOKEN_PRINT */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_RETURN */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_SUPER */ {super_, NULL, PREC_NONE},
+    /* TOKEN_THIS */ {this_, NULL, PREC_NONE},
+    /* TOKEN_TRUE */ {literal, NULL, PREC_NONE},
+    /* TOKEN_VAR */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_WHILE */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_ERROR */ {NULL, NULL, PREC_NONE},
+    /* TOKEN_EOF */ {NULL, NULL, PREC_NONE},
 };
 
 static void parsePrecedence(Precedence precedence) {
@@ -680,40 +1005,78 @@ static void block() {
   consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
+/**
+ * a function whose forward jumps outgrew 16 bits is dropped, the caller
+ * rewinds the source and compiles it again with wide jumps.
+ */
+static bool compileAgain() {
+  if (!current->jumpOverflow || current->wideJumps || parser.hadError)
+    return false;
+  // the remembered set or the gray stack may still scan the abandoned
+  // function after the arena is gone
+  freeChunk(&current->function->chunk);
+  current = current->enclosing;
+  return true;
+}
+
 static void function(FunctionType type) {
+  Scanner scannerState = saveScanner();
+  Parser parserState = parser;
+  bool wideJumps = false;
   Compiler compiler;
-  initCompiler(&compiler, type);
-  beginScope(); // [no-end-scope]
+  for (;;) {
+    initCompiler(&compiler, type);
+    compiler.wideJumps = wideJumps;
+    beginScope(); // [no-end-scope]
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+
+    if (!check(TOKEN_RIGHT_PAREN)) {
+      do {
+        current->function->arity++;
+        if (current->function->arity > 255) {
+          errorAtCurrent("Can't have more than 255 parameters.");
+        }
+        int constant = parseVariable("Expect parameter name.");
+        defineVariable(constant);
+      } while (match(TOKEN_COMMA));
+    }
 
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
 
-  if (!check(TOKEN_RIGHT_PAREN)) {
-    do {
-      current->function->arity++;
-      if (current->function->arity > 255) {
-        errorAtCurrent("Can't have more than 255 parameters.");
-      }
-      uint8_t constant = parseVariable("Expect parameter name.");
-      defineVariable(constant);
-    } while (match(TOKEN_COMMA));
+    if (!compileAgain())
+      break;
+    restoreScanner(scannerState);
+    parser = parserState;
+    wideJumps = true;
   }
 
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
-  consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-  block();
-
   ObjFunction *function = endCompiler();
-  emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+  int constant = makeConstant(OBJ_VAL(function));
+  bool wide = constant > UINT8_MAX;
+  for (int i = 0; i < function->upvalueCount; i++) {
+    wide = wide || compiler.upvalues[i].index > UINT8_MAX;
+  }
 
+  if (wide) {
+    emitBytes(OP_WIDE, OP_CLOSURE);
+    emitBytes((constant >> 8) & 0xff, constant & 0xff);
+  } else {
+    emitBytes(OP_CLOSURE, (uint8_t)constant);
+  }
   for (int i = 0; i < function->upvalueCount; i++) {
     emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-    emitByte(compiler.upvalues[i].index);
+    if (wide)
+      emitByte((compiler.upvalues[i].index >> 8) & 0xff);
+    emitByte(compiler.upvalues[i].index & 0xff);
   }
 }
 
 static void method() {
   consume(TOKEN_IDENTIFIER, "Expect method name.");
-  uint8_t constant = identifierConstant(&parser.previous);
+  int constant = identifierConstant(&parser.previous);
   FunctionType type = TYPE_METHOD;
 
   if (parser.previous.length == 4 &&
@@ -722,7 +1085,7 @@ static void method() {
   }
 
   function(type);
-  emitBytes(OP_METHOD, constant);
+  emitOperand(OP_METHOD, constant);
 }
 
 static void classDeclaration() {
@@ -730,10 +1093,10 @@ static void classDeclaration() {
 
   Token className = parser.previous;
 
-  uint8_t nameConstant = identifierConstant(&parser.previous);
+  int nameConstant = identifierConstant(&parser.previous);
   declareVariable();
 
-  emitBytes(OP_CLASS, nameConstant);
+  emitOperand(OP_CLASS, nameConstant);
   defineVariable(nameConstant);
 
   ClassCompiler classCompiler;
@@ -781,14 +1144,14 @@ static void classDeclaration() {
 }
 
 static void funDeclaration() {
-  uint8_t global = parseVariable("Expect function name.");
+  int global = parseVariable("Expect function name.");
   markInitialized();
   function(TYPE_FUNCTION);
   defineVariable(global);
 }
 
 static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+  int global = parseVariable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
@@ -806,6 +1169,14 @@ static void expressionStatement() {
   emitByte(OP_POP);
 }
 
+// compile a statement that can never run, for its errors only
+static void deadStatement() {
+  int code = currentChunk()->count;
+  int constants = currentChunk()->constants.count;
+  statement();
+  rewindChunk(code, constants);
+}
+
 static void forStatement() {
   beginScope();
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
@@ -819,16 +1190,27 @@ static void forStatement() {
   }
 
   int loopStart = currentChunk()->count;
+  markJumpTarget(loopStart);
   int exitJump = -1;
+  bool deadLoop = false;
   if (!match(TOKEN_SEMICOLON)) {
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-    // Jump out of the loop if the condition is false.
-    exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP); // Condition.
+    Value condition;
+    if (constantCondition(loopStart, &condition)) {
+      // a truthy constant needs no check, a falsey one skips the whole loop.
+      deadLoop = isFalseyConstant(condition);
+    } else {
+      // Jump out of the loop if the condition is false.
+      exitJump = emitJump(OP_JUMP_IF_FALSE);
+      emitByte(OP_POP); // Condition.
+    }
   }
 
+  int deadCode = currentChunk()->count;
+  int deadConstants = currentChunk()->constants.count;
+
   if (!match(TOKEN_RIGHT_PAREN)) {
     int bodyJump = emitJump(OP_JUMP);
     int incrementStart = currentChunk()->count;
@@ -844,6 +1226,10 @@ static void forStatement() {
   statement();
   emitLoop(loopStart);
 
+  if (deadLoop) {
+    rewindChunk(deadCode, deadConstants);
+  }
+
   if (exitJump != -1) {
     patchJump(exitJump);
     emitByte(OP_POP); // Condition.
@@ -854,9 +1240,24 @@ static void forStatement() {
 
 static void ifStatement() {
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  int conditionStart = currentChunk()->count;
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition."); // [paren]
 
+  Value condition;
+  if (constantCondition(conditionStart, &condition)) {
+    if (isFalseyConstant(condition)) {
+      deadStatement();
+      if (match(TOKEN_ELSE))
+        statement();
+    } else {
+      statement();
+      if (match(TOKEN_ELSE))
+        deadStatement();
+    }
+    return;
+  }
+
   int thenJump = emitJump(OP_JUMP_IF_FALSE);
 
   emitByte(OP_POP);
@@ -900,11 +1301,23 @@ static void returnStatement() {
 
 static void whileStatement() {
   int loopStart = currentChunk()->count;
+  markJumpTarget(loopStart);
 
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+  Value condition;
+  if (constantCondition(loopStart, &condition)) {
+    if (isFalseyConstant(condition)) {
+      deadStatement();
+    } else {
+      statement();
+      emitLoop(loopStart);
+    }
+    return;
+  }
+
   int exitJump = emitJump(OP_JUMP_IF_FALSE);
   emitByte(OP_POP);
   statement();
@@ -991,18 +1404,35 @@ ObjFunction *compile(const char *source) {
   */
 
   Compiler compiler;
-  initCompiler(&compiler, TYPE_SCRIPT);
+  bool wideJumps = false;
+  for (;;) {
+    initCompiler(&compiler, TYPE_SCRIPT);
+    compiler.wideJumps = wideJumps;
 
-  parser.hadError = false;
-  parser.panicMode = false;
+    parser.hadError = false;
+    parser.panicMode = false;
+    initPeepholeStats(&peepholeStats);
 
-  advance();
+    advance();
 
-  while (!match(TOKEN_EOF)) {
-    declaration();
+    while (!match(TOKEN_EOF)) {
+      declaration();
+    }
+
+    if (!compileAgain())
+      break;
+    initScanner(source);
+    wideJumps = true;
   }
 
   ObjFunction *function = endCompiler();
+  if (compilerOptions.peephole && compilerOptions.peepholeReport &&
+      !parser.hadError) {
+    reportPeephole("total", &peepholeStats);
+  }
+  // every function is finished, nothing points into the arenas anymore.
+  freeArena(&scratchArena);
+  freeArena(&compilerArena);
   return parser.hadError ? NULL : function;
 }
 
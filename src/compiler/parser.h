@@ -20,6 +20,25 @@
 #include "common/ysobject.h"
 #include "vm/interp/interp.h"
 
+typedef struct {
+  // run the peephole optimizer over every finished chunk
+  bool peephole;
+  // print the before/after instruction counts of the peephole optimizer
+  bool peepholeReport;
+  // fold constant expressions and drop the dead arm of constant conditions
+  bool constantFolding;
+  // run the SSA IR passes over every finished function
+  bool ir;
+  // use the unchecked number operators where the IR proves the operands
+  bool typeInference;
+  // print the IR of every function after the passes
+  bool dumpIr;
+  // print the bytecode of every finished function, with ENABLE_COMPILE_TRACE
+  bool printCode;
+} CompilerOptions;
+
+extern CompilerOptions compilerOptions;
+
 ObjFunction *compile(const char *source);
 
 void markCompilerRoots();
@@ -0,0 +1,310 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "compiler/peephole.h"
+
+// bound the jump-to-jump chains we follow, cycles are legal bytecode
+#define MAX_THREAD_HOPS 8
+
+typedef struct {
+  // offset in the original code
+  int offset;
+  int length;
+  uint8_t op;
+  // index of the jump target, -1 for non-jump instructions
+  int target;
+  bool live;
+  // re-encoded jump operand
+  uint16_t operand;
+} Instr;
+
+static bool isJump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP;
+}
+
+void initPeepholeStats(PeepholeStats *stats) {
+  stats->instructionsBefore = 0;
+  stats->instructionsAfter = 0;
+  stats->bytesBefore = 0;
+  stats->bytesAfter = 0;
+}
+
+static int decode(Chunk *chunk, Instr *instrs, int *indexOf) {
+  int count = 0;
+  for (int offset = 0; offset <= chunk->count; offset++) {
+    indexOf[offset] = -1;
+  }
+  for (int offset = 0; offset < chunk->count;) {
+    Instr *instr = &instrs[count];
+    instr->offset = offset;
+    instr->length = instructionLength(chunk, offset);
+    instr->op = chunk->code[offset];
+    // wide jumps do not fit the encoding below, leave such chunks alone.
+    if (instr->op == OP_WIDE)
+      return -1;
+    instr->target = -1;
+    instr->live = true;
+    indexOf[offset] = count++;
+    offset += instr->length;
+  }
+  // the end of the code is a valid (sentinel) jump target
+  indexOf[chunk->count] = count;
+
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!isJump(instr->op))
+      continue;
+    uint16_t jump = (uint16_t)((chunk->code[instr->offset + 1] << 8) |
+                               chunk->code[instr->offset + 2]);
+    int target = instr->op == OP_LOOP ? instr->offset + 3 - jump
+                                      : instr->offset + 3 + jump;
+    // a jump into the middle of an instruction, leave the chunk alone.
+    if (indexOf[target] == -1)
+      return -1;
+    instr->target = indexOf[target];
+  }
+  return count;
+}
+
+// first live instruction at or after index
+static int resolve(Instr *instrs, int count, int index) {
+  while (index < count && !instrs[index].live)
+    index++;
+  return index;
+}
+
+static int nextLive(Instr *instrs, int count, int index) {
+  return resolve(instrs, count, index + 1);
+}
+
+static void countTargets(Instr *instrs, int count, int *targeted) {
+  for (int i = 0; i <= count; i++) {
+    targeted[i] = 0;
+  }
+  for (int i = 0; i < count; i++) {
+    if (instrs[i].live && instrs[i].target != -1) {
+      targeted[resolve(instrs, count, instrs[i].target)]++;
+    }
+  }
+}
+
+static bool fuseComparisons(Instr *instrs, int count, int *targeted) {
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!instr->live)
+      continue;
+
+    uint8_t fused;
+    switch (instr->op) {
+    case OP_EQUAL:
+      fused = OP_NOT_EQUAL;
+      break;
+    case OP_LESS:
+      fused = OP_GREATER_EQUAL;
+      break;
+    case OP_GREATER:
+      fused = OP_LESS_EQUAL;
+      break;
+    case OP_LESS_NUM:
+      fused = OP_GREATER_EQUAL_NUM;
+      break;
+    case OP_GREATER_NUM:
+      fused = OP_LESS_EQUAL_NUM;
+      break;
+    default:
+      continue;
+    }
+
+    int next = nextLive(instrs, count, i);
+    if (next < count && instrs[next].op == OP_NOT && targeted[next] == 0) {
+      instr->op = fused;
+      instrs[next].live = false;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static bool threadJumps(Instr *instrs, int count) {
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!instr->live || instr->target == -1)
+      continue;
+
+    int target = resolve(instrs, count, instr->target);
+    for (int hops = 0; hops < MAX_THREAD_HOPS && target < count; hops++) {
+      Instr *next = &instrs[target];
+      // a falsey value stays on the stack, so the next OP_JUMP_IF_FALSE
+      // takes its branch as well.
+      bool follow = next->op == OP_JUMP || next->op == OP_LOOP ||
+                    (instr->op == OP_JUMP_IF_FALSE &&
+                     next->op == OP_JUMP_IF_FALSE);
+      if (!follow)
+        break;
+
+      int hop = resolve(instrs, count, next->target);
+      if (hop == target)
+        break;
+      // OP_JUMP_IF_FALSE has no backward form.
+      if (instr->op == OP_JUMP_IF_FALSE && hop < count &&
+          instrs[hop].offset <= instr->offset)
+        break;
+      target = hop;
+    }
+
+    if (target != resolve(instrs, count, instr->target)) {
+      instr->target = target;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static bool removeUnreachable(Instr *instrs, int count, int *targeted) {
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!instr->live)
+      continue;
+    if (instr->op != OP_RETURN && instr->op != OP_JUMP && instr->op != OP_LOOP)
+      continue;
+
+    for (int j = i + 1; j < count && targeted[j] == 0; j++) {
+      if (instrs[j].live) {
+        instrs[j].live = false;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+static bool removeNopJumps(Instr *instrs, int count) {
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!instr->live || instr->op == OP_LOOP || instr->target == -1)
+      continue;
+
+    // OP_JUMP_IF_FALSE does not pop, jumping to the next one is a no-op too.
+    if (resolve(instrs, count, instr->target) == nextLive(instrs, count, i)) {
+      instr->live = false;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// compute the new jump operands, false if one of them does not fit anymore
+static bool encodeJumps(Instr *instrs, int count, int *newOffsets) {
+  int offset = 0;
+  for (int i = 0; i < count; i++) {
+    newOffsets[i] = offset;
+    if (instrs[i].live)
+      offset += instrs[i].length;
+  }
+  newOffsets[count] = offset;
+
+  for (int i = 0; i < count; i++) {
+    Instr *instr = &instrs[i];
+    if (!instr->live || instr->target == -1)
+      continue;
+
+    int from = newOffsets[i] + 3;
+    int to = newOffsets[resolve(instrs, count, instr->target)];
+    int jump;
+    if (to >= from) {
+      if (instr->op == OP_LOOP)
+        instr->op = OP_JUMP;
+      jump = to - from;
+    } else {
+      if (instr->op == OP_JUMP_IF_FALSE)
+        return false;
+      instr->op = OP_LOOP;
+      jump = from - to;
+    }
+    if (jump > UINT16_MAX)
+      return false;
+    instr->operand = (uint16_t)jump;
+  }
+  return true;
+}
+
+void optimizeChunk(Chunk *chunk, Arena *scratch, PeepholeStats *stats) {
+  if (chunk->count == 0)
+    return;
+
+  ArenaMark mark = arenaMark(scratch);
+  Instr *instrs = ARENA_ALLOCATE(scratch, Instr, chunk->count);
+  int *indexOf = ARENA_ALLOCATE(scratch, int, chunk->count + 1);
+  int count = decode(chunk, instrs, indexOf);
+  if (count == -1) {
+    arenaRelease(scratch, mark);
+    return;
+  }
+  // indexOf is no longer needed, reuse it for the jump target counts.
+  int *targeted = indexOf;
+
+  bool changed;
+  do {
+    changed = false;
+    countTargets(instrs, count, targeted);
+    changed |= fuseComparisons(instrs, count, targeted);
+    changed |= threadJumps(instrs, count);
+
+    countTargets(instrs, count, targeted);
+    changed |= removeUnreachable(instrs, count, targeted);
+    changed |= removeNopJumps(instrs, count);
+  } while (changed);
+
+  int liveCount = count;
+  int bytesBefore = chunk->count;
+  // newOffsets reuses the jump target counts as well.
+  int *newOffsets = targeted;
+  if (encodeJumps(instrs, count, newOffsets)) {
+    // every instruction moves towards the start, so compact in place.
+    for (int i = 0; i < count; i++) {
+      Instr *instr = &instrs[i];
+      if (!instr->live) {
+        liveCount--;
+        continue;
+      }
+      int to = newOffsets[i];
+      memmove(chunk->code + to, chunk->code + instr->offset, instr->length);
+      memmove(chunk->lines + to, chunk->lines + instr->offset,
+              sizeof(int) * instr->length);
+      chunk->code[to] = instr->op;
+      if (instr->target != -1) {
+        chunk->code[to + 1] = (instr->operand >> 8) & 0xff;
+        chunk->code[to + 2] = instr->operand & 0xff;
+      }
+    }
+    chunk->count = newOffsets[count];
+  }
+
+  if (stats != NULL) {
+    stats->instructionsBefore += count;
+    stats->instructionsAfter += liveCount;
+    stats->bytesBefore += bytesBefore;
+    stats->bytesAfter += chunk->count;
+  }
+
+  arenaRelease(scratch, mark);
+}
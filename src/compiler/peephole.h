@@ -0,0 +1,44 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_COMPILER_PEEPHOLE_H_
+#define YSCRIPT_COMPILER_PEEPHOLE_H_
+
+#include "common/chunk.h"
+
+typedef struct {
+  int instructionsBefore;
+  int instructionsAfter;
+  int bytesBefore;
+  int bytesAfter;
+} PeepholeStats;
+
+void initPeepholeStats(PeepholeStats *stats);
+
+/**
+ * rewrite a finished chunk in place:
+ *  - fuse `OP_EQUAL/OP_LESS/OP_GREATER; OP_NOT` into one comparison, the
+ *    unchecked number comparisons as well
+ *  - thread jumps whose target is another jump
+ *  - drop jumps to the next instruction
+ *  - drop unreachable code after OP_RETURN/OP_JUMP/OP_LOOP
+ * jump offsets are re-patched and chunk->lines stays aligned with the code.
+ * the counts of the chunk are added to stats (which may be NULL), the
+ * working tables are taken from the scratch arena and released again.
+ */
+void optimizeChunk(Chunk *chunk, Arena *scratch, PeepholeStats *stats);
+
+#endif // YSCRIPT_COMPILER_PEEPHOLE_H_
@@ -20,12 +20,6 @@
 #include "common/config.h"
 #include "compiler/scanner.h"
 
-typedef struct {
-  const char *start;
-  const char *current;
-  int line;
-} Scanner;
-
 Scanner scanner;
 
 void initScanner(const char *source) {
@@ -34,6 +28,10 @@ void initScanner(const char *source) {
   scanner.line = 1;
 }
 
+Scanner saveScanner() { return scanner; }
+
+void restoreScanner(Scanner state) { scanner = state; }
+
 static bool isAlpha(char c) {
   return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
@@ -47,7 +47,16 @@ typedef struct {
   int line;
 } Token;
 
+typedef struct {
+  const char* start;
+  const char* current;
+  int line;
+} Scanner;
+
 void initScanner(const char* source);
 Token scanToken();
+// where the scanner is, to scan the same tokens again later
+Scanner saveScanner();
+void restoreScanner(Scanner state);
 
 #endif // YSCRIPT_COMPILER_SCANNER_H_
@@ -14,157 +14,395 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 
 #include "common/ysobject.h"
 #include "common/ysvalue.h"
 #include "disassembler/disassembler.h"
+#include "stream/stream.h"
 
-void disassembleChunk(Chunk *chunk, const char *name) {
-  printf("== %s ==\n", name);
-  for (int offset = 0; offset < chunk->count;) {
-    offset = disassembleInstruction(chunk, offset);
-  }
+static const char *opcodeNames[] = {
+    "OP_CONSTANT",
+    "OP_NIL",
+    "OP_TRUE",
+    "OP_FALSE",
+    "OP_POP",
+    "OP_GET_LOCAL",
+    "OP_SET_LOCAL",
+    "OP_GET_GLOBAL",
+    "OP_DEFINE_GLOBAL",
+    "OP_SET_GLOBAL",
+    "OP_GET_UPVALUE",
+    "OP_SET_UPVALUE",
+    "OP_GET_PROPERTY",
+    "OP_SET_PROPERTY",
+    "OP_GET_SUPER",
+    "OP_EQUAL",
+    "OP_GREATER",
+    "OP_LESS",
+    "OP_NOT_EQUAL",
+    "OP_GREATER_EQUAL",
+    "OP_LESS_EQUAL",
+    "OP_ADD",
+    "OP_SUBTRACT",
+    "OP_MULTIPLY",
+    "OP_DIVIDE",
+    "OP_NOT",
+    "OP_NEGATE",
+    "OP_ADD_NUM",
+    "OP_SUBTRACT_NUM",
+    "OP_MULTIPLY_NUM",
+    "OP_DIVIDE_NUM",
+    "OP_GREATER_NUM",
+    "OP_LESS_NUM",
+    "OP_GREATER_EQUAL_NUM",
+    "OP_LESS_EQUAL_NUM",
+    "OP_NEGATE_NUM",
+    "OP_PRINT",
+    "OP_JUMP",
+    "OP_JUMP_IF_FALSE",
+    "OP_LOOP",
+    "OP_CALL",
+    "OP_INVOKE",
+    "OP_SUPER_INVOKE",
+    "OP_CLOSURE",
+    "OP_CLOSE_UPVALUE",
+    "OP_RETURN",
+    "OP_CLASS",
+    "OP_INHERIT",
+    "OP_METHOD",
+    "OP_WIDE",
+};
+
+const char *opcodeName(uint8_t op) {
+  if (op >= sizeof(opcodeNames) / sizeof(opcodeNames[0]))
+    return "OP_UNKNOWN";
+  return opcodeNames[op];
 }
 
-static int constantInstruction(const char *name, Chunk *chunk, int offset) {
+static int constantInstruction(base::Stream &out, const char *name,
+                               Chunk *chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
-  printf("%-16s %4d '", name, constant);
-  printValue(chunk->constants.values[constant]);
-  printf("'\n");
+  out.Writef("%-16s %4d '", name, constant);
+  writeValue(out, chunk->constants.values[constant]);
+  out.Writef("'\n");
   return offset + 2;
 }
 
-static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
+static int invokeInstruction(base::Stream &out, const char *name,
+                             Chunk *chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t argCount = chunk->code[offset + 2];
-  printf("%-16s (%d args) %4d '", name, argCount, constant);
-  printValue(chunk->constants.values[constant]);
-  printf("'\n");
+  out.Writef("%-16s (%d args) %4d '", name, argCount, constant);
+  writeValue(out, chunk->constants.values[constant]);
+  out.Writef("'\n");
   return offset + 3;
 }
 
-static int simpleInstruction(const char *name, int offset) {
-  printf("%s\n", name);
+static int simpleInstruction(base::Stream &out, const char *name,
+                             int offset) {
+  out.Writef("%s\n", name);
   return offset + 1;
 }
 
-static int byteInstruction(const char *name, Chunk *chunk, int offset) {
+static int byteInstruction(base::Stream &out, const char *name, Chunk *chunk,
+                           int offset) {
   uint8_t slot = chunk->code[offset + 1];
-  printf("%-16s %4d\n", name, slot);
+  out.Writef("%-16s %4d\n", name, slot);
   return offset + 2; // [debug]
 }
 
-static int jumpInstruction(const char *name, int sign, Chunk *chunk,
-                           int offset) {
+static int jumpInstruction(base::Stream &out, const char *name, int sign,
+                           Chunk *chunk, int offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
   jump |= chunk->code[offset + 2];
-  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+  out.Writef("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
   return offset + 3;
 }
 
-int disassembleInstruction(Chunk *chunk, int offset) {
-  printf("%04d ", offset);
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
-    printf("   | ");
-  } else {
-    printf("%4d ", chunk->lines[offset]);
+static int wideInstruction(base::Stream &out, Chunk *chunk, int offset) {
+  uint8_t instruction = chunk->code[offset + 1];
+  uint8_t *operands = chunk->code + offset + 2;
+  int index = (operands[0] << 8) | operands[1];
+  char name[32];
+  snprintf(name, sizeof(name), "%s_W", opcodeName(instruction));
+
+  switch (instruction) {
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+    out.Writef("%-16s %4d\n", name, index);
+    return offset + 4;
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP: {
+    uint32_t jump = ((uint32_t)operands[0] << 24) | (operands[1] << 16) |
+                    (operands[2] << 8) | operands[3];
+    int sign = instruction == OP_LOOP ? -1 : 1;
+    out.Writef("%-16s %4d -> %d\n", name, offset,
+           offset + 6 + sign * (int)jump);
+    return offset + 6;
   }
+  case OP_INVOKE:
+  case OP_SUPER_INVOKE:
+    out.Writef("%-16s (%d args) %4d '", name, operands[2], index);
+    writeValue(out, chunk->constants.values[index]);
+    out.Writef("'\n");
+    return offset + 5;
+  case OP_CLOSURE: {
+    out.Writef("%-16s %4d ", name, index);
+    writeValue(out, chunk->constants.values[index]);
+    out.Writef("\n");
 
+    ObjFunction *function = AS_FUNCTION(chunk->constants.values[index]);
+    offset += 4;
+    for (int j = 0; j < function->upvalueCount; j++) {
+      int isLocal = chunk->code[offset];
+      int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+      out.Writef("%04d      |                     %s %d\n", offset,
+             isLocal ? "local" : "upvalue", slot);
+      offset += 3;
+    }
+    return offset;
+  }
+  default:
+    out.Writef("%-16s %4d '", name, index);
+    writeValue(out, chunk->constants.values[index]);
+    out.Writef("'\n");
+    return offset + 4;
+  }
+}
+
+// the instruction at offset without the offset and line columns
+static int writeInstruction(base::Stream &out, Chunk *chunk, int offset) {
   uint8_t instruction = chunk->code[offset];
   switch (instruction) {
 
   case OP_CONSTANT:
-    return constantInstruction("OP_CONSTANT", chunk, offset);
+    return constantInstruction(out, "OP_CONSTANT", chunk, offset);
   case OP_NIL:
-    return simpleInstruction("OP_NIL", offset);
+    return simpleInstruction(out, "OP_NIL", offset);
   case OP_TRUE:
-    return simpleInstruction("OP_TRUE", offset);
+    return simpleInstruction(out, "OP_TRUE", offset);
   case OP_FALSE:
-    return simpleInstruction("OP_FALSE", offset);
+    return simpleInstruction(out, "OP_FALSE", offset);
   case OP_POP:
-    return simpleInstruction("OP_POP", offset);
+    return simpleInstruction(out, "OP_POP", offset);
   case OP_GET_LOCAL:
-    return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    return byteInstruction(out, "OP_GET_LOCAL", chunk, offset);
   case OP_SET_LOCAL:
-    return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    return byteInstruction(out, "OP_SET_LOCAL", chunk, offset);
   case OP_GET_GLOBAL:
-    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_GET_GLOBAL", chunk, offset);
   case OP_DEFINE_GLOBAL:
-    return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_DEFINE_GLOBAL", chunk, offset);
   case OP_SET_GLOBAL:
-    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+    return constantInstruction(out, "OP_SET_GLOBAL", chunk, offset);
   case OP_GET_UPVALUE:
-    return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+    return byteInstruction(out, "OP_GET_UPVALUE", chunk, offset);
   case OP_SET_UPVALUE:
-    return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+    return byteInstruction(out, "OP_SET_UPVALUE", chunk, offset);
   case OP_GET_PROPERTY:
-    return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+    return constantInstruction(out, "OP_GET_PROPERTY", chunk, offset);
   case OP_SET_PROPERTY:
-    return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+    return constantInstruction(out, "OP_SET_PROPERTY", chunk, offset);
   case OP_GET_SUPER:
-    return constantInstruction("OP_GET_SUPER", chunk, offset);
+    return constantInstruction(out, "OP_GET_SUPER", chunk, offset);
   case OP_EQUAL:
-    return simpleInstruction("OP_EQUAL", offset);
+    return simpleInstruction(out, "OP_EQUAL", offset);
   case OP_GREATER:
-    return simpleInstruction("OP_GREATER", offset);
+    return simpleInstruction(out, "OP_GREATER", offset);
   case OP_LESS:
-    return simpleInstruction("OP_LESS", offset);
+    return simpleInstruction(out, "OP_LESS", offset);
+  case OP_NOT_EQUAL:
+    return simpleInstruction(out, "OP_NOT_EQUAL", offset);
+  case OP_GREATER_EQUAL:
+    return simpleInstruction(out, "OP_GREATER_EQUAL", offset);
+  case OP_LESS_EQUAL:
+    return simpleInstruction(out, "OP_LESS_EQUAL", offset);
   case OP_ADD:
-    return simpleInstruction("OP_ADD", offset);
+    return simpleInstruction(out, "OP_ADD", offset);
   case OP_SUBTRACT:
-    return simpleInstruction("OP_SUBTRACT", offset);
+    return simpleInstruction(out, "OP_SUBTRACT", offset);
   case OP_MULTIPLY:
-    return simpleInstruction("OP_MULTIPLY", offset);
+    return simpleInstruction(out, "OP_MULTIPLY", offset);
   case OP_DIVIDE:
-    return simpleInstruction("OP_DIVIDE", offset);
+    return simpleInstruction(out, "OP_DIVIDE", offset);
   case OP_NOT:
-    return simpleInstruction("OP_NOT", offset);
+    return simpleInstruction(out, "OP_NOT", offset);
   case OP_NEGATE:
-    return simpleInstruction("OP_NEGATE", offset);
+    return simpleInstruction(out, "OP_NEGATE", offset);
+  case OP_ADD_NUM:
+    return simpleInstruction(out, "OP_ADD_NUM", offset);
+  case OP_SUBTRACT_NUM:
+    return simpleInstruction(out, "OP_SUBTRACT_NUM", offset);
+  case OP_MULTIPLY_NUM:
+    return simpleInstruction(out, "OP_MULTIPLY_NUM", offset);
+  case OP_DIVIDE_NUM:
+    return simpleInstruction(out, "OP_DIVIDE_NUM", offset);
+  case OP_GREATER_NUM:
+    return simpleInstruction(out, "OP_GREATER_NUM", offset);
+  case OP_LESS_NUM:
+    return simpleInstruction(out, "OP_LESS_NUM", offset);
+  case OP_GREATER_EQUAL_NUM:
+    return simpleInstruction(out, "OP_GREATER_EQUAL_NUM", offset);
+  case OP_LESS_EQUAL_NUM:
+    return simpleInstruction(out, "OP_LESS_EQUAL_NUM", offset);
+  case OP_NEGATE_NUM:
+    return simpleInstruction(out, "OP_NEGATE_NUM", offset);
   case OP_PRINT:
-    return simpleInstruction("OP_PRINT", offset);
+    return simpleInstruction(out, "OP_PRINT", offset);
   case OP_JUMP:
-    return jumpInstruction("OP_JUMP", 1, chunk, offset);
+    return jumpInstruction(out, "OP_JUMP", 1, chunk, offset);
   case OP_JUMP_IF_FALSE:
-    return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    return jumpInstruction(out, "OP_JUMP_IF_FALSE", 1, chunk, offset);
   case OP_LOOP:
-    return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    return jumpInstruction(out, "OP_LOOP", -1, chunk, offset);
   case OP_CALL:
-    return byteInstruction("OP_CALL", chunk, offset);
+    return byteInstruction(out, "OP_CALL", chunk, offset);
   case OP_INVOKE:
-    return invokeInstruction("OP_INVOKE", chunk, offset);
+    return invokeInstruction(out, "OP_INVOKE", chunk, offset);
   case OP_SUPER_INVOKE:
-    return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
+    return invokeInstruction(out, "OP_SUPER_INVOKE", chunk, offset);
   case OP_CLOSURE: {
     offset++;
     uint8_t constant = chunk->code[offset++];
-    printf("%-16s %4d ", "OP_CLOSURE", constant);
-    printValue(chunk->constants.values[constant]);
-    printf("\n");
+    out.Writef("%-16s %4d ", "OP_CLOSURE", constant);
+    writeValue(out, chunk->constants.values[constant]);
+    out.Writef("\n");
 
     ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
     for (int j = 0; j < function->upvalueCount; j++) {
       int isLocal = chunk->code[offset++];
       int index = chunk->code[offset++];
-      printf("%04d      |                     %s %d\n", offset - 2,
+      out.Writef("%04d      |                     %s %d\n", offset - 2,
              isLocal ? "local" : "upvalue", index);
     }
     return offset;
   }
 
   case OP_CLOSE_UPVALUE:
-    return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+    return simpleInstruction(out, "OP_CLOSE_UPVALUE", offset);
   case OP_RETURN:
-    return simpleInstruction("OP_RETURN", offset);
+    return simpleInstruction(out, "OP_RETURN", offset);
   case OP_CLASS:
-    return constantInstruction("OP_CLASS", chunk, offset);
+    return constantInstruction(out, "OP_CLASS", chunk, offset);
   case OP_INHERIT:
-    return simpleInstruction("OP_INHERIT", offset);
+    return simpleInstruction(out, "OP_INHERIT", offset);
   case OP_METHOD:
-    return constantInstruction("OP_METHOD", chunk, offset);
+    return constantInstruction(out, "OP_METHOD", chunk, offset);
+  case OP_WIDE:
+    return wideInstruction(out, chunk, offset);
   default:
-    printf("Unknown opcode %d\n", instruction);
+    out.Writef("Unknown opcode %d\n", instruction);
     return offset + 1;
   }
 }
+
+void disassembleChunk(base::Stream &out, Chunk *chunk, const char *name) {
+  out.Writef("== %s ==\n", name);
+  for (int offset = 0; offset < chunk->count;) {
+    offset = disassembleInstruction(out, chunk, offset);
+  }
+}
+
+int disassembleInstruction(base::Stream &out, Chunk *chunk, int offset) {
+  out.Writef("%04d ", offset);
+  int line = getLine(chunk, offset);
+  if (offset > 0 && line == getLine(chunk, offset - 1)) {
+    out.Writef("   | ");
+  } else {
+    out.Writef("%4d ", line);
+  }
+  return writeInstruction(out, chunk, offset);
+}
+
+void disassembleChunk(Chunk *chunk, const char *name) {
+  disassembleChunk(stdoutStream(), chunk, name);
+}
+
+int disassembleInstruction(Chunk *chunk, int offset) {
+  return disassembleInstruction(stdoutStream(), chunk, offset);
+}
+
+// the listing of every instruction is prefixed by the percent of the chunk's
+// hits it got and its own count, like perf annotate does
+static void writeHits(base::Stream &out, uint64_t count, uint64_t total) {
+  if (count == 0) {
+    out.Writef("%21s : ", "");
+    return;
+  }
+  out.Writef("%7.2f%% %12" PRIu64 " : ", 100.0 * (double)count / (double)total,
+             count);
+}
+
+void annotateChunk(base::Stream &out, Chunk *chunk, const uint64_t *hits) {
+  uint64_t total = 0;
+  for (int offset = 0; offset < chunk->count; offset++) {
+    total += hits[offset];
+  }
+  out.Writef("%8s %12s : %s\n", "percent", "count", "instruction");
+
+  for (int offset = 0; offset < chunk->count;) {
+    // closures list their upvalues on lines of their own, those get no
+    // counts.
+    base::MemoryStream text;
+    int next = disassembleInstruction(text, chunk, offset);
+    const std::vector<uint8_t> &data = text.output_buffer().data;
+    uint64_t count = hits[offset];
+    for (size_t start = 0; start < data.size();) {
+      size_t end = start;
+      while (end < data.size() && data[end] != '\n')
+        end++;
+      writeHits(out, count, total);
+      out.WriteData(&data[start], end - start);
+      out.WriteChar('\n');
+      count = 0;
+      start = end + 1;
+    }
+    offset = next;
+  }
+}
+
+static void writeJsonString(base::Stream &out, const uint8_t *chars,
+                            size_t length) {
+  out.WriteChar('"');
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = chars[i];
+    if (c == '"' || c == '\\') {
+      out.WriteChar('\\');
+      out.WriteChar(c);
+    } else if (c == '\n') {
+      out.Writef("\\n");
+    } else if (c < 0x20) {
+      out.Writef("\\u%04x", c);
+    } else {
+      out.WriteChar(c);
+    }
+  }
+  out.WriteChar('"');
+}
+
+void annotateChunkJson(base::Stream &out, Chunk *chunk, const uint64_t *hits,
+                       const char *indent) {
+  for (int offset = 0; offset < chunk->count;) {
+    base::MemoryStream text;
+    int next = writeInstruction(text, chunk, offset);
+    const std::vector<uint8_t> &data = text.output_buffer().data;
+    // leave out the newline every listing ends with.
+    size_t length = data.empty() ? 0 : data.size() - 1;
+    uint8_t op = chunk->code[offset];
+    if (op == OP_WIDE)
+      op = chunk->code[offset + 1];
+
+    out.Writef("%s\n%s{\"offset\": %d, \"line\": %d, \"count\": %" PRIu64
+               ", \"opcode\": \"%s\", \"text\": ",
+               offset > 0 ? "," : "", indent, offset, getLine(chunk, offset),
+               hits[offset], opcodeName(op));
+    writeJsonString(out, data.data(), length);
+    out.Writef("}");
+    offset = next;
+  }
+}
@@ -19,7 +19,20 @@
 
 #include "common/chunk.h"
 
+// the listings are written to stdoutStream() unless out is given
 void disassembleChunk(Chunk *chunk, const char *name);
 int disassembleInstruction(Chunk *chunk, int offset);
+void disassembleChunk(base::Stream &out, Chunk *chunk, const char *name);
+int disassembleInstruction(base::Stream &out, Chunk *chunk, int offset);
+const char *opcodeName(uint8_t op);
+
+/**
+ * the listing of chunk with the execution count of every instruction, hits
+ * holds one count per code offset. the JSON form writes the elements of an
+ * array, one instruction per line starting with indent.
+ */
+void annotateChunk(base::Stream &out, Chunk *chunk, const uint64_t *hits);
+void annotateChunkJson(base::Stream &out, Chunk *chunk, const uint64_t *hits,
+                       const char *indent);
 
 #endif // YSCRIPT_DISASSEMBLER_DISASSEMBLER_H_
@@ -0,0 +1,236 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "common/gcstats.h"
+#include "vm/interp/allocsites.h"
+#include "vm/interp/interp.h"
+
+// the sites never move once made, the sweeper thread counts their dead
+// objects while the mutator adds more
+#define SITE_CHUNK 256
+#define SITE_CHUNKS ((ALLOC_SITES_MAX + 1) / SITE_CHUNK)
+#define TABLE_MAX_LOAD 0.75
+
+typedef struct {
+  // "name:line" with the line of the declaration, like the profiler
+  char *label;
+  // the line allocating
+  int line;
+  ObjType type;
+  uint32_t hash;
+  uint64_t samples;
+  uint64_t bytes;
+  // the samples not freed yet, see releaseSample()
+  uint64_t live;
+} AllocSite;
+
+AllocSampler allocSampler;
+
+static AllocSite *siteChunks[SITE_CHUNKS];
+// site 0 stands for no site
+static int siteCount = 1;
+// the index of every site by label, line and type, open addressing
+static uint16_t *siteTable = NULL;
+static int siteTableCapacity = 0;
+static uint64_t sampleCount = 0;
+// samples of new sites once there is no room for them
+static uint64_t dropped = 0;
+
+static AllocSite *siteAt(int index) {
+  return &siteChunks[index / SITE_CHUNK][index % SITE_CHUNK];
+}
+
+void startAllocSampler(size_t interval) {
+  allocSampler.enabled = true;
+  allocSampler.interval = interval < 1 ? 1 : (int64_t)interval;
+  allocSampler.countdown = allocSampler.interval;
+}
+
+void freeAllocSites() {
+  for (int i = 1; i < siteCount; i++) {
+    free(siteAt(i)->label);
+  }
+  for (int i = 0; i < SITE_CHUNKS; i++) {
+    free(siteChunks[i]);
+    siteChunks[i] = NULL;
+  }
+  free(siteTable);
+  siteTable = NULL;
+  siteTableCapacity = 0;
+  siteCount = 1;
+  sampleCount = 0;
+  dropped = 0;
+  allocSampler.enabled = false;
+}
+
+static uint32_t hashSite(const char *label, int line, ObjType type) {
+  uint32_t hash = 2166136261u;
+  for (const char *c = label; *c != '\0'; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= 16777619;
+  }
+  hash ^= (uint32_t)line * 31 + (uint32_t)type;
+  hash *= 16777619;
+  return hash;
+}
+
+static int findSlot(uint16_t *table, int capacity, uint32_t hash,
+                    const char *label, int line, ObjType type) {
+  int index = (int)(hash & (uint32_t)(capacity - 1));
+  for (;;) {
+    if (table[index] == 0)
+      return index;
+    AllocSite *site = siteAt(table[index]);
+    if (site->hash == hash && site->line == line && site->type == type &&
+        strcmp(site->label, label) == 0)
+      return index;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growSiteTable() {
+  int capacity = siteTableCapacity < 64 ? 64 : siteTableCapacity * 2;
+  uint16_t *table = (uint16_t *)calloc(capacity, sizeof(uint16_t));
+  if (table == NULL)
+    exit(1);
+  for (int i = 1; i < siteCount; i++) {
+    AllocSite *site = siteAt(i);
+    table[findSlot(table, capacity, site->hash, site->label, site->line,
+                   site->type)] = (uint16_t)i;
+  }
+  free(siteTable);
+  siteTable = table;
+  siteTableCapacity = capacity;
+}
+
+static int findSite(const char *label, int line, ObjType type) {
+  if (siteCount > siteTableCapacity * TABLE_MAX_LOAD)
+    growSiteTable();
+  uint32_t hash = hashSite(label, line, type);
+  int slot = findSlot(siteTable, siteTableCapacity, hash, label, line, type);
+  if (siteTable[slot] != 0)
+    return siteTable[slot];
+  if (siteCount > ALLOC_SITES_MAX)
+    return 0;
+
+  int index = siteCount++;
+  if (siteChunks[index / SITE_CHUNK] == NULL) {
+    siteChunks[index / SITE_CHUNK] =
+        (AllocSite *)calloc(SITE_CHUNK, sizeof(AllocSite));
+    if (siteChunks[index / SITE_CHUNK] == NULL)
+      exit(1);
+  }
+  AllocSite *site = siteAt(index);
+  site->label = strdup(label);
+  if (site->label == NULL)
+    exit(1);
+  site->line = line;
+  site->type = type;
+  site->hash = hash;
+  siteTable[slot] = (uint16_t)index;
+  return index;
+}
+
+void sampleAllocation(Obj *object) {
+  // the sample stands for every interval the allocation went past
+  int64_t intervals = 1 + -allocSampler.countdown / allocSampler.interval;
+  allocSampler.countdown += intervals * allocSampler.interval;
+
+  char label[256];
+  int line = 0;
+  if (vm.frameCount == 0) {
+    snprintf(label, sizeof(label), "(vm)");
+  } else {
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    ObjFunction *function = frame->closure->function;
+    if (function->name == NULL) {
+      snprintf(label, sizeof(label), "script");
+    } else {
+      snprintf(label, sizeof(label), "%s:%d", function->name->chars,
+               function->line);
+    }
+    // ip is past the instruction running, or at the start of a new frame
+    int offset = (int)(frame->ip - function->chunk.code) - 1;
+    if (offset < 0)
+      offset = 0;
+    if (offset < function->chunk.count)
+      line = getLine(&function->chunk, offset);
+  }
+
+  sampleCount++;
+  int index = findSite(label, line, object->type);
+  if (index == 0) {
+    dropped++;
+    return;
+  }
+  AllocSite *site = siteAt(index);
+  site->samples++;
+  site->bytes += (uint64_t)(intervals * allocSampler.interval);
+  __atomic_fetch_add(&site->live, 1, __ATOMIC_RELAXED);
+  object->site = (uint16_t)index;
+}
+
+void releaseSample(Obj *object) {
+  __atomic_fetch_sub(&siteAt(object->site)->live, 1, __ATOMIC_RELAXED);
+}
+
+static int compareSites(const void *a, const void *b) {
+  const AllocSite *siteA = *(const AllocSite **)a;
+  const AllocSite *siteB = *(const AllocSite **)b;
+  if (siteA->bytes != siteB->bytes)
+    return siteA->bytes < siteB->bytes ? 1 : -1;
+  int order = strcmp(siteA->label, siteB->label);
+  if (order != 0)
+    return order;
+  if (siteA->line != siteB->line)
+    return siteA->line - siteB->line;
+  return (int)siteA->type - (int)siteB->type;
+}
+
+void printAllocSites(FILE *file) {
+  AllocSite **sorted =
+      (AllocSite **)malloc(sizeof(AllocSite *) * (size_t)siteCount);
+  if (sorted == NULL)
+    exit(1);
+  int count = 0;
+  for (int i = 1; i < siteCount; i++) {
+    sorted[count++] = siteAt(i);
+  }
+  qsort(sorted, count, sizeof(AllocSite *), compareSites);
+
+  fprintf(file,
+          "== allocation sites: %" PRIu64 " samples, one every %" PRId64
+          " bytes, %" PRIu64 " dropped ==\n",
+          sampleCount, allocSampler.interval, dropped);
+  fprintf(file, "%12s %12s %10s %10s  %-14s %s\n", "bytes", "live bytes",
+          "samples", "live", "type", "site");
+  for (int i = 0; i < count; i++) {
+    AllocSite *site = sorted[i];
+    uint64_t live = __atomic_load_n(&site->live, __ATOMIC_RELAXED);
+    // the objects of a site have one type and one size
+    uint64_t liveBytes =
+        (uint64_t)((double)site->bytes * (double)live / (double)site->samples);
+    fprintf(file,
+            "%12" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64
+            "  %-14s %s line %d\n",
+            site->bytes, liveBytes, site->samples, live,
+            objTypeName(site->type), site->label, site->line);
+  }
+  free(sorted);
+}
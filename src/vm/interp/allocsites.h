@@ -0,0 +1,58 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_VM_INTERP_ALLOCSITES_H_
+#define YSCRIPT_VM_INTERP_ALLOCSITES_H_
+
+#include <stdio.h>
+
+#include "common/ysobject.h"
+
+/**
+ * allocation site profiler. allocateObject() samples an object about every
+ * interval bytes and counts it for the function and line running then and
+ * its type, the object keeps the index of its site in obj->site. the
+ * collector calls releaseSample() when a sampled object dies, that may be
+ * on a thread of its own.
+ *
+ * a sample stands for the interval bytes before it, the bytes of a site
+ * are an estimate that gets exact with an interval of 1.
+ */
+
+#define ALLOC_SAMPLE_DEFAULT 512
+// obj->site is a uint16_t, 0 for the objects not sampled
+#define ALLOC_SITES_MAX UINT16_MAX
+
+typedef struct {
+  bool enabled;
+  int64_t interval;
+  // bytes left until the next sample
+  int64_t countdown;
+} AllocSampler;
+
+extern AllocSampler allocSampler;
+
+void startAllocSampler(size_t interval);
+void freeAllocSites();
+
+// allocSampler.countdown ran out, object is the one allocated last
+void sampleAllocation(Obj *object);
+void releaseSample(Obj *object);
+
+// one line per site and type, the most bytes first
+void printAllocSites(FILE *file);
+
+#endif // YSCRIPT_VM_INTERP_ALLOCSITES_H_
@@ -14,17 +14,22 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #include "common/config.h"
+#include "common/gcstats.h"
 #include "common/memory.h"
+#include "common/barrier.h"
+#include "common/nursery.h"
 #include "common/ysobject.h"
 #include "compiler/parser.h"
-#include "disassembler/disassembler.h"
 #include "vm/interp/interp.h"
+#include "vm/interp/stats.h"
+#include "vm/interp/tracer.h"
 
 VM vm; // [one]
 
@@ -32,6 +37,13 @@ static Value clockNative(int argCount, Value *args) {
   return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+// collect now, returns the bytes still allocated
+static Value gcNative(int argCount, Value *args) {
+  collectGarbage();
+  finishSweep();
+  return NUMBER_VAL((double)vm.bytesAllocated);
+}
+
 static void resetStack() {
   vm.stackTop = vm.stack;
   vm.frameCount = 0;
@@ -52,7 +64,7 @@ static void runtimeError(const char *format, ...) {
 
     size_t instruction = frame->ip - function->chunk.code - 1;
     fprintf(stderr, "[line %d] in ", // [minus]
-            function->chunk.lines[instruction]);
+            getLine(&function->chunk, (int)instruction));
     if (function->name == NULL) {
       fprintf(stderr, "script\n");
     } else {
@@ -74,13 +86,24 @@ static void defineNative(const char *name, NativeFn function) {
 void initVM() {
   resetStack();
 
-  vm.objects = NULL;
   vm.bytesAllocated = 0;
-
-  vm.nextGC = 1024 * 1024;
+  vm.bytesAllocatedTotal = 0;
+  vm.allocationCount = 0;
+  initVMStats();
+  initGCStats();
+
+  vm.nextGC = initialHeapThreshold();
+  vm.outOfMemory = false;
+  vm.safepointRequested = false;
+  initNursery(gcPolicy.nurserySize);
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
+  vm.gcPhase = GC_IDLE;
+  vm.markerRunning = false;
+  vm.sliceRequested = false;
+  vm.sliceBytes = 0;
+  vm.compactionRequested = false;
 
   initTable(&vm.globals);
   initTable(&vm.strings);
@@ -88,6 +111,7 @@ void initVM() {
   vm.initString = copyString("init", 4);
 
   defineNative("clock", clockNative);
+  defineNative("gc", gcNative);
 }
 
 void freeVM() {
@@ -97,6 +121,8 @@ void freeVM() {
   vm.initString = NULL;
 
   freeObjects();
+  freeNursery();
+  freeVMStats();
 }
 
 void push(Value value) {
@@ -119,15 +145,21 @@ static bool call(ObjClosure *closure, int argCount) {
     return false;
   }
 
-  if (vm.frameCount == FRAMES_MAX) {
+  // a function may have more than UINT8_COUNT locals with wide operands.
+  if (vm.frameCount == FRAMES_MAX ||
+      vm.stackTop + closure->function->localCount + UINT8_COUNT >
+          vm.stack + STACK_MAX) {
     runtimeError("Stack overflow.");
     return false;
   }
 
-  CallFrame *frame = &vm.frames[vm.frameCount++];
+  CallFrame *frame = &vm.frames[vm.frameCount];
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
   frame->slots = vm.stackTop - argCount - 1;
+  // the profiler may sample any frame below frameCount from its handler.
+  std::atomic_signal_fence(std::memory_order_release);
+  vm.frameCount++;
   return true;
 }
 
@@ -238,8 +270,11 @@ static ObjUpvalue *captureUpvalue(Value *local) {
 static void closeUpvalues(Value *last) {
   while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
     ObjUpvalue *upvalue = vm.openUpvalues;
+    writeBarrier((Obj *)upvalue, *upvalue->location);
+    beginHeapWrite();
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    endHeapWrite();
     vm.openUpvalues = upvalue->next;
   }
 }
@@ -247,10 +282,37 @@ static void closeUpvalues(Value *last) {
 static void defineMethod(ObjString *name) {
   Value method = peek(0);
   ObjClass *klass = AS_CLASS(peek(1));
+  writeBarrier((Obj *)klass, OBJ_VAL(name));
+  writeBarrier((Obj *)klass, method);
+  beginHeapWrite();
+  overwriteEntryBarrier(&klass->methods, name);
   tableSet(&klass->methods, name, method);
+  endHeapWrite();
   pop();
 }
 
+/**
+ * the back edges, calls and returns, every unbounded allocation passes one
+ * of them. the allocations leave three things for here: a minor collection,
+ * it moves objects so no C code may hold one across it, a slice of an
+ * incremental collection, it must not see an object half built, and the
+ * "Out of memory." error of a heap over gcPolicy.heapLimit, raised with the
+ * stack still intact for the trace. the VM stays usable for the next
+ * interpret(). false if the script has to stop.
+ */
+static bool safepoint() {
+  if (!vm.safepointRequested)
+    return true;
+  vm.safepointRequested = false;
+  collectRequested();
+  if (vm.outOfMemory) {
+    vm.outOfMemory = false;
+    runtimeError("Out of memory.");
+    return false;
+  }
+  return true;
+}
+
 static bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
@@ -273,15 +335,58 @@ static void concatenate() {
   push(OBJ_VAL(result));
 }
 
-static InterpretResult run() {
+// --stats and --trace look at every instruction before it runs
+static void instrument(CallFrame *frame, uint8_t instruction) {
+  ObjFunction *function = frame->closure->function;
+  uint32_t offset = (uint32_t)(frame->ip - function->chunk.code - 1);
+  if (vmStats.enabled) {
+    if (function->statsIndex == -1 ||
+        function->statsIndex != vmStats.current)
+      switchFunctionStats(function);
+    FunctionStats *stats = &vmStats.functions[vmStats.current];
+    stats->instructions++;
+    stats->hits[offset]++;
+    vmStats.opcodes[instruction]++;
+  }
+  if (tracer.enabled) {
+    traceInstruction(function, offset, instruction, vm.frameCount,
+                     (int)(vm.stackTop - vm.stack));
+  }
+}
+
+static void countCall(ObjFunction *function) {
+  if (vmStats.enabled)
+    functionStats(function)->calls++;
+}
+
+/**
+ * kInstrumented selects the copy of the loop for --stats and --trace, the
+ * code under if (kInstrumented) is not even compiled into the plain one.
+ */
+template <bool kInstrumented> static InterpretResult run() {
   CallFrame *frame = &vm.frames[vm.frameCount - 1];
+  if (kInstrumented)
+    countCall(frame->closure->function);
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT()                                                           \
   (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT()                                                        \
-  (frame->closure->function->chunk.constants.values[READ_BYTE()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_WORD()                                                            \
+  (frame->ip += 4,                                                             \
+   (uint32_t)((frame->ip[-4] << 24) | (frame->ip[-3] << 16) |                  \
+              (frame->ip[-2] << 8) | frame->ip[-1]))
+#define CONSTANT_AT(index)                                                     \
+  (frame->closure->function->chunk.constants.values[index])
+#define STRING_AT(index) AS_STRING(CONSTANT_AT(index))
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+// reload the frame after a call, which pushed one unless it called a native
+#define ENTER_FRAME()                                                          \
+  do {                                                                         \
+    CallFrame *caller = frame;                                                 \
+    frame = &vm.frames[vm.frameCount - 1];                                     \
+    if (kInstrumented && frame != caller)                                      \
+      countCall(frame->closure->function);                                     \
+  } while (false)
 #define BINARY_OP(valueType, op)                                               \
   do {                                                                         \
     if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
@@ -292,28 +397,28 @@ static InterpretResult run() {
     double a = AS_NUMBER(pop());                                               \
     push(valueType(a op b));                                                   \
   } while (false)
+// the compiler proved both operands are numbers, skip the checks
+#define NUMBER_OP(valueType, op)                                               \
+  do {                                                                         \
+    double b = AS_NUMBER(pop());                                               \
+    double a = AS_NUMBER(pop());                                               \
+    push(valueType(a op b));                                                   \
+  } while (false)
 
   for (;;) {
-#ifdef ENABLE_INTERP_TRACE
-    printf("          ");
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
-    }
-    printf("\n");
-    disassembleInstruction(
-        &frame->closure->function->chunk,
-        (int)(frame->ip - frame->closure->function->chunk.code));
-#endif
-
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-    case OP_CONSTANT: {
-      Value constant = READ_CONSTANT();
-      push(constant);
+    uint8_t instruction = READ_BYTE();
+    if (kInstrumented)
+      instrument(frame, instruction);
+    // the operand of an instruction OP_WIDE may prefix, the compact forms
+    // read it into here as well and share the code after the label
+    uint32_t operand;
+    bool wide;
+    switch (instruction) {
+    case OP_CONSTANT:
+      operand = READ_BYTE();
+    constantOp:
+      push(CONSTANT_AT(operand));
       break;
-    }
 
     case OP_NIL:
       push(NIL_VAL);
@@ -329,20 +434,22 @@ static InterpretResult run() {
       pop();
       break;
 
-    case OP_GET_LOCAL: {
-      uint8_t slot = READ_BYTE();
-      push(frame->slots[slot]);
+    case OP_GET_LOCAL:
+      operand = READ_BYTE();
+    getLocalOp:
+      push(frame->slots[operand]);
       break;
-    }
 
-    case OP_SET_LOCAL: {
-      uint8_t slot = READ_BYTE();
-      frame->slots[slot] = peek(0);
+    case OP_SET_LOCAL:
+      operand = READ_BYTE();
+    setLocalOp:
+      frame->slots[operand] = peek(0);
       break;
-    }
 
-    case OP_GET_GLOBAL: {
-      ObjString *name = READ_STRING();
+    case OP_GET_GLOBAL:
+      operand = READ_BYTE();
+    getGlobalOp: {
+      ObjString *name = STRING_AT(operand);
       Value value;
       if (!tableGet(&vm.globals, name, &value)) {
         runtimeError("Undefined variable '%s'.", name->chars);
@@ -352,15 +459,19 @@ static InterpretResult run() {
       break;
     }
 
-    case OP_DEFINE_GLOBAL: {
-      ObjString *name = READ_STRING();
+    case OP_DEFINE_GLOBAL:
+      operand = READ_BYTE();
+    defineGlobalOp: {
+      ObjString *name = STRING_AT(operand);
       tableSet(&vm.globals, name, peek(0));
       pop();
       break;
     }
 
-    case OP_SET_GLOBAL: {
-      ObjString *name = READ_STRING();
+    case OP_SET_GLOBAL:
+      operand = READ_BYTE();
+    setGlobalOp: {
+      ObjString *name = STRING_AT(operand);
       if (tableSet(&vm.globals, name, peek(0))) {
         tableDelete(&vm.globals, name); // [delete]
         runtimeError("Undefined variable '%s'.", name->chars);
@@ -369,26 +480,34 @@ static InterpretResult run() {
       break;
     }
 
-    case OP_GET_UPVALUE: {
-      uint8_t slot = READ_BYTE();
-      push(*frame->closure->upvalues[slot]->location);
+    case OP_GET_UPVALUE:
+      operand = READ_BYTE();
+    getUpvalueOp:
+      push(*frame->closure->upvalues[operand]->location);
       break;
-    }
 
-    case OP_SET_UPVALUE: {
-      uint8_t slot = READ_BYTE();
-      *frame->closure->upvalues[slot]->location = peek(0);
+    case OP_SET_UPVALUE:
+      operand = READ_BYTE();
+    setUpvalueOp: {
+      ObjUpvalue *upvalue = frame->closure->upvalues[operand];
+      writeBarrier((Obj *)upvalue, peek(0));
+      beginHeapWrite();
+      overwriteBarrier(*upvalue->location);
+      *upvalue->location = peek(0);
+      endHeapWrite();
       break;
     }
 
-    case OP_GET_PROPERTY: {
+    case OP_GET_PROPERTY:
+      operand = READ_BYTE();
+    getPropertyOp: {
       if (!IS_INSTANCE(peek(0))) {
         runtimeError("Only instances have properties.");
         return INTERPRET_RUNTIME_ERROR;
       }
 
       ObjInstance *instance = AS_INSTANCE(peek(0));
-      ObjString *name = READ_STRING();
+      ObjString *name = STRING_AT(operand);
 
       Value value;
       if (tableGet(&instance->fields, name, &value)) {
@@ -402,20 +521,30 @@ static InterpretResult run() {
       break;
     }
 
-    case OP_SET_PROPERTY: {
+    case OP_SET_PROPERTY:
+      operand = READ_BYTE();
+    setPropertyOp: {
       if (!IS_INSTANCE(peek(1))) {
         runtimeError("Only instances have fields.");
         return INTERPRET_RUNTIME_ERROR;
       }
       ObjInstance *instance = AS_INSTANCE(peek(1));
-      tableSet(&instance->fields, READ_STRING(), peek(0));
+      ObjString *name = STRING_AT(operand);
+      writeBarrier((Obj *)instance, OBJ_VAL(name));
+      writeBarrier((Obj *)instance, peek(0));
+      beginHeapWrite();
+      overwriteEntryBarrier(&instance->fields, name);
+      tableSet(&instance->fields, name, peek(0));
+      endHeapWrite();
       Value value = pop();
       pop();
       push(value);
       break;
     }
-    case OP_GET_SUPER: {
-      ObjString *name = READ_STRING();
+    case OP_GET_SUPER:
+      operand = READ_BYTE();
+    getSuperOp: {
+      ObjString *name = STRING_AT(operand);
       ObjClass *superclass = AS_CLASS(pop());
       if (!bindMethod(superclass, name)) {
         return INTERPRET_RUNTIME_ERROR;
@@ -434,6 +563,19 @@ static InterpretResult run() {
     case OP_LESS:
       BINARY_OP(BOOL_VAL, <);
       break;
+    case OP_NOT_EQUAL: {
+      Value b = pop();
+      Value a = pop();
+      push(BOOL_VAL(!valuesEqual(a, b)));
+      break;
+    }
+    // the fused forms keep the `!(a < b)` result of the unfused pair for NaN
+    case OP_GREATER_EQUAL:
+      BINARY_OP(NOT_BOOL_VAL, <);
+      break;
+    case OP_LESS_EQUAL:
+      BINARY_OP(NOT_BOOL_VAL, >);
+      break;
     case OP_ADD: {
       if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
         concatenate();
@@ -470,69 +612,110 @@ static InterpretResult run() {
       push(NUMBER_VAL(-AS_NUMBER(pop())));
       break;
 
+    case OP_ADD_NUM:
+      NUMBER_OP(NUMBER_VAL, +);
+      break;
+    case OP_SUBTRACT_NUM:
+      NUMBER_OP(NUMBER_VAL, -);
+      break;
+    case OP_MULTIPLY_NUM:
+      NUMBER_OP(NUMBER_VAL, *);
+      break;
+    case OP_DIVIDE_NUM:
+      NUMBER_OP(NUMBER_VAL, /);
+      break;
+    case OP_GREATER_NUM:
+      NUMBER_OP(BOOL_VAL, >);
+      break;
+    case OP_LESS_NUM:
+      NUMBER_OP(BOOL_VAL, <);
+      break;
+    case OP_GREATER_EQUAL_NUM:
+      NUMBER_OP(NOT_BOOL_VAL, <);
+      break;
+    case OP_LESS_EQUAL_NUM:
+      NUMBER_OP(NOT_BOOL_VAL, >);
+      break;
+    case OP_NEGATE_NUM:
+      push(NUMBER_VAL(-AS_NUMBER(pop())));
+      break;
+
     case OP_PRINT: {
       printValue(pop());
       printf("\n");
       break;
     }
 
-    case OP_JUMP: {
-      uint16_t offset = READ_SHORT();
-      frame->ip += offset;
+    case OP_JUMP:
+      operand = READ_SHORT();
+    jumpOp:
+      frame->ip += operand;
       break;
-    }
 
-    case OP_JUMP_IF_FALSE: {
-      uint16_t offset = READ_SHORT();
+    case OP_JUMP_IF_FALSE:
+      operand = READ_SHORT();
+    jumpIfFalseOp:
       if (isFalsey(peek(0)))
-        frame->ip += offset;
+        frame->ip += operand;
       break;
-    }
 
-    case OP_LOOP: {
-      uint16_t offset = READ_SHORT();
-      frame->ip -= offset;
+    case OP_LOOP:
+      operand = READ_SHORT();
+    loopOp:
+      if (!safepoint())
+        return INTERPRET_RUNTIME_ERROR;
+      frame->ip -= operand;
       break;
-    }
 
     case OP_CALL: {
       int argCount = READ_BYTE();
-      if (!callValue(peek(argCount), argCount)) {
+      if (!safepoint() || !callValue(peek(argCount), argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frameCount - 1];
+      ENTER_FRAME();
       break;
     }
 
-    case OP_INVOKE: {
-      ObjString *method = READ_STRING();
+    case OP_INVOKE:
+      operand = READ_BYTE();
+    invokeOp: {
+      if (!safepoint())
+        return INTERPRET_RUNTIME_ERROR;
+      ObjString *method = STRING_AT(operand);
       int argCount = READ_BYTE();
       if (!invoke(method, argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frameCount - 1];
+      ENTER_FRAME();
       break;
     }
 
-    case OP_SUPER_INVOKE: {
-      ObjString *method = READ_STRING();
+    case OP_SUPER_INVOKE:
+      operand = READ_BYTE();
+    superInvokeOp: {
+      if (!safepoint())
+        return INTERPRET_RUNTIME_ERROR;
+      ObjString *method = STRING_AT(operand);
       int argCount = READ_BYTE();
       ObjClass *superclass = AS_CLASS(pop());
       if (!invokeFromClass(superclass, method, argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frameCount - 1];
+      ENTER_FRAME();
       break;
     }
 
-    case OP_CLOSURE: {
-      ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+    case OP_CLOSURE:
+      operand = READ_BYTE();
+      wide = false;
+    closureOp: {
+      ObjFunction *function = AS_FUNCTION(CONSTANT_AT(operand));
       ObjClosure *closure = newClosure(function);
       push(OBJ_VAL(closure));
 
       for (int i = 0; i < closure->upvalueCount; i++) {
         uint8_t isLocal = READ_BYTE();
-        uint8_t index = READ_BYTE();
+        int index = wide ? READ_SHORT() : READ_BYTE();
         if (isLocal) {
           closure->upvalues[i] = captureUpvalue(frame->slots + index);
         } else {
@@ -548,6 +731,8 @@ static InterpretResult run() {
       break;
 
     case OP_RETURN: {
+      if (!safepoint())
+        return INTERPRET_RUNTIME_ERROR;
       Value result = pop();
       closeUpvalues(frame->slots);
       vm.frameCount--;
@@ -563,7 +748,9 @@ static InterpretResult run() {
     }
 
     case OP_CLASS:
-      push(OBJ_VAL(newClass(READ_STRING())));
+      operand = READ_BYTE();
+    classOp:
+      push(OBJ_VAL(newClass(STRING_AT(operand))));
       break;
 
     case OP_INHERIT: {
@@ -574,26 +761,88 @@ static InterpretResult run() {
       }
 
       ObjClass *subclass = AS_CLASS(peek(0));
+      // the methods of the new class are still empty, nothing to overwrite
+      writeBarrierAll((Obj *)subclass);
+      beginHeapWrite();
       tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+      endHeapWrite();
       pop(); // Subclass.
       break;
     }
     case OP_METHOD:
-      defineMethod(READ_STRING());
+      operand = READ_BYTE();
+    methodOp:
+      defineMethod(STRING_AT(operand));
       break;
+
+    case OP_WIDE:
+      instruction = READ_BYTE();
+      if (instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE ||
+          instruction == OP_LOOP) {
+        operand = READ_WORD();
+      } else {
+        operand = READ_SHORT();
+      }
+      switch (instruction) {
+      case OP_CONSTANT:
+        goto constantOp;
+      case OP_GET_LOCAL:
+        goto getLocalOp;
+      case OP_SET_LOCAL:
+        goto setLocalOp;
+      case OP_GET_GLOBAL:
+        goto getGlobalOp;
+      case OP_DEFINE_GLOBAL:
+        goto defineGlobalOp;
+      case OP_SET_GLOBAL:
+        goto setGlobalOp;
+      case OP_GET_UPVALUE:
+        goto getUpvalueOp;
+      case OP_SET_UPVALUE:
+        goto setUpvalueOp;
+      case OP_GET_PROPERTY:
+        goto getPropertyOp;
+      case OP_SET_PROPERTY:
+        goto setPropertyOp;
+      case OP_GET_SUPER:
+        goto getSuperOp;
+      case OP_JUMP:
+        goto jumpOp;
+      case OP_JUMP_IF_FALSE:
+        goto jumpIfFalseOp;
+      case OP_LOOP:
+        goto loopOp;
+      case OP_INVOKE:
+        goto invokeOp;
+      case OP_SUPER_INVOKE:
+        goto superInvokeOp;
+      case OP_CLOSURE:
+        wide = true;
+        goto closureOp;
+      case OP_CLASS:
+        goto classOp;
+      case OP_METHOD:
+        goto methodOp;
+      default:
+        YSCRIPT_UNREACHABLE("OP_WIDE before an instruction without operands");
+      }
     }
   }
 #undef READ_BYTE
 #undef READ_SHORT
-#undef READ_CONSTANT
-#undef READ_STRING
+#undef READ_WORD
+#undef CONSTANT_AT
+#undef STRING_AT
+#undef NOT_BOOL_VAL
+#undef ENTER_FRAME
 #undef BINARY_OP
+#undef NUMBER_OP
 }
 
 void hack(bool b) {
   // Hack to avoid unused function error. run() is not used in the
   // scanning chapter.
-  run();
+  run<false>();
   if (b)
     hack(false);
 }
@@ -609,5 +858,5 @@ InterpretResult interpret(const char *source) {
   pop();
   push(OBJ_VAL(closure));
   call(closure, 0);
-  return run();
+  return vmStats.enabled || tracer.enabled ? run<true>() : run<false>();
 }
@@ -30,6 +30,14 @@ typedef struct {
   Value* slots;
 } CallFrame;
 
+// where the incremental collection of the old generation is, see
+// collectSlice()
+typedef enum {
+  GC_IDLE,
+  GC_MARKING,
+  GC_SWEEPING,
+} GCPhase;
+
 typedef struct {
   CallFrame frames[FRAMES_MAX];
   int frameCount;
@@ -44,12 +52,32 @@ typedef struct {
 
   size_t bytesAllocated;
   size_t nextGC;
-
-  Obj* objects;
+  // a collection left more than gcPolicy.heapLimit
+  bool outOfMemory;
+  // outOfMemory, nursery.collectionRequested, sliceRequested or
+  // compactionRequested, for the interpreter loop to test one flag
+  bool safepointRequested;
+  // every byte ever allocated, freeing does not take it back
+  size_t bytesAllocatedTotal;
+  // the reallocate() calls that grew a block and the young objects
+  size_t allocationCount;
 
   int grayCount;
   int grayCapacity;
   Obj** grayStack;
+
+  GCPhase gcPhase;
+  // the marker thread has the gray stack
+  bool markerRunning;
+  // waiting for the next safepoint to run a slice
+  bool sliceRequested;
+  // allocated since the last slice
+  size_t sliceBytes;
+  // waiting for the next safepoint to compact the old generation
+  bool compactionRequested;
+  // for gcStats once the collection is done
+  size_t cycleBytesBefore;
+  uint64_t cyclePauseNs;
 } VM;
 
 
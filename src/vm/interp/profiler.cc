@@ -0,0 +1,326 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "vm/interp/interp.h"
+#include "vm/interp/profiler.h"
+
+// entries of the ring buffer, a power of two so the indexes may wrap
+#define PROFILER_BUFFER_SIZE (64 * 1024)
+#define TABLE_MAX_LOAD 0.75
+
+typedef struct {
+  // NULL for the entry starting a sample, offset is its depth then
+  ObjFunction *function;
+  int offset;
+} SampleEntry;
+
+typedef struct {
+  // a whole collapsed stack or the label of a function, NULL if unused
+  char *key;
+  // source line for the line table, 0 for stacks
+  int line;
+  uint64_t count;
+} ProfileCount;
+
+typedef struct {
+  ProfileCount *entries;
+  int count;
+  int capacity;
+} ProfileTable;
+
+static SampleEntry buffer[PROFILER_BUFFER_SIZE];
+// the signal handler is the only writer of head, drainProfiler() of tail
+static std::atomic<uint32_t> head;
+static std::atomic<uint32_t> tail;
+static std::atomic<bool> sampling;
+// set while the collector moves objects, see suspendProfiler()
+static std::atomic<bool> suspended;
+// samples lost to a full buffer
+static std::atomic<uint64_t> dropped;
+// set from startProfiler() until freeProfiler()
+static bool profiling = false;
+
+static ProfileTable stacks;
+static ProfileTable lines;
+static uint64_t sampleCount = 0;
+// the stack being collapsed by drainProfiler()
+static char *stackKey = NULL;
+static size_t stackKeyCapacity = 0;
+
+// only lock-free atomics and plain stores in here, it may interrupt the VM
+// at any instruction
+static void onProfileSignal(int signal) {
+  (void)signal;
+  if (!sampling.load(std::memory_order_relaxed))
+    return;
+
+  // call() fills in a frame before it counts it. a moved closure has the
+  // address of its copy over its function, the frames are not followed
+  // while the collector moves them.
+  int depth = suspended.load(std::memory_order_relaxed) ? 0 : vm.frameCount;
+  std::atomic_signal_fence(std::memory_order_acquire);
+
+  uint32_t start = head.load(std::memory_order_relaxed);
+  uint32_t used = start - tail.load(std::memory_order_acquire);
+  if (used + depth + 1 > PROFILER_BUFFER_SIZE) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  SampleEntry *header = &buffer[start % PROFILER_BUFFER_SIZE];
+  header->function = NULL;
+  header->offset = depth;
+  for (int i = 0; i < depth; i++) {
+    CallFrame *frame = &vm.frames[i];
+    ObjFunction *function = frame->closure->function;
+    SampleEntry *entry = &buffer[(start + 1 + i) % PROFILER_BUFFER_SIZE];
+    entry->function = function;
+    // ip is past the instruction, the call for the frames below the top.
+    entry->offset = (int)(frame->ip - function->chunk.code) - 1;
+  }
+  head.store(start + 1 + depth, std::memory_order_release);
+}
+
+static uint32_t hashKey(const char *key, int line) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const char *c = key; *c != '\0'; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= 16777619;
+  }
+  hash ^= (uint32_t)line;
+  hash *= 16777619;
+  return hash;
+}
+
+static ProfileCount *findEntry(ProfileCount *entries, int capacity,
+                               const char *key, int line) {
+  uint32_t index = hashKey(key, line) & (capacity - 1);
+  for (;;) {
+    ProfileCount *entry = &entries[index];
+    if (entry->key == NULL ||
+        (entry->line == line && strcmp(entry->key, key) == 0))
+      return entry;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growTable(ProfileTable *table) {
+  int capacity = table->capacity < 64 ? 64 : table->capacity * 2;
+  ProfileCount *entries =
+      (ProfileCount *)calloc(capacity, sizeof(ProfileCount));
+  if (entries == NULL)
+    exit(1);
+  for (int i = 0; i < table->capacity; i++) {
+    ProfileCount *entry = &table->entries[i];
+    if (entry->key != NULL)
+      *findEntry(entries, capacity, entry->key, entry->line) = *entry;
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+static void countSample(ProfileTable *table, const char *key, int line) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    growTable(table);
+  ProfileCount *entry =
+      findEntry(table->entries, table->capacity, key, line);
+  if (entry->key == NULL) {
+    entry->key = strdup(key);
+    entry->line = line;
+    entry->count = 0;
+    table->count++;
+  }
+  entry->count++;
+}
+
+static void freeTable(ProfileTable *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    free(table->entries[i].key);
+  }
+  free(table->entries);
+  table->entries = NULL;
+  table->count = 0;
+  table->capacity = 0;
+}
+
+static void appendKey(size_t *length, const char *text) {
+  size_t textLength = strlen(text);
+  if (*length + textLength + 1 > stackKeyCapacity) {
+    stackKeyCapacity = (*length + textLength + 1) * 2;
+    stackKey = (char *)realloc(stackKey, stackKeyCapacity);
+    if (stackKey == NULL)
+      exit(1);
+  }
+  memcpy(stackKey + *length, text, textLength + 1);
+  *length += textLength;
+}
+
+// "name:line" with the line of the declaration, names may repeat
+static void functionLabel(ObjFunction *function, char *label, size_t size) {
+  if (function->name == NULL) {
+    snprintf(label, size, "script");
+  } else {
+    snprintf(label, size, "%s:%d", function->name->chars, function->line);
+  }
+}
+
+void drainProfiler() {
+  if (!profiling)
+    return;
+
+  uint32_t end = head.load(std::memory_order_acquire);
+  uint32_t at = tail.load(std::memory_order_relaxed);
+  char label[256];
+  while (at != end) {
+    int depth = buffer[at % PROFILER_BUFFER_SIZE].offset;
+    size_t length = 0;
+    appendKey(&length, depth == 0 ? "(vm)" : "");
+    for (int i = 0; i < depth; i++) {
+      SampleEntry *entry = &buffer[(at + 1 + i) % PROFILER_BUFFER_SIZE];
+      functionLabel(entry->function, label, sizeof(label));
+      if (i > 0)
+        appendKey(&length, ";");
+      appendKey(&length, label);
+    }
+    countSample(&stacks, stackKey, 0);
+
+    if (depth > 0) {
+      SampleEntry *leaf = &buffer[(at + depth) % PROFILER_BUFFER_SIZE];
+      Chunk *chunk = &leaf->function->chunk;
+      int offset = leaf->offset;
+      if (offset < 0)
+        offset = 0;
+      if (offset >= chunk->count)
+        offset = chunk->count - 1;
+      functionLabel(leaf->function, label, sizeof(label));
+      countSample(&lines, label, offset >= 0 ? getLine(chunk, offset) : 0);
+    }
+    sampleCount++;
+    at += depth + 1;
+  }
+  tail.store(at, std::memory_order_release);
+}
+
+bool startProfiler(int hz) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onProfileSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    return false;
+
+  profiling = true;
+  sampling.store(true, std::memory_order_relaxed);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    sampling.store(false, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void suspendProfiler() {
+  suspended.store(true, std::memory_order_relaxed);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void resumeProfiler() {
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  suspended.store(false, std::memory_order_relaxed);
+}
+
+void stopProfiler() {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  // the handler stays installed, a signal still pending is ignored.
+  sampling.store(false, std::memory_order_relaxed);
+  drainProfiler();
+}
+
+void freeProfiler() {
+  freeTable(&stacks);
+  freeTable(&lines);
+  free(stackKey);
+  stackKey = NULL;
+  stackKeyCapacity = 0;
+  sampleCount = 0;
+  profiling = false;
+}
+
+static int compareKeys(const void *a, const void *b) {
+  return strcmp((*(const ProfileCount **)a)->key,
+                (*(const ProfileCount **)b)->key);
+}
+
+static int compareCounts(const void *a, const void *b) {
+  const ProfileCount *countA = *(const ProfileCount **)a;
+  const ProfileCount *countB = *(const ProfileCount **)b;
+  if (countA->count != countB->count)
+    return countA->count < countB->count ? 1 : -1;
+  int order = strcmp(countA->key, countB->key);
+  return order != 0 ? order : countA->line - countB->line;
+}
+
+// the used entries of table in order, to be freed by the caller
+static ProfileCount **sortedCounts(ProfileTable *table,
+                                   int (*compare)(const void *,
+                                                  const void *)) {
+  ProfileCount **sorted =
+      (ProfileCount **)malloc(sizeof(ProfileCount *) * (table->count + 1));
+  if (sorted == NULL)
+    exit(1);
+  int count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key != NULL)
+      sorted[count++] = &table->entries[i];
+  }
+  qsort(sorted, count, sizeof(ProfileCount *), compare);
+  return sorted;
+}
+
+void writeCollapsedStacks(FILE *file) {
+  ProfileCount **sorted = sortedCounts(&stacks, compareKeys);
+  for (int i = 0; i < stacks.count; i++) {
+    fprintf(file, "%s %" PRIu64 "\n", sorted[i]->key, sorted[i]->count);
+  }
+  free(sorted);
+}
+
+void printLineHotness(FILE *file) {
+  ProfileCount **sorted = sortedCounts(&lines, compareCounts);
+  fprintf(file, "== profile: %" PRIu64 " samples, %" PRIu64 " dropped ==\n",
+          sampleCount, dropped.load(std::memory_order_relaxed));
+  for (int i = 0; i < lines.count; i++) {
+    fprintf(file, "%10" PRIu64 " %6.2f%%  %s line %d\n", sorted[i]->count,
+            100.0 * (double)sorted[i]->count / (double)sampleCount,
+            sorted[i]->key, sorted[i]->line);
+  }
+  free(sorted);
+}
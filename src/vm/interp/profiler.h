@@ -0,0 +1,50 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_VM_INTERP_PROFILER_H_
+#define YSCRIPT_VM_INTERP_PROFILER_H_
+
+#include <stdio.h>
+
+#include "common/config.h"
+
+/**
+ * sampling profiler of the script call stacks. a SIGPROF timer interrupts
+ * the VM, the signal handler copies the function and code offset of every
+ * frame in vm.frames into a lock-free ring buffer and nothing else.
+ * drainProfiler() turns the buffered samples into names and lines outside
+ * of the handler, the GC drains it before sweeping so every sampled
+ * function is still alive.
+ */
+
+#define PROFILER_DEFAULT_HZ 1000
+
+// false if the timer could not be set up
+bool startProfiler(int hz);
+void stopProfiler();
+void drainProfiler();
+// the collector is about to move objects the frames point at, the samples
+// until resumeProfiler() count for the VM alone
+void suspendProfiler();
+void resumeProfiler();
+void freeProfiler();
+
+// one line per distinct stack, root first: "script;fib:1;fib:1 42"
+void writeCollapsedStacks(FILE *file);
+// samples per function and line, where the innermost frame was
+void printLineHotness(FILE *file);
+
+#endif // YSCRIPT_VM_INTERP_PROFILER_H_
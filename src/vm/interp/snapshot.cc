@@ -0,0 +1,304 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "common/memory.h"
+#include "vm/interp/interp.h"
+#include "vm/interp/snapshot.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+// the walk keeps its state out of the heap, malloc() does not collect
+typedef struct {
+  base::Stream *out;
+  // the ids of the objects found, open addressing on keys
+  Obj **keys;
+  uint32_t *ids;
+  int capacity;
+  uint32_t count;
+  // found, not written yet
+  Obj **pending;
+  int pendingCount;
+  int pendingCapacity;
+  // the references of the object being written
+  uint32_t *references;
+  int referenceCount;
+  int referenceCapacity;
+} Snapshot;
+
+static Snapshot snapshot;
+
+static void *growArray(void *array, int *capacity, size_t size) {
+  *capacity = *capacity < 8 ? 8 : *capacity * 2;
+  array = realloc(array, size * *capacity);
+  if (array == NULL)
+    exit(1);
+  return array;
+}
+
+static uint32_t hashObject(Obj *object) {
+  uintptr_t bits = (uintptr_t)object >> 3;
+  return (uint32_t)(bits ^ (bits >> 17) ^ (bits >> 31)) * 2654435761u;
+}
+
+static int findSlot(Obj **keys, int capacity, Obj *object) {
+  int index = (int)(hashObject(object) & (uint32_t)(capacity - 1));
+  while (keys[index] != NULL && keys[index] != object) {
+    index = (index + 1) & (capacity - 1);
+  }
+  return index;
+}
+
+static void growIds() {
+  int capacity = snapshot.capacity < 1024 ? 1024 : snapshot.capacity * 2;
+  Obj **keys = (Obj **)calloc(capacity, sizeof(Obj *));
+  uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * capacity);
+  if (keys == NULL || ids == NULL)
+    exit(1);
+  for (int i = 0; i < snapshot.capacity; i++) {
+    if (snapshot.keys[i] == NULL)
+      continue;
+    int slot = findSlot(keys, capacity, snapshot.keys[i]);
+    keys[slot] = snapshot.keys[i];
+    ids[slot] = snapshot.ids[i];
+  }
+  free(snapshot.keys);
+  free(snapshot.ids);
+  snapshot.keys = keys;
+  snapshot.ids = ids;
+  snapshot.capacity = capacity;
+}
+
+// the id of object, a new one queues it for writing
+static uint32_t idOf(Obj *object) {
+  if (snapshot.count + 1 > snapshot.capacity * TABLE_MAX_LOAD)
+    growIds();
+  int slot = findSlot(snapshot.keys, snapshot.capacity, object);
+  if (snapshot.keys[slot] != NULL)
+    return snapshot.ids[slot];
+
+  snapshot.keys[slot] = object;
+  snapshot.ids[slot] = snapshot.count++;
+  if (snapshot.pendingCount == snapshot.pendingCapacity) {
+    snapshot.pending = (Obj **)growArray(
+        snapshot.pending, &snapshot.pendingCapacity, sizeof(Obj *));
+  }
+  snapshot.pending[snapshot.pendingCount++] = object;
+  return snapshot.ids[slot];
+}
+
+static void writeString(const char *chars, int length) {
+  snapshot.out->WriteU32((uint32_t)length);
+  snapshot.out->WriteData(chars, length);
+}
+
+static void writeName(ObjString *name) {
+  if (name == NULL) {
+    writeString("", 0);
+  } else {
+    writeString(name->chars, name->length);
+  }
+}
+
+static void addReference(Obj *object) {
+  if (object == NULL)
+    return;
+  if (snapshot.referenceCount == snapshot.referenceCapacity) {
+    snapshot.references = (uint32_t *)growArray(
+        snapshot.references, &snapshot.referenceCapacity, sizeof(uint32_t));
+  }
+  snapshot.references[snapshot.referenceCount++] = idOf(object);
+}
+
+static void addValue(Value value) {
+  if (IS_OBJ(value))
+    addReference(AS_OBJ(value));
+}
+
+static void addTable(Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    addReference((Obj *)entry->key);
+    addValue(entry->value);
+  }
+}
+
+// the object and what it owns, the way releaseObject() in memory.cc frees
+static size_t ownedSize(Obj *object) {
+  size_t size = objectSize(object->type);
+  switch (object->type) {
+  case OBJ_CLASS:
+    size += sizeof(Entry) * ((ObjClass *)object)->methods.capacity;
+    break;
+
+  case OBJ_CLOSURE:
+    size += sizeof(ObjUpvalue *) * ((ObjClosure *)object)->upvalueCount;
+    break;
+
+  case OBJ_FUNCTION: {
+    Chunk *chunk = &((ObjFunction *)object)->chunk;
+    size += chunk->capacity;
+    size += sizeof(LineStart) * chunk->lineCapacity;
+    size += sizeof(Value) * chunk->constants.capacity;
+    break;
+  }
+
+  case OBJ_INSTANCE:
+    size += sizeof(Entry) * ((ObjInstance *)object)->fields.capacity;
+    break;
+
+  case OBJ_STRING:
+    size += ((ObjString *)object)->length + 1;
+    break;
+
+  case OBJ_BOUND_METHOD:
+  case OBJ_NATIVE:
+  case OBJ_UPVALUE:
+    break;
+  }
+  return size;
+}
+
+// the references in the order blackenObject() in memory.cc marks them
+static void addReferences(Obj *object) {
+  switch (object->type) {
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    addValue(bound->receiver);
+    addReference((Obj *)bound->method);
+    break;
+  }
+
+  case OBJ_CLASS: {
+    ObjClass *klass = (ObjClass *)object;
+    addReference((Obj *)klass->name);
+    addTable(&klass->methods);
+    break;
+  }
+
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    addReference((Obj *)closure->function);
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      addReference((Obj *)closure->upvalues[i]);
+    }
+    break;
+  }
+
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    addReference((Obj *)function->name);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+      addValue(function->chunk.constants.values[i]);
+    }
+    break;
+  }
+
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)object;
+    addReference((Obj *)instance->klass);
+    addTable(&instance->fields);
+    break;
+  }
+
+  case OBJ_UPVALUE:
+    addValue(((ObjUpvalue *)object)->closed);
+    break;
+
+  case OBJ_NATIVE:
+  case OBJ_STRING:
+    break;
+  }
+}
+
+static void writeObjectName(Obj *object) {
+  switch (object->type) {
+  case OBJ_STRING: {
+    ObjString *string = (ObjString *)object;
+    int length = string->length;
+    if (length > SNAPSHOT_NAME_MAX)
+      length = SNAPSHOT_NAME_MAX;
+    writeString(string->chars, length);
+    break;
+  }
+
+  case OBJ_CLASS:
+    writeName(((ObjClass *)object)->name);
+    break;
+
+  case OBJ_INSTANCE:
+    writeName(((ObjInstance *)object)->klass->name);
+    break;
+
+  case OBJ_FUNCTION:
+    writeName(((ObjFunction *)object)->name);
+    break;
+
+  case OBJ_CLOSURE:
+    writeName(((ObjClosure *)object)->function->name);
+    break;
+
+  case OBJ_BOUND_METHOD:
+  case OBJ_NATIVE:
+  case OBJ_UPVALUE:
+    writeString("", 0);
+    break;
+  }
+}
+
+static void writeObject(Obj *object) {
+  snapshot.referenceCount = 0;
+  addReferences(object);
+
+  base::Stream *out = snapshot.out;
+  out->WriteU8('O');
+  out->WriteU32(idOf(object));
+  out->WriteU8((uint8_t)object->type);
+  out->WriteU32((uint32_t)ownedSize(object));
+  writeObjectName(object);
+  out->WriteU32((uint32_t)snapshot.referenceCount);
+  out->WriteData(snapshot.references,
+                 sizeof(uint32_t) * snapshot.referenceCount);
+}
+
+static void writeRoot(RootKind kind, ObjString *name, Obj *object) {
+  snapshot.out->WriteU8('R');
+  snapshot.out->WriteU8((uint8_t)kind);
+  snapshot.out->WriteU32(idOf(object));
+  writeName(name);
+}
+
+void writeHeapSnapshot(base::Stream &out) {
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.out = &out;
+  out.WriteData(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+
+  visitRoots(writeRoot);
+  while (snapshot.pendingCount > 0) {
+    writeObject(snapshot.pending[--snapshot.pendingCount]);
+  }
+  out.WriteU8('E');
+  out.WriteU32(snapshot.count);
+
+  free(snapshot.keys);
+  free(snapshot.ids);
+  free(snapshot.pending);
+  free(snapshot.references);
+  memset(&snapshot, 0, sizeof(snapshot));
+}
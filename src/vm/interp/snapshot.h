@@ -0,0 +1,48 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_VM_INTERP_SNAPSHOT_H_
+#define YSCRIPT_VM_INTERP_SNAPSHOT_H_
+
+#include "common/config.h"
+#include "stream/stream.h"
+
+/**
+ * heap snapshot, every object reachable from the roots of visitRoots()
+ * with its references. the objects get ids in the order the walk finds
+ * them, a reference may name an object whose block comes later.
+ * tools/heap computes the retained sizes and the dominator tree.
+ *
+ * file layout, integers in host byte order:
+ *   "YSHEAP01"
+ *   blocks, each starting with a tag byte:
+ *   'R' a root, u8 RootKind, u32 id, string name of the global
+ *   'O' an object, u32 id, u8 ObjType, u32 size, string name,
+ *       u32 reference count, the u32 ids
+ *   'E' the end, u32 object count
+ * the size counts the arrays and tables the object owns. strings carry up
+ * to SNAPSHOT_NAME_MAX of their bytes as the name, classes, instances,
+ * functions and closures the name of the class or function. a string is a
+ * u32 length and the bytes, empty for no name.
+ */
+
+#define SNAPSHOT_MAGIC "YSHEAP01"
+#define SNAPSHOT_NAME_MAX 64
+
+// between two interpret() calls, the snapshot does not collect
+void writeHeapSnapshot(base::Stream &out);
+
+#endif // YSCRIPT_VM_INTERP_SNAPSHOT_H_
@@ -0,0 +1,233 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "disassembler/disassembler.h"
+#include "stream/stream.h"
+#include "vm/interp/interp.h"
+#include "vm/interp/stats.h"
+
+VMStats vmStats;
+
+void initVMStats() {
+  bool enabled = vmStats.enabled;
+  memset(&vmStats, 0, sizeof(vmStats));
+  vmStats.enabled = enabled;
+  vmStats.current = -1;
+}
+
+void freeVMStats() {
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    free(vmStats.functions[i].name);
+    free(vmStats.functions[i].hits);
+  }
+  free(vmStats.functions);
+  initVMStats();
+}
+
+FunctionStats *functionStats(ObjFunction *function) {
+  if (function->statsIndex != -1)
+    return &vmStats.functions[function->statsIndex];
+
+  if (vmStats.functionCount == vmStats.functionCapacity) {
+    vmStats.functionCapacity =
+        vmStats.functionCapacity < 8 ? 8 : vmStats.functionCapacity * 2;
+    vmStats.functions = (FunctionStats *)realloc(
+        vmStats.functions, sizeof(FunctionStats) * vmStats.functionCapacity);
+    if (vmStats.functions == NULL)
+      exit(1);
+  }
+  function->statsIndex = vmStats.functionCount++;
+  FunctionStats *stats = &vmStats.functions[function->statsIndex];
+  const char *name = function->name != NULL ? function->name->chars : "script";
+  stats->name = strdup(name);
+  stats->line = function->line;
+  stats->calls = 0;
+  stats->instructions = 0;
+  stats->bytesAllocated = 0;
+  stats->function = function;
+  // the function runs, so its chunk is finished and keeps its size.
+  stats->hits = (uint64_t *)calloc(function->chunk.count + 1, sizeof(uint64_t));
+  if (stats->hits == NULL)
+    exit(1);
+  return stats;
+}
+
+void forgetFunctionStats(ObjFunction *function) {
+  vmStats.functions[function->statsIndex].function = NULL;
+}
+
+static void chargeAllocations() {
+  if (vmStats.current != -1) {
+    vmStats.functions[vmStats.current].bytesAllocated +=
+        vm.bytesAllocatedTotal - vmStats.allocatedMark;
+  }
+  vmStats.allocatedMark = vm.bytesAllocatedTotal;
+}
+
+void switchFunctionStats(ObjFunction *function) {
+  chargeAllocations();
+  functionStats(function);
+  vmStats.current = function->statsIndex;
+}
+
+static int compareOpcodes(const void *a, const void *b) {
+  uint64_t countA = vmStats.opcodes[*(const uint8_t *)a];
+  uint64_t countB = vmStats.opcodes[*(const uint8_t *)b];
+  if (countA != countB)
+    return countA < countB ? 1 : -1;
+  return *(const uint8_t *)a - *(const uint8_t *)b;
+}
+
+static int compareFunctions(const void *a, const void *b) {
+  const FunctionStats *statsA = &vmStats.functions[*(const int *)a];
+  const FunctionStats *statsB = &vmStats.functions[*(const int *)b];
+  if (statsA->instructions != statsB->instructions)
+    return statsA->instructions < statsB->instructions ? 1 : -1;
+  return statsA->line - statsB->line;
+}
+
+// the executed opcodes, most frequent first
+static int sortedOpcodes(uint8_t *opcodes, uint64_t *total) {
+  int count = 0;
+  *total = 0;
+  for (int op = 0; op < UINT8_COUNT; op++) {
+    if (vmStats.opcodes[op] == 0)
+      continue;
+    opcodes[count++] = (uint8_t)op;
+    *total += vmStats.opcodes[op];
+  }
+  qsort(opcodes, count, sizeof(uint8_t), compareOpcodes);
+  return count;
+}
+
+// indexes into vmStats.functions, most instructions first. the functions
+// keep their index, the table itself is left alone
+static int *sortedFunctions() {
+  // charge the allocations of the last instruction as well.
+  chargeAllocations();
+  int *order = (int *)malloc(sizeof(int) * (vmStats.functionCount + 1));
+  if (order == NULL)
+    exit(1);
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    order[i] = i;
+  }
+  qsort(order, vmStats.functionCount, sizeof(int), compareFunctions);
+  return order;
+}
+
+void printStats(FILE *file) {
+  uint8_t opcodes[UINT8_COUNT];
+  uint64_t total;
+  int opcodeCount = sortedOpcodes(opcodes, &total);
+  int *order = sortedFunctions();
+
+  fprintf(file, "== opcodes: %" PRIu64 " instructions ==\n", total);
+  for (int i = 0; i < opcodeCount; i++) {
+    uint64_t count = vmStats.opcodes[opcodes[i]];
+    fprintf(file, "%14" PRIu64 " %6.2f%%  %s\n", count,
+            100.0 * (double)count / (double)total, opcodeName(opcodes[i]));
+  }
+
+  fprintf(file, "== functions ==\n");
+  fprintf(file, "%10s %14s %14s  %s\n", "calls", "instructions", "bytes",
+          "function");
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    FunctionStats *stats = &vmStats.functions[order[i]];
+    fprintf(file, "%10" PRIu64 " %14" PRIu64 " %14" PRIu64 "  %s", stats->calls,
+            stats->instructions, stats->bytesAllocated, stats->name);
+    if (stats->line > 0)
+      fprintf(file, ":%d", stats->line);
+    fprintf(file, "\n");
+  }
+  free(order);
+}
+
+void writeStatsJson(FILE *file) {
+  uint8_t opcodes[UINT8_COUNT];
+  uint64_t total;
+  int opcodeCount = sortedOpcodes(opcodes, &total);
+  int *order = sortedFunctions();
+
+  // function names are identifiers, nothing needs escaping.
+  fprintf(file, "{\n  \"instructions\": %" PRIu64 ",\n  \"opcodes\": [",
+          total);
+  for (int i = 0; i < opcodeCount; i++) {
+    fprintf(file, "%s\n    {\"opcode\": \"%s\", \"count\": %" PRIu64 "}",
+            i > 0 ? "," : "", opcodeName(opcodes[i]),
+            vmStats.opcodes[opcodes[i]]);
+  }
+  fprintf(file, "\n  ],\n  \"functions\": [");
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    FunctionStats *stats = &vmStats.functions[order[i]];
+    fprintf(file,
+            "%s\n    {\"name\": \"%s\", \"line\": %d, \"calls\": %" PRIu64
+            ", \"instructions\": %" PRIu64 ", \"bytes\": %" PRIu64 "}",
+            i > 0 ? "," : "", stats->name, stats->line, stats->calls,
+            stats->instructions, stats->bytesAllocated);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  free(order);
+}
+
+// name:line, or just the name of the script
+static void writeFunctionName(base::Stream &out, FunctionStats *stats) {
+  out.WriteData(stats->name, strlen(stats->name));
+  if (stats->line > 0)
+    out.Writef(":%d", stats->line);
+}
+
+void writeAnnotations(base::Stream &out) {
+  int *order = sortedFunctions();
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    FunctionStats *stats = &vmStats.functions[order[i]];
+    if (i > 0)
+      out.WriteChar('\n');
+    out.Writef("== ");
+    writeFunctionName(out, stats);
+    out.Writef(": %" PRIu64 " instructions", stats->instructions);
+    // the code of collected functions is gone, there is nothing to annotate.
+    if (stats->function == NULL) {
+      out.Writef(", collected ==\n");
+      continue;
+    }
+    out.Writef(" ==\n");
+    annotateChunk(out, &stats->function->chunk, stats->hits);
+  }
+  free(order);
+}
+
+void writeAnnotationsJson(base::Stream &out) {
+  int *order = sortedFunctions();
+  out.Writef("{\n  \"functions\": [");
+  int written = 0;
+  for (int i = 0; i < vmStats.functionCount; i++) {
+    FunctionStats *stats = &vmStats.functions[order[i]];
+    if (stats->function == NULL)
+      continue;
+    out.Writef("%s\n    {\"name\": \"", written++ > 0 ? "," : "");
+    out.WriteData(stats->name, strlen(stats->name));
+    out.Writef("\", \"line\": %d, \"calls\": %" PRIu64
+               ", \"instructions\": %" PRIu64 ", \"code\": [",
+               stats->line, stats->calls, stats->instructions);
+    annotateChunkJson(out, &stats->function->chunk, stats->hits, "      ");
+    out.Writef("\n    ]}");
+  }
+  out.Writef("\n  ]\n}\n");
+  free(order);
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_VM_INTERP_STATS_H_
+#define YSCRIPT_VM_INTERP_STATS_H_
+
+#include <stdio.h>
+
+#include "common/ysobject.h"
+
+/**
+ * execution counters of the instrumented interpreter loop, see run() in
+ * interp.cc. the counters live outside the GC heap, allocating them never
+ * collects and they survive the functions they describe.
+ */
+
+typedef struct {
+  // copied, the function may be collected before the report
+  char *name;
+  // line the function is declared at
+  int line;
+  uint64_t calls;
+  uint64_t instructions;
+  // bytes the GC heap grew by while the function ran
+  uint64_t bytesAllocated;
+  // NULL once the function is collected
+  ObjFunction *function;
+  // executions of the instruction at every code offset
+  uint64_t *hits;
+} FunctionStats;
+
+typedef struct {
+  // run the instrumented loop, set before the first interpret()
+  bool enabled;
+  uint64_t opcodes[UINT8_COUNT];
+  FunctionStats *functions;
+  int functionCount;
+  int functionCapacity;
+  // index of the function the last instruction ran in, -1 before the first
+  // one, and vm.bytesAllocatedTotal when that function started running
+  int current;
+  size_t allocatedMark;
+} VMStats;
+
+extern VMStats vmStats;
+
+void initVMStats();
+void freeVMStats();
+
+// the counters of function, created the first time it runs
+FunctionStats *functionStats(ObjFunction *function);
+// charge the bytes allocated since the last instruction to the function it
+// ran in, then move on to function
+void switchFunctionStats(ObjFunction *function);
+// the GC frees function, its counters stay but its code is gone
+void forgetFunctionStats(ObjFunction *function);
+
+// sorted by count, most frequent first
+void printStats(FILE *file);
+void writeStatsJson(FILE *file);
+// the code of the functions with the execution count of every instruction
+void writeAnnotations(base::Stream &out);
+void writeAnnotationsJson(base::Stream &out);
+
+#endif // YSCRIPT_VM_INTERP_STATS_H_
@@ -0,0 +1,126 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "vm/interp/tracer.h"
+
+Tracer tracer;
+
+static void writeU8(uint8_t value) {
+  fwrite(&value, sizeof(value), 1, tracer.file);
+}
+
+static void writeU32(uint32_t value) {
+  fwrite(&value, sizeof(value), 1, tracer.file);
+}
+
+static void writeString(const char *chars, int length) {
+  writeU32((uint32_t)length);
+  fwrite(chars, 1, length, tracer.file);
+}
+
+static void writeConstant(Value value) {
+  if (IS_BOOL(value)) {
+    writeU8(TRACE_CONSTANT_BOOL);
+    writeU8(AS_BOOL(value) ? 1 : 0);
+  } else if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    writeU8(TRACE_CONSTANT_NUMBER);
+    fwrite(&number, sizeof(number), 1, tracer.file);
+  } else if (IS_STRING(value)) {
+    ObjString *string = AS_STRING(value);
+    writeU8(TRACE_CONSTANT_STRING);
+    writeString(string->chars, string->length);
+  } else if (IS_FUNCTION(value)) {
+    ObjFunction *function = AS_FUNCTION(value);
+    writeU8(TRACE_CONSTANT_FUNCTION);
+    writeU32((uint32_t)function->upvalueCount);
+    if (function->name != NULL) {
+      writeString(function->name->chars, function->name->length);
+    } else {
+      writeString("", 0);
+    }
+  } else {
+    // the compiler makes no other constants.
+    writeU8(TRACE_CONSTANT_NIL);
+  }
+}
+
+bool startTracer(const char *path) {
+  tracer.file = fopen(path, "wb");
+  if (tracer.file == NULL)
+    return false;
+  tracer.records =
+      (TraceRecord *)malloc(sizeof(TraceRecord) * TRACE_BUFFER_RECORDS);
+  if (tracer.records == NULL)
+    exit(1);
+  tracer.count = 0;
+  tracer.functionCount = 0;
+  tracer.enabled = true;
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), tracer.file);
+  return true;
+}
+
+void stopTracer() {
+  if (!tracer.enabled)
+    return;
+  flushTracer();
+  fclose(tracer.file);
+  free(tracer.records);
+  tracer.file = NULL;
+  tracer.records = NULL;
+  tracer.enabled = false;
+}
+
+void defineTraceFunction(ObjFunction *function) {
+  // straight to the file, ahead of the buffered records referring to it.
+  function->traceId = (int)tracer.functionCount++;
+  Chunk *chunk = &function->chunk;
+
+  writeU8('F');
+  writeU32((uint32_t)function->traceId);
+  writeU32((uint32_t)function->line);
+  writeU32((uint32_t)function->arity);
+  writeU32((uint32_t)function->upvalueCount);
+  if (function->name != NULL) {
+    writeString(function->name->chars, function->name->length);
+  } else {
+    writeString("", 0);
+  }
+
+  writeU32((uint32_t)chunk->count);
+  fwrite(chunk->code, 1, chunk->count, tracer.file);
+  writeU32((uint32_t)chunk->lineCount);
+  for (int i = 0; i < chunk->lineCount; i++) {
+    writeU32((uint32_t)chunk->lineStarts[i].offset);
+    writeU32((uint32_t)chunk->lineStarts[i].line);
+  }
+
+  writeU32((uint32_t)chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    writeConstant(chunk->constants.values[i]);
+  }
+}
+
+void flushTracer() {
+  if (tracer.count == 0)
+    return;
+  writeU8('I');
+  writeU32((uint32_t)tracer.count);
+  fwrite(tracer.records, sizeof(TraceRecord), tracer.count, tracer.file);
+  tracer.count = 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YSCRIPT_VM_INTERP_TRACER_H_
+#define YSCRIPT_VM_INTERP_TRACER_H_
+
+#include <stdio.h>
+
+#include "common/ysobject.h"
+
+/**
+ * binary execution trace, one fixed size record per instruction the
+ * instrumented loop runs. the records collect in a buffer that is written
+ * out whenever it fills up. tools/trace decodes the file.
+ *
+ * file layout, integers in host byte order:
+ *   "YSTRACE1"
+ *   blocks, each starting with a tag byte:
+ *   'F' a function the records refer to, defined before its first record
+ *       u32 id, u32 line, u32 arity, u32 upvalueCount, string name
+ *       u32 code count, the code
+ *       u32 line runs, {u32 offset, u32 line} each
+ *       u32 constant count, the constants: u8 TraceConstant and
+ *         nothing for nil, u8 for bools, f64 for numbers, string for
+ *         strings, u32 upvalueCount and string name for functions
+ *   'I' u32 count, count TraceRecords
+ * a string is a u32 length and the bytes, the script has an empty name.
+ */
+
+#define TRACE_MAGIC "YSTRACE1"
+// records buffered before a write
+#define TRACE_BUFFER_RECORDS (64 * 1024)
+
+typedef enum {
+  TRACE_CONSTANT_NIL,
+  TRACE_CONSTANT_BOOL,
+  TRACE_CONSTANT_NUMBER,
+  TRACE_CONSTANT_STRING,
+  TRACE_CONSTANT_FUNCTION,
+} TraceConstant;
+
+typedef struct {
+  // id of the 'F' block of the function
+  uint32_t function;
+  // of the instruction in the chunk of the function
+  uint32_t offset;
+  uint8_t opcode;
+  // frames on the call stack, the running one included
+  uint8_t frames;
+  // values on the VM stack before the instruction ran
+  uint16_t stack;
+} TraceRecord;
+
+typedef struct {
+  bool enabled;
+  FILE *file;
+  TraceRecord *records;
+  int count;
+  uint32_t functionCount;
+} Tracer;
+
+extern Tracer tracer;
+
+// false if the file could not be created
+bool startTracer(const char *path);
+// write out the buffered records and close the file
+void stopTracer();
+// give the function an id and write its 'F' block
+void defineTraceFunction(ObjFunction *function);
+void flushTracer();
+
+static inline void traceInstruction(ObjFunction *function, uint32_t offset,
+                                    uint8_t opcode, int frames, int stack) {
+  if (function->traceId == -1)
+    defineTraceFunction(function);
+  if (tracer.count == TRACE_BUFFER_RECORDS)
+    flushTracer();
+  TraceRecord *record = &tracer.records[tracer.count++];
+  record->function = (uint32_t)function->traceId;
+  record->offset = offset;
+  record->opcode = opcode;
+  record->frames = (uint8_t)frames;
+  record->stack = (uint16_t)stack;
+}
+
+#endif // YSCRIPT_VM_INTERP_TRACER_H_
@@ -0,0 +1,79 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTING_BENCHMARK_BENCH_H_
+#define TESTING_BENCHMARK_BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "compiler/parser.h"
+#include "vm/interp/interp.h"
+
+// the VM of the component benchmarks, its GC never runs so the objects the
+// benchmarks hold on to need no roots
+inline void initBenchVM() {
+  compilerOptions.printCode = false;
+  initVM();
+  vm.nextGC = SIZE_MAX;
+}
+
+// count distinct strings interned in the VM, prefix followed by a number
+inline std::vector<ObjString *> internStrings(const char *prefix, int count) {
+  std::vector<ObjString *> strings;
+  char buffer[64];
+  for (int i = 0; i < count; i++) {
+    int length = snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+    strings.push_back(copyString(buffer, length));
+  }
+  return strings;
+}
+
+// functions and classes of the size and shape generated scripts have
+inline std::string generateSource(int functions) {
+  std::string source;
+  char buffer[512];
+  for (int i = 0; i < functions; i++) {
+    snprintf(buffer, sizeof(buffer),
+             "fun f%d(a, b) {\n"
+             "  var x = a * %d + b;\n"
+             "  if (x > %d) {\n"
+             "    x = x - 1;\n"
+             "  } else {\n"
+             "    x = x + %d;\n"
+             "  }\n"
+             "  for (var i = 0; i < 3; i = i + 1) x = x + i;\n"
+             "  return x;\n"
+             "}\n",
+             i, i % 7, i, i);
+    source += buffer;
+    if (i % 10 == 9) {
+      snprintf(buffer, sizeof(buffer),
+               "class C%d {\n"
+               "  init(v) { this.v = v; }\n"
+               "  get() { return this.v + f%d(1, 2); }\n"
+               "}\n",
+               i, i);
+      source += buffer;
+    }
+  }
+  return source;
+}
+
+#endif // TESTING_BENCHMARK_BENCH_H_
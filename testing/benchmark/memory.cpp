@@ -0,0 +1,304 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "bench.h"
+#include "common/allocator.h"
+#include "common/gcstats.h"
+#include "common/memory.h"
+#include "common/nursery.h"
+
+// blocks allocated per round of the churn benchmark
+#define CHURN_BLOCKS 1024
+// blocks of the fragmentation benchmark
+#define FRAGMENT_BLOCKS 65536
+
+// reallocate() a round of small blocks of the argument size and free them,
+// the way short lived objects come and go
+static void BM_ReallocateChurn(benchmark::State &state) {
+  size_t size = (size_t)state.range(0);
+  std::vector<void *> blocks(CHURN_BLOCKS);
+  initBenchVM();
+  for (auto _ : state) {
+    for (int i = 0; i < CHURN_BLOCKS; i++) {
+      blocks[i] = reallocate(NULL, 0, size);
+    }
+    benchmark::DoNotOptimize(blocks.data());
+    for (int i = 0; i < CHURN_BLOCKS; i++) {
+      reallocate(blocks[i], size, 0);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * CHURN_BLOCKS);
+  freeVM();
+}
+BENCHMARK(BM_ReallocateChurn)->Arg(16)->Arg(32)->Arg(64)->Arg(256);
+
+// the same rounds without the heap accounting of reallocate(), from the
+// size classes with argument 1 and from malloc() with 0
+static void BM_AllocatorChurn(benchmark::State &state) {
+  size_t size = (size_t)state.range(0);
+  bool pages = state.range(1) != 0;
+  std::vector<void *> blocks(CHURN_BLOCKS);
+  for (auto _ : state) {
+    for (int i = 0; i < CHURN_BLOCKS; i++) {
+      blocks[i] = pages ? allocateBlock(size) : malloc(size);
+    }
+    benchmark::DoNotOptimize(blocks.data());
+    for (int i = 0; i < CHURN_BLOCKS; i++) {
+      pages ? freeBlock(blocks[i], size) : free(blocks[i]);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * CHURN_BLOCKS);
+}
+BENCHMARK(BM_AllocatorChurn)
+    ->Args({16, 0})
+    ->Args({16, 1})
+    ->Args({64, 0})
+    ->Args({64, 1})
+    ->Args({256, 0})
+    ->Args({256, 1});
+
+// the memory malloc() holds, less what it gave out before the benchmark
+static size_t mallocFootprint(bool held) {
+  struct mallinfo2 info = mallinfo2();
+  return held ? info.arena + info.hblkhd : info.uordblks + info.hblkhd;
+}
+
+static size_t pageFootprint(bool held) {
+  AllocatorStats stats = allocatorStats();
+  size_t pages = stats.pagesInUse + (held ? stats.pagesCached : 0);
+  return pages * ALLOCATOR_PAGE_SIZE;
+}
+
+/**
+ * blocks of 16 to 256 bytes, every other one freed, then half as many of
+ * 272 to 512 bytes that do not fit the holes. argument 0 takes them from
+ * malloc(), 1 from the size classes. "overhead" is the memory the allocator
+ * holds at the end per byte still allocated.
+ */
+static void BM_Fragmentation(benchmark::State &state) {
+  bool pages = state.range(0) != 0;
+  std::vector<void *> blocks(FRAGMENT_BLOCKS + FRAGMENT_BLOCKS / 2);
+  std::vector<size_t> sizes(blocks.size());
+  for (int i = 0; i < FRAGMENT_BLOCKS; i++) {
+    sizes[i] = 16 + (size_t)(i * 37) % 241;
+  }
+  for (size_t i = FRAGMENT_BLOCKS; i < sizes.size(); i++) {
+    sizes[i] = 272 + (i * 53) % 241;
+  }
+
+  malloc_trim(0);
+  trimPages(0);
+  size_t before = pages ? pageFootprint(false) : mallocFootprint(false);
+  double overhead = 0;
+  for (auto _ : state) {
+    size_t live = 0;
+    for (int i = 0; i < FRAGMENT_BLOCKS; i++) {
+      blocks[i] = pages ? allocateBlock(sizes[i]) : malloc(sizes[i]);
+      live += sizes[i];
+    }
+    for (int i = 0; i < FRAGMENT_BLOCKS; i += 2) {
+      pages ? freeBlock(blocks[i], sizes[i]) : free(blocks[i]);
+      live -= sizes[i];
+    }
+    for (size_t i = FRAGMENT_BLOCKS; i < blocks.size(); i++) {
+      blocks[i] = pages ? allocateBlock(sizes[i]) : malloc(sizes[i]);
+      live += sizes[i];
+    }
+    benchmark::DoNotOptimize(blocks.data());
+
+    if (pages)
+      flushThreadCache();
+    size_t footprint = pages ? pageFootprint(true) : mallocFootprint(true);
+    overhead = (double)(footprint - before) / (double)live;
+
+    for (size_t i = 1; i < blocks.size(); i++) {
+      if (i < FRAGMENT_BLOCKS && i % 2 == 0)
+        continue;
+      pages ? freeBlock(blocks[i], sizes[i]) : free(blocks[i]);
+    }
+  }
+  if (pages) {
+    flushThreadCache();
+    trimPages(0);
+  } else {
+    malloc_trim(0);
+  }
+  state.SetItemsProcessed(state.iterations() * blocks.size());
+  state.counters["overhead"] = overhead;
+}
+BENCHMARK(BM_Fragmentation)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+/**
+ * a round of instances that die right away and the collection that frees
+ * them, the argument is the nursery size. with 0 they go to the object
+ * pages and a full collection sweeps them, else they are bump allocated and
+ * a minor collection drops them all at once.
+ */
+static void BM_ShortLivedObjects(benchmark::State &state) {
+  GCPolicy defaults = gcPolicy;
+  gcPolicy.nurserySize = (size_t)state.range(0);
+  initBenchVM();
+  // on the stack, the minor collections move it
+  push(OBJ_VAL(newClass(copyString("Node", 4))));
+  for (auto _ : state) {
+    for (int i = 0; i < CHURN_BLOCKS; i++) {
+      benchmark::DoNotOptimize(newInstance(AS_CLASS(vm.stack[0])));
+    }
+    if (nursery.capacity != 0) {
+      collectYoung();
+    } else {
+      collectGarbage();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * CHURN_BLOCKS);
+  freeVM();
+  gcPolicy = defaults;
+}
+BENCHMARK(BM_ShortLivedObjects)->Arg(0)->Arg(65536)->Arg(262144);
+
+/**
+ * the pause of a full collection against the size of the heap, the argument
+ * is the number of instances in a list every collection marks again. the
+ * "bytes" counter is the heap size.
+ */
+static void BM_CollectGarbage(benchmark::State &state) {
+  char source[512];
+  snprintf(source, sizeof(source),
+           "class Node { init(next) { this.next = next; } }\n"
+           "var head = nil;\n"
+           "for (var i = 0; i < %d; i = i + 1) head = Node(head);\n",
+           (int)state.range(0));
+  compilerOptions.printCode = false;
+  initVM();
+  if (interpret(source) != INTERPRET_OK) {
+    state.SkipWithError("can not build the heap");
+    freeVM();
+    return;
+  }
+  collectGarbage();
+  for (auto _ : state) {
+    collectGarbage();
+  }
+  state.counters["bytes"] = (double)vm.bytesAllocated;
+  freeVM();
+}
+BENCHMARK(BM_CollectGarbage)
+    ->Arg(1024)
+    ->Arg(16384)
+    ->Arg(262144)
+    ->Unit(benchmark::kMicrosecond);
+
+/**
+ * a full collection of a binary tree of 2^18 instances on the argument
+ * number of threads, half of the tree is garbage the sweep frees again
+ * every round. the workers only run side by side with a core each.
+ */
+static void BM_ParallelCollect(benchmark::State &state) {
+  const char *source =
+      "class Node { init(left, right) { this.left = left; "
+      "this.right = right; } }\n"
+      "fun tree(depth) {\n"
+      "  if (depth == 0) return nil;\n"
+      "  return Node(tree(depth - 1), tree(depth - 1));\n"
+      "}\n"
+      "var root = tree(17);\n"
+      "fun garbage() { tree(17); }\n";
+  compilerOptions.printCode = false;
+  GCPolicy defaults = gcPolicy;
+  gcPolicy.gcThreads = (int)state.range(0);
+  gcPolicy.nurserySize = 0;
+  initVM();
+  if (interpret(source) != INTERPRET_OK) {
+    state.SkipWithError("can not build the heap");
+    freeVM();
+    gcPolicy = defaults;
+    return;
+  }
+  collectGarbage();
+  size_t bytes = vm.bytesAllocated;
+  for (auto _ : state) {
+    state.PauseTiming();
+    // no collection while the garbage is made
+    vm.nextGC = SIZE_MAX;
+    interpret("garbage();");
+    state.ResumeTiming();
+    collectGarbage();
+  }
+  state.counters["bytes"] = (double)bytes;
+  freeVM();
+  gcPolicy = defaults;
+}
+BENCHMARK(BM_ParallelCollect)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * a list of 2^16 instances in the old generation cut down to every 16th,
+ * argument 1 compacts the heap after the collection. "objectPages" is what
+ * the object pages hold at the end in MB, "reclaimed" the bytes of the
+ * pages the compaction emptied.
+ */
+static void BM_Compaction(benchmark::State &state) {
+  const char *source =
+      "class Node { init(next) { this.next = next; } }\n"
+      "var head = nil;\n"
+      "for (var i = 0; i < 65536; i = i + 1) head = Node(head);\n"
+      "var node = head;\n"
+      "while (node != nil) {\n"
+      "  var next = node.next;\n"
+      "  for (var j = 0; j < 15 and next != nil; j = j + 1) next = next.next;\n"
+      "  node.next = next;\n"
+      "  node = next;\n"
+      "}\n"
+      "gc();\n"
+      // the compaction waits for the safepoint of the next call
+      "clock();\n";
+  compilerOptions.printCode = false;
+  GCPolicy defaults = gcPolicy;
+  gcPolicy.nurserySize = 0;
+  gcPolicy.compactThreshold = state.range(0) != 0 ? 0.5 : 0;
+  int pages = 0;
+  uint64_t reclaimed = 0;
+  bool failed = false;
+  for (auto _ : state) {
+    initVM();
+    failed = interpret(source) != INTERPRET_OK;
+    objectPages(&pages);
+    reclaimed = gcStats.reclaimedBytes;
+    freeVM();
+    if (failed)
+      break;
+  }
+  gcPolicy = defaults;
+  if (failed) {
+    state.SkipWithError("can not build the heap");
+    return;
+  }
+  state.counters["objectPages"] =
+      (double)pages * ALLOCATOR_PAGE_SIZE / (1024.0 * 1024.0);
+  state.counters["reclaimed"] = (double)reclaimed / (1024.0 * 1024.0);
+}
+BENCHMARK(BM_Compaction)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
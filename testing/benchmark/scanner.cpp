@@ -0,0 +1,41 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "bench.h"
+#include "compiler/scanner.h"
+
+// scanToken() over a generated source with the argument number of
+// functions, the scanner needs no VM
+static void BM_ScanToken(benchmark::State &state) {
+  std::string source = generateSource((int)state.range(0));
+  int64_t tokens = 0;
+  for (auto _ : state) {
+    initScanner(source.c_str());
+    for (;;) {
+      Token token = scanToken();
+      tokens++;
+      if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR)
+        break;
+    }
+  }
+  state.SetItemsProcessed(tokens);
+  state.SetBytesProcessed(state.iterations() * (int64_t)source.size());
+}
+BENCHMARK(BM_ScanToken)->Arg(100)->Arg(1000);
@@ -0,0 +1,135 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "bench.h"
+#include "common/memory.h"
+
+/**
+ * interning through copyString() and takeString(), the argument is the
+ * length of the strings. a hit finds the string in vm.strings, a miss
+ * allocates and adds it.
+ */
+
+// strings interned next to the ones under test, vm.strings is not empty in
+// a running program either
+#define RESIDENT_STRINGS 4096
+// strings interned per round of the miss benchmarks
+#define BATCH_STRINGS 1024
+
+static std::vector<std::string> makeChars(const char *prefix, int count,
+                                          int length) {
+  std::vector<std::string> strings;
+  for (int i = 0; i < count; i++) {
+    std::string chars = prefix + std::to_string(i);
+    chars.resize(length > (int)chars.size() ? length : chars.size(), '.');
+    strings.push_back(chars);
+  }
+  return strings;
+}
+
+// a VM with the resident strings and nothing of the batch interned yet
+static void resetStrings() {
+  initBenchVM();
+  internStrings("resident", RESIDENT_STRINGS);
+}
+
+static void BM_CopyStringHit(benchmark::State &state) {
+  std::vector<std::string> strings =
+      makeChars("hit", BATCH_STRINGS, (int)state.range(0));
+  resetStrings();
+  for (const std::string &chars : strings) {
+    copyString(chars.data(), (int)chars.size());
+  }
+  for (auto _ : state) {
+    for (const std::string &chars : strings) {
+      benchmark::DoNotOptimize(copyString(chars.data(), (int)chars.size()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH_STRINGS);
+  freeVM();
+}
+BENCHMARK(BM_CopyStringHit)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_CopyStringMiss(benchmark::State &state) {
+  std::vector<std::string> strings =
+      makeChars("miss", BATCH_STRINGS, (int)state.range(0));
+  resetStrings();
+  for (auto _ : state) {
+    for (const std::string &chars : strings) {
+      benchmark::DoNotOptimize(copyString(chars.data(), (int)chars.size()));
+    }
+    state.PauseTiming();
+    freeVM();
+    resetStrings();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH_STRINGS);
+  freeVM();
+}
+BENCHMARK(BM_CopyStringMiss)->Arg(8)->Arg(64)->Arg(512);
+
+// takeString() gets the chars from the heap, the way concatenation builds
+// them, and frees them on a hit
+static char *heapChars(const std::string &chars) {
+  char *heap = ALLOCATE(char, chars.size() + 1);
+  memcpy(heap, chars.data(), chars.size());
+  heap[chars.size()] = '\0';
+  return heap;
+}
+
+static void BM_TakeStringHit(benchmark::State &state) {
+  std::vector<std::string> strings =
+      makeChars("hit", BATCH_STRINGS, (int)state.range(0));
+  resetStrings();
+  for (const std::string &chars : strings) {
+    copyString(chars.data(), (int)chars.size());
+  }
+  for (auto _ : state) {
+    for (const std::string &chars : strings) {
+      benchmark::DoNotOptimize(
+          takeString(heapChars(chars), (int)chars.size()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH_STRINGS);
+  freeVM();
+}
+BENCHMARK(BM_TakeStringHit)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_TakeStringMiss(benchmark::State &state) {
+  std::vector<std::string> strings =
+      makeChars("miss", BATCH_STRINGS, (int)state.range(0));
+  resetStrings();
+  for (auto _ : state) {
+    for (const std::string &chars : strings) {
+      benchmark::DoNotOptimize(
+          takeString(heapChars(chars), (int)chars.size()));
+    }
+    state.PauseTiming();
+    freeVM();
+    resetStrings();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH_STRINGS);
+  freeVM();
+}
+BENCHMARK(BM_TakeStringMiss)->Arg(8)->Arg(64)->Arg(512);
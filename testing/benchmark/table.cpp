@@ -0,0 +1,128 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "bench.h"
+#include "common/hashtable.h"
+
+/**
+ * the Table operations on tables of a few capacities, each filled to a low,
+ * a middle and the highest load factor before it grows. the argument is the
+ * number of keys, the "load" counter the load factor it gives.
+ */
+
+static void tableSizes(benchmark::internal::Benchmark *b) {
+  const int capacities[] = {128, 4096, 131072};
+  const int loads[] = {40, 55, 75};
+  for (int capacity : capacities) {
+    for (int load : loads) {
+      b->Arg(capacity * load / 100);
+    }
+  }
+}
+
+static void fillTable(Table *table, const std::vector<ObjString *> &keys) {
+  initTable(table);
+  for (size_t i = 0; i < keys.size(); i++) {
+    tableSet(table, keys[i], NUMBER_VAL((double)i));
+  }
+}
+
+static void reportLoad(benchmark::State &state, Table *table) {
+  state.counters["load"] = (double)table->count / (double)table->capacity;
+}
+
+// a new table, growing it is part of the cost
+static void BM_TableSet(benchmark::State &state) {
+  initBenchVM();
+  std::vector<ObjString *> keys = internStrings("key", (int)state.range(0));
+  Table table;
+  for (auto _ : state) {
+    fillTable(&table, keys);
+    benchmark::DoNotOptimize(table.entries);
+    freeTable(&table);
+  }
+  fillTable(&table, keys);
+  reportLoad(state, &table);
+  freeTable(&table);
+  state.SetItemsProcessed(state.iterations() * (int64_t)keys.size());
+  freeVM();
+}
+BENCHMARK(BM_TableSet)->Apply(tableSizes);
+
+static void BM_TableGetHit(benchmark::State &state) {
+  initBenchVM();
+  std::vector<ObjString *> keys = internStrings("key", (int)state.range(0));
+  Table table;
+  fillTable(&table, keys);
+  reportLoad(state, &table);
+  for (auto _ : state) {
+    for (ObjString *key : keys) {
+      Value value;
+      benchmark::DoNotOptimize(tableGet(&table, key, &value));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)keys.size());
+  freeTable(&table);
+  freeVM();
+}
+BENCHMARK(BM_TableGetHit)->Apply(tableSizes);
+
+// the probe sequence of a missing key ends at an empty entry only, the
+// longer the clusters the slower
+static void BM_TableGetMiss(benchmark::State &state) {
+  initBenchVM();
+  std::vector<ObjString *> keys = internStrings("key", (int)state.range(0));
+  std::vector<ObjString *> missing =
+      internStrings("missing", (int)state.range(0));
+  Table table;
+  fillTable(&table, keys);
+  reportLoad(state, &table);
+  for (auto _ : state) {
+    for (ObjString *key : missing) {
+      Value value;
+      benchmark::DoNotOptimize(tableGet(&table, key, &value));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)missing.size());
+  freeTable(&table);
+  freeVM();
+}
+BENCHMARK(BM_TableGetMiss)->Apply(tableSizes);
+
+// delete every key and set it again, the sets reuse the tombstones
+static void BM_TableDelete(benchmark::State &state) {
+  initBenchVM();
+  std::vector<ObjString *> keys = internStrings("key", (int)state.range(0));
+  Table table;
+  fillTable(&table, keys);
+  reportLoad(state, &table);
+  for (auto _ : state) {
+    for (ObjString *key : keys) {
+      tableDelete(&table, key);
+    }
+    for (ObjString *key : keys) {
+      tableSet(&table, key, NIL_VAL);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * (int64_t)keys.size());
+  freeTable(&table);
+  freeVM();
+}
+BENCHMARK(BM_TableDelete)->Apply(tableSizes);
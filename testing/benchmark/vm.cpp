@@ -0,0 +1,268 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "bench.h"
+#include "common/gcstats.h"
+#include "common/hashtable.h"
+#include "common/memory.h"
+#include "compiler/parser.h"
+#include "stream/stream.h"
+#include "vm/interp/interp.h"
+
+/**
+ * end to end runs of the scripts in workloads/, every iteration is a fresh
+ * initVM(), interpret() and freeVM(). the workloads leave their outcome in
+ * the global "result", it is checked so a broken VM does not get fast.
+ */
+
+static std::string readWorkload(const char *name) {
+  std::string path = std::string(YS_WORKLOADS_DIR) + "/" + name;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL)
+    return std::string();
+  std::string source;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    source.append(buffer, length);
+  }
+  fclose(file);
+  return source;
+}
+
+// the global "result" as print shows it
+static std::string workloadResult() {
+  Value value;
+  if (!tableGet(&vm.globals, copyString("result", 6), &value))
+    return "<undefined>";
+  base::MemoryStream out;
+  writeValue(out, value);
+  const std::vector<uint8_t> &data = out.output_buffer().data;
+  return std::string(data.begin(), data.end());
+}
+
+// allocations and bytes per run next to the time of it
+static void countAllocations(benchmark::State &state, size_t allocations,
+                             size_t bytes) {
+  state.counters["allocs"] = benchmark::Counter(
+      (double)allocations, benchmark::Counter::kAvgIterations);
+  state.counters["bytes"] =
+      benchmark::Counter((double)bytes, benchmark::Counter::kAvgIterations);
+}
+
+static void BM_Workload(benchmark::State &state, const char *name,
+                        const char *expected) {
+  std::string source = readWorkload(name);
+  if (source.empty()) {
+    state.SkipWithError("can not read the workload");
+    return;
+  }
+  compilerOptions.printCode = false;
+
+  size_t allocations = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    initVM();
+    InterpretResult result = interpret(source.c_str());
+    allocations += vm.allocationCount;
+    bytes += vm.bytesAllocatedTotal;
+    bool failed = result != INTERPRET_OK || workloadResult() != expected;
+    freeVM();
+    if (failed) {
+      state.SkipWithError("the workload did not compute its result");
+      return;
+    }
+  }
+  countAllocations(state, allocations, bytes);
+}
+
+BENCHMARK_CAPTURE(BM_Workload, fib, "fib.ys", "75025")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, method_call, "method_call.ys", "200000")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, field_access, "field_access.ys", "1")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, closure, "closure.ys", "100000")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, string_concat, "string_concat.ys",
+                  "abababababababababababababababababababab")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, global_access, "global_access.ys", "300000")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, instantiation, "instantiation.ys", "100000")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, binary_trees, "binary_trees.ys", "131759")
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, large_heap, "large_heap.ys", "455000")
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * binary_trees under a few heap policies, the first argument is the growth
+ * factor in percent, the second the initial threshold in KB. the time
+ * against the "peak" heap, the largest the heap got before a collection, is
+ * the trade of throughput against memory. "gcs" is the collections per run.
+ */
+static size_t peakHeap;
+
+static void recordPeak(const GCCollection *collection) {
+  if (collection->bytesBefore > peakHeap)
+    peakHeap = collection->bytesBefore;
+}
+
+static void heapPolicies(benchmark::internal::Benchmark *b) {
+  const int factors[] = {125, 150, 200, 400};
+  const int initials[] = {256, 1024, 16384};
+  for (int factor : factors) {
+    for (int initial : initials) {
+      b->Args({factor, initial});
+    }
+  }
+}
+
+static void BM_HeapPolicy(benchmark::State &state) {
+  std::string source = readWorkload("binary_trees.ys");
+  if (source.empty()) {
+    state.SkipWithError("can not read the workload");
+    return;
+  }
+  compilerOptions.printCode = false;
+  GCPolicy defaults = gcPolicy;
+  gcPolicy.growFactor = (double)state.range(0) / 100.0;
+  gcPolicy.initialHeap = (size_t)state.range(1) * 1024;
+  gcStats.listener = recordPeak;
+
+  peakHeap = 0;
+  uint64_t collections = 0;
+  bool failed = false;
+  for (auto _ : state) {
+    initVM();
+    failed = interpret(source.c_str()) != INTERPRET_OK ||
+             workloadResult() != "131759";
+    collections += gcStats.collections;
+    if (vm.bytesAllocated > peakHeap)
+      peakHeap = vm.bytesAllocated;
+    freeVM();
+    if (failed)
+      break;
+  }
+  gcStats.listener = NULL;
+  gcPolicy = defaults;
+  if (failed) {
+    state.SkipWithError("the workload did not compute its result");
+    return;
+  }
+  state.counters["peak"] = (double)peakHeap;
+  state.counters["gcs"] = benchmark::Counter(
+      (double)collections, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_HeapPolicy)->Apply(heapPolicies)->Unit(benchmark::kMillisecond);
+
+/**
+ * large_heap with the old generation collected in one pause, first argument
+ * 0, or incrementally with the argument as the pause target in us. the
+ * second argument 1 marks on the marker thread, the third 1 sweeps lazily
+ * and 2 on the sweeper thread. "maxPause" is the longest pause of all runs
+ * in ms, minor collections included, "pauses" the pauses per run and
+ * "pauseTime" their total per run in ms. "overdue" counts the slices per run
+ * that ignored the pause target, the benchmark fails when most cycles do.
+ */
+static void BM_PauseTarget(benchmark::State &state) {
+  std::string source = readWorkload("large_heap.ys");
+  if (source.empty()) {
+    state.SkipWithError("can not read the workload");
+    return;
+  }
+  compilerOptions.printCode = false;
+  GCPolicy defaults = gcPolicy;
+  gcPolicy.pauseTargetNs = (uint64_t)state.range(0) * 1000;
+  gcPolicy.concurrentMarking = state.range(1) != 0;
+  gcPolicy.lazySweep = state.range(2) != 0;
+  gcPolicy.sweepThread = state.range(2) == 2;
+
+  uint64_t maxPauseNs = 0;
+  uint64_t pauses = 0;
+  uint64_t pauseNs = 0;
+  uint64_t overdue = 0;
+  uint64_t cycles = 0;
+  bool failed = false;
+  for (auto _ : state) {
+    initVM();
+    failed = interpret(source.c_str()) != INTERPRET_OK ||
+             workloadResult() != "455000";
+    if (gcStats.maxPauseNs > maxPauseNs)
+      maxPauseNs = gcStats.maxPauseNs;
+    pauses += gcStats.pauseCount;
+    pauseNs += gcStats.totalPauseNs;
+    overdue += gcStats.overdueSlices;
+    cycles += gcStats.collections - gcStats.minorCollections;
+    freeVM();
+    if (failed)
+      break;
+  }
+  gcPolicy = defaults;
+  if (failed) {
+    state.SkipWithError("the workload did not compute its result");
+    return;
+  }
+  state.counters["maxPause"] = (double)maxPauseNs / 1e6;
+  state.counters["pauses"] =
+      benchmark::Counter((double)pauses, benchmark::Counter::kAvgIterations);
+  state.counters["pauseTime"] = benchmark::Counter(
+      (double)pauseNs / 1e6, benchmark::Counter::kAvgIterations);
+  state.counters["overdue"] =
+      benchmark::Counter((double)overdue, benchmark::Counter::kAvgIterations);
+  if (overdue * 2 > cycles)
+    state.SkipWithError("the cycles fell behind the allocations");
+}
+BENCHMARK(BM_PauseTarget)
+    ->Args({0, 0, 0})
+    ->Args({1000, 0, 0})
+    ->Args({250, 0, 0})
+    ->Args({0, 1, 0})
+    ->Args({1000, 1, 0})
+    ->Args({0, 0, 1})
+    ->Args({0, 0, 2})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_Compile(benchmark::State &state) {
+  std::string source = generateSource((int)state.range(0));
+  compilerOptions.printCode = false;
+
+  size_t allocations = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    initVM();
+    ObjFunction *function = compile(source.c_str());
+    allocations += vm.allocationCount;
+    bytes += vm.bytesAllocatedTotal;
+    freeVM();
+    if (function == NULL) {
+      state.SkipWithError("the generated source does not compile");
+      return;
+    }
+  }
+  countAllocations(state, allocations, bytes);
+  state.SetBytesProcessed((int64_t)state.iterations() *
+                          (int64_t)source.size());
+}
+BENCHMARK(BM_Compile)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
@@ -74,6 +74,27 @@ test_suit=samples
 test_cases=(
             samples/assignment/global.ys
             samples/class/inherited_method.ys
+            samples/comparison/fused.ys
+            samples/constant/folding.ys
+            samples/constant/propagation.ys
+            samples/types/numbers.ys
+            samples/limits/wide_operands.ys
+            samples/limits/gc.ys
+            samples/limits/compact.ys
+            # the compaction right after a sweep on the sweeper thread
+            "--gc-initial 1k --gc-nursery 0 --gc-sweep-thread --gc-compact 1 --gc-pause 0.001 samples/limits/compact.ys"
+            "--gc-initial 1k --gc-nursery 0 --gc-sweep-thread --gc-compact 1 --gc-concurrent samples/limits/compact.ys"
+            # the old generation marked on the marker thread
+            "--gc-initial 1k --gc-concurrent samples/limits/gc.ys"
+            "--gc-initial 1k --gc-concurrent samples/limits/compact.ys"
+            # a full collection shared out to four threads
+            "--gc-initial 1k --gc-threads 4 samples/limits/gc.ys"
+            "--gc-initial 1k --gc-threads 4 samples/limits/compact.ys"
+            # the sweep left to the allocations and to the sweeper thread
+            "--gc-initial 1k --gc-lazy-sweep samples/limits/gc.ys"
+            "--gc-initial 1k --gc-lazy-sweep samples/limits/compact.ys"
+            "--gc-initial 1k --gc-sweep-thread samples/limits/gc.ys"
+            "--gc-initial 1k --gc-sweep-thread samples/limits/compact.ys"
             samples/constructor/call_init_explicitly.ys
             samples/method/print_bound_method.ys
             samples/for/closure_in_body.ys
@@ -15,14 +15,140 @@
  * limitations under the License.
  */
 
+#include <float.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "common/chunk.h"
 #include "common/config.h"
+#include "common/gcstats.h"
+#include "common/memory.h"
+#include "compiler/parser.h"
 #include "disassembler/disassembler.h"
+#include "stream/file-stream.h"
+#include "vm/interp/allocsites.h"
 #include "vm/interp/interp.h"
+#include "vm/interp/profiler.h"
+#include "vm/interp/snapshot.h"
+#include "vm/interp/stats.h"
+#include "vm/interp/tracer.h"
+
+// --stats prints the execution statistics to stderr, --stats-json writes
+// them here instead
+static bool statsReport = false;
+static const char *statsPath = NULL;
+// --annotate and --annotate-json write the annotated code here, - for stdout
+static const char *annotatePath = NULL;
+static bool annotateJson = false;
+
+static void writeAnnotated(base::Stream &out) {
+  if (annotateJson) {
+    writeAnnotationsJson(out);
+  } else {
+    writeAnnotations(out);
+  }
+}
+
+static void reportAnnotations() {
+  if (annotatePath == NULL)
+    return;
+  if (strcmp(annotatePath, "-") == 0) {
+    writeAnnotated(stdoutStream());
+    return;
+  }
+  FILE *file = fopen(annotatePath, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", annotatePath);
+    exit(74);
+  }
+  {
+    base::FileStream out(file);
+    writeAnnotated(out);
+  }
+  fclose(file);
+}
+
+// --gc-stats prints the collector counters to stderr
+static bool gcStatsReport = false;
+
+static void reportStats() {
+  if (gcStatsReport)
+    printGCStats(stderr);
+  reportAnnotations();
+  if (!statsReport && statsPath == NULL)
+    return;
+  if (statsPath == NULL) {
+    printStats(stderr);
+    return;
+  }
+  FILE *file = fopen(statsPath, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", statsPath);
+    exit(74);
+  }
+  writeStatsJson(file);
+  fclose(file);
+}
+
+// --trace records every instruction into this file
+static const char *tracePath = NULL;
+
+// --profile writes the collapsed stacks of the sampling profiler here
+static const char *profilePath = NULL;
+// --profile-lines prints the samples per source line to stderr
+static bool profileLines = false;
+static int profileHz = PROFILER_DEFAULT_HZ;
+
+static void reportProfile() {
+  if (profilePath == NULL && !profileLines)
+    return;
+  stopProfiler();
+  if (profilePath != NULL) {
+    FILE *file = fopen(profilePath, "w");
+    if (file == NULL) {
+      fprintf(stderr, "Could not open file \"%s\".\n", profilePath);
+      exit(74);
+    }
+    writeCollapsedStacks(file);
+    fclose(file);
+  }
+  if (profileLines)
+    printLineHotness(stderr);
+  freeProfiler();
+}
+
+// --heap-snapshot writes the objects reachable once the script ran here
+static const char *snapshotPath = NULL;
+
+static void reportSnapshot() {
+  if (snapshotPath == NULL)
+    return;
+  FILE *file = fopen(snapshotPath, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", snapshotPath);
+    exit(74);
+  }
+  {
+    base::FileStream out(file);
+    writeHeapSnapshot(out);
+  }
+  fclose(file);
+}
+
+// --alloc-sites prints the sampled allocations by site to stderr
+static bool allocSitesReport = false;
+static size_t allocSampleBytes = ALLOC_SAMPLE_DEFAULT;
+
+static void reportAllocSites() {
+  if (!allocSitesReport)
+    return;
+  // what is still live is what a full collection does not free
+  collectGarbage();
+  finishSweep();
+  printAllocSites(stderr);
+}
 
 static void repl() {
   char line[1024];
@@ -67,6 +193,11 @@ static void runFile(const char *path) {
   char *source = readFile(path);
   InterpretResult result = interpret(source);
   free(source); // [owner]
+  reportSnapshot();
+  reportStats();
+  reportAllocSites();
+  reportProfile();
+  stopTracer();
 
   if (result == INTERPRET_COMPILE_ERROR)
     exit(65);
@@ -74,17 +205,221 @@ static void runFile(const char *path) {
     exit(70);
 }
 
+static void usage();
+
+// a byte count with an optional k, m or g suffix
+static size_t parseSize(const char *text) {
+  char *end;
+  double size = strtod(text, &end);
+  switch (*end) {
+  case 'k':
+  case 'K':
+    size *= 1024;
+    end++;
+    break;
+  case 'm':
+  case 'M':
+    size *= 1024 * 1024;
+    end++;
+    break;
+  case 'g':
+  case 'G':
+    size *= 1024 * 1024 * 1024;
+    end++;
+    break;
+  }
+  if (end == text || *end != '\0' || !(size >= 0) ||
+      !(size < (double)SIZE_MAX))
+    usage();
+  return (size_t)size;
+}
+
+// a finite number
+static double parseNumber(const char *text) {
+  char *end;
+  double number = strtod(text, &end);
+  if (end == text || *end != '\0' || !(number >= -DBL_MAX && number <= DBL_MAX))
+    usage();
+  return number;
+}
+
+// a positive whole number
+static int parseCount(const char *text) {
+  char *end;
+  long count = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || count < 1 || count > INT_MAX)
+    usage();
+  return (int)count;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: ysrun [options] [path]\n"
+                  "Options:\n"
+                  "  --no-peephole       disable the bytecode peephole pass\n"
+                  "  --peephole-report   print instruction counts before/after "
+                  "the peephole pass\n"
+                  "  --no-fold           disable constant folding and "
+                  "branch pruning\n"
+                  "  --no-ir             disable the SSA IR passes\n"
+                  "  --no-types          keep the type checked arithmetic\n"
+                  "  --dump-ir           print the IR of every function\n"
+                  "  --stats             print per opcode and per function "
+                  "execution counts\n"
+                  "  --stats-json <file> write the execution counts as JSON\n"
+                  "  --annotate <file>   write the bytecode with the count of "
+                  "every instruction, - for stdout\n"
+                  "  --annotate-json <file>\n"
+                  "                      the same as JSON\n"
+                  "  --gc-stats          print the pauses, allocation and "
+                  "live objects of the GC\n"
+                  "  --gc-initial <size> heap size of the first collection, "
+                  "1m by default\n"
+                  "  --gc-grow <factor>  next collection at factor times the "
+                  "live heap, 2 by default\n"
+                  "  --gc-min <size>     lower bound of the next collection\n"
+                  "  --gc-max <size>     upper bound of the next collection\n"
+                  "  --heap-limit <size> fail with \"Out of memory.\" above "
+                  "it, sizes take k, m, g\n"
+                  "  --gc-nursery <size> young generation, 256k by default, "
+                  "0 for none\n"
+                  "  --gc-pause <ms>     collect the old generation in slices "
+                  "of about ms\n"
+                  "  --gc-concurrent     mark the old generation on a thread "
+                  "of its own\n"
+                  "  --gc-threads <n>    threads of a full collection, 1 by "
+                  "default\n"
+                  "  --gc-lazy-sweep     sweep the old generation as the "
+                  "script allocates\n"
+                  "  --gc-sweep-thread   sweep it on a thread of its own\n"
+                  "  --gc-compact <pct>  compact the old generation once "
+                  "pct%% of its pages is free\n"
+                  "  --profile <file>    sample the call stacks, write them "
+                  "collapsed for flame graphs\n"
+                  "  --profile-lines     print the samples per source line\n"
+                  "  --profile-hz <n>    samples per second of CPU time, "
+                  "1000 by default\n"
+                  "  --trace <file>      record every instruction, decode "
+                  "with ystrace\n"
+                  "  --alloc-sites       print the sampled allocations by "
+                  "line and type\n"
+                  "  --alloc-sample <size>\n"
+                  "                      bytes between two samples, 512 by "
+                  "default\n"
+                  "  --heap-snapshot <file>\n"
+                  "                      write the reachable objects at the "
+                  "end, analyze with ysheap\n");
+  exit(64);
+}
+
 int main(int argc, const char *argv[]) {
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-peephole") == 0) {
+      compilerOptions.peephole = false;
+    } else if (strcmp(argv[i], "--peephole-report") == 0) {
+      compilerOptions.peepholeReport = true;
+    } else if (strcmp(argv[i], "--no-fold") == 0) {
+      compilerOptions.constantFolding = false;
+    } else if (strcmp(argv[i], "--no-ir") == 0) {
+      compilerOptions.ir = false;
+    } else if (strcmp(argv[i], "--no-types") == 0) {
+      compilerOptions.typeInference = false;
+    } else if (strcmp(argv[i], "--dump-ir") == 0) {
+      compilerOptions.dumpIr = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      vmStats.enabled = true;
+      statsReport = true;
+    } else if (strcmp(argv[i], "--gc-stats") == 0) {
+      gcStatsReport = true;
+    } else if (strcmp(argv[i], "--gc-initial") == 0 && i + 1 < argc) {
+      gcPolicy.initialHeap = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--gc-grow") == 0 && i + 1 < argc) {
+      gcPolicy.growFactor = parseNumber(argv[++i]);
+      if (!(gcPolicy.growFactor >= 1.0))
+        usage();
+    } else if (strcmp(argv[i], "--gc-min") == 0 && i + 1 < argc) {
+      gcPolicy.minHeap = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--gc-max") == 0 && i + 1 < argc) {
+      gcPolicy.maxHeap = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc) {
+      gcPolicy.heapLimit = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--gc-nursery") == 0 && i + 1 < argc) {
+      gcPolicy.nurserySize = parseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--gc-pause") == 0 && i + 1 < argc) {
+      double ms = parseNumber(argv[++i]);
+      if (!(ms >= 0.0 && ms * 1e6 < (double)UINT64_MAX))
+        usage();
+      gcPolicy.pauseTargetNs = (uint64_t)(ms * 1e6);
+    } else if (strcmp(argv[i], "--gc-concurrent") == 0) {
+      gcPolicy.concurrentMarking = true;
+    } else if (strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc) {
+      gcPolicy.gcThreads = parseCount(argv[++i]);
+    } else if (strcmp(argv[i], "--gc-lazy-sweep") == 0) {
+      gcPolicy.lazySweep = true;
+    } else if (strcmp(argv[i], "--gc-sweep-thread") == 0) {
+      gcPolicy.lazySweep = true;
+      gcPolicy.sweepThread = true;
+    } else if (strcmp(argv[i], "--gc-compact") == 0 && i + 1 < argc) {
+      double percent = parseNumber(argv[++i]);
+      if (!(percent > 0.0 && percent < 100.0))
+        usage();
+      gcPolicy.compactThreshold = percent / 100.0;
+    } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+      vmStats.enabled = true;
+      statsPath = argv[++i];
+    } else if ((strcmp(argv[i], "--annotate") == 0 ||
+                strcmp(argv[i], "--annotate-json") == 0) &&
+               i + 1 < argc) {
+      vmStats.enabled = true;
+      annotateJson = strcmp(argv[i], "--annotate-json") == 0;
+      annotatePath = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--alloc-sites") == 0) {
+      allocSitesReport = true;
+    } else if (strcmp(argv[i], "--alloc-sample") == 0 && i + 1 < argc) {
+      allocSitesReport = true;
+      allocSampleBytes = parseSize(argv[++i]);
+      if (allocSampleBytes == 0)
+        usage();
+    } else if (strcmp(argv[i], "--heap-snapshot") == 0 && i + 1 < argc) {
+      snapshotPath = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profilePath = argv[++i];
+    } else if (strcmp(argv[i], "--profile-lines") == 0) {
+      profileLines = true;
+    } else if (strcmp(argv[i], "--profile-hz") == 0 && i + 1 < argc) {
+      profileHz = parseCount(argv[++i]);
+    } else if (argv[i][0] == '-' || path != NULL) {
+      usage();
+    } else {
+      path = argv[i];
+    }
+  }
+
   initVM();
-  if (argc == 1) {
+  if (allocSitesReport)
+    startAllocSampler(allocSampleBytes);
+  if ((profilePath != NULL || profileLines) && !startProfiler(profileHz)) {
+    fprintf(stderr, "Could not start the profiler.\n");
+    exit(71);
+  }
+  if (tracePath != NULL && !startTracer(tracePath)) {
+    fprintf(stderr, "Could not open file \"%s\".\n", tracePath);
+    exit(74);
+  }
+  if (path == NULL) {
     repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+    reportSnapshot();
+    reportStats();
+    reportAllocSites();
+    reportProfile();
+    stopTracer();
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    runFile(path);
   }
 
   freeVM();
+  freeAllocSites();
   return 0;
 }
@@ -0,0 +1,548 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/config.h"
+#include "common/gcstats.h"
+#include "common/memory.h"
+#include "common/ysobject.h"
+#include "vm/interp/snapshot.h"
+
+typedef struct {
+  const uint8_t *start;
+  const uint8_t *current;
+  const uint8_t *end;
+} Reader;
+
+/**
+ * the graph of the snapshot, node 0 is a root of its own pointing at every
+ * root of the snapshot, the object of id i is node i + 1. the references of
+ * a node stay in the file buffer.
+ */
+typedef struct {
+  bool defined;
+  uint8_t type;
+  uint32_t size;
+  const char *name;
+  uint32_t nameLength;
+  // how a root holds the object, NULL if none does
+  const char *rootName;
+  uint32_t rootNameLength;
+  int rootKind;
+  const uint8_t *references;
+  uint32_t referenceCount;
+} Node;
+
+static Node *nodes = NULL;
+// node 0 included
+static uint32_t nodeCount = 1;
+static uint32_t nodeCapacity = 0;
+static uint32_t *rootNodes = NULL;
+static uint32_t rootCount = 0;
+static uint32_t rootCapacity = 0;
+
+// of the dominator tree
+static uint32_t *idom = NULL;
+static uint64_t *retained = NULL;
+// the children of node n are children[childStart[n]] up to childStart[n + 1]
+static uint32_t *childStart = NULL;
+static uint32_t *children = NULL;
+
+static void invalid(const char *what) {
+  fprintf(stderr, "Invalid heap snapshot: %s.\n", what);
+  exit(65);
+}
+
+static uint8_t *readFile(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t fileSize = ftell(file);
+  rewind(file);
+  uint8_t *buffer = (uint8_t *)malloc(fileSize + 1);
+  if (buffer == NULL) {
+    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    exit(74);
+  }
+  size_t bytesRead = fread(buffer, 1, fileSize, file);
+  if (bytesRead < fileSize) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  fclose(file);
+  *size = bytesRead;
+  return buffer;
+}
+
+static void *allocate(size_t count, size_t size) {
+  void *memory = calloc(count == 0 ? 1 : count, size);
+  if (memory == NULL) {
+    fprintf(stderr, "Not enough memory for the heap snapshot.\n");
+    exit(74);
+  }
+  return memory;
+}
+
+static const uint8_t *readBytes(Reader *reader, size_t count) {
+  if ((size_t)(reader->end - reader->current) < count)
+    invalid("truncated");
+  const uint8_t *bytes = reader->current;
+  reader->current += count;
+  return bytes;
+}
+
+static uint8_t readU8(Reader *reader) { return *readBytes(reader, 1); }
+
+static uint32_t readU32(Reader *reader) {
+  uint32_t value;
+  memcpy(&value, readBytes(reader, sizeof(value)), sizeof(value));
+  return value;
+}
+
+static const char *readString(Reader *reader, uint32_t *length) {
+  *length = readU32(reader);
+  return (const char *)readBytes(reader, *length);
+}
+
+static uint32_t referenceAt(const Node *node, uint32_t index) {
+  uint32_t id;
+  memcpy(&id, node->references + index * sizeof(id), sizeof(id));
+  return id + 1;
+}
+
+// the ids may come before the 'E' block that counts them
+static Node *nodeOf(uint32_t id) {
+  if (id >= UINT32_MAX - 1)
+    invalid("bad id");
+  if (id + 1 >= nodeCapacity) {
+    uint32_t capacity = nodeCapacity < 1024 ? 1024 : nodeCapacity;
+    while (capacity <= id + 1) {
+      capacity *= 2;
+    }
+    nodes = (Node *)realloc(nodes, sizeof(Node) * capacity);
+    if (nodes == NULL)
+      invalid("too large");
+    memset(nodes + nodeCapacity, 0,
+           sizeof(Node) * (capacity - nodeCapacity));
+    nodeCapacity = capacity;
+  }
+  if (id + 2 > nodeCount)
+    nodeCount = id + 2;
+  return &nodes[id + 1];
+}
+
+static void readRoot(Reader *reader) {
+  int kind = readU8(reader);
+  uint32_t id = readU32(reader);
+  uint32_t length;
+  const char *name = readString(reader, &length);
+  Node *node = nodeOf(id);
+  if (node->rootName == NULL || node->rootKind != ROOT_GLOBAL) {
+    node->rootKind = kind;
+    node->rootName = name;
+    node->rootNameLength = length;
+  }
+  if (rootCount == rootCapacity) {
+    rootCapacity = rootCapacity < 64 ? 64 : rootCapacity * 2;
+    rootNodes =
+        (uint32_t *)realloc(rootNodes, sizeof(uint32_t) * rootCapacity);
+    if (rootNodes == NULL)
+      invalid("too large");
+  }
+  rootNodes[rootCount++] = id + 1;
+}
+
+static void readObject(Reader *reader) {
+  Node *node = nodeOf(readU32(reader));
+  if (node->defined)
+    invalid("object defined twice");
+  node->defined = true;
+  node->type = readU8(reader);
+  if (node->type >= OBJ_TYPE_COUNT)
+    invalid("unknown object type");
+  node->size = readU32(reader);
+  node->name = readString(reader, &node->nameLength);
+  node->referenceCount = readU32(reader);
+  node->references =
+      readBytes(reader, (size_t)node->referenceCount * sizeof(uint32_t));
+}
+
+static void readSnapshot(Reader *reader) {
+  size_t magicLength = strlen(SNAPSHOT_MAGIC);
+  if (memcmp(readBytes(reader, magicLength), SNAPSHOT_MAGIC, magicLength) != 0)
+    invalid("bad magic");
+
+  for (;;) {
+    uint8_t tag = readU8(reader);
+    if (tag == 'R') {
+      readRoot(reader);
+    } else if (tag == 'O') {
+      readObject(reader);
+    } else if (tag == 'E') {
+      if (readU32(reader) != nodeCount - 1)
+        invalid("object count does not match");
+      break;
+    } else {
+      invalid("unknown block");
+    }
+  }
+
+  for (uint32_t n = 1; n < nodeCount; n++) {
+    if (!nodes[n].defined)
+      invalid("object missing");
+    for (uint32_t i = 0; i < nodes[n].referenceCount; i++) {
+      if (referenceAt(&nodes[n], i) >= nodeCount)
+        invalid("reference to no object");
+    }
+  }
+  for (uint32_t i = 0; i < rootCount; i++) {
+    if (rootNodes[i] >= nodeCount)
+      invalid("root of no object");
+  }
+}
+
+static uint32_t successorCount(uint32_t n) {
+  return n == 0 ? rootCount : nodes[n].referenceCount;
+}
+
+static uint32_t successor(uint32_t n, uint32_t index) {
+  return n == 0 ? rootNodes[index] : referenceAt(&nodes[n], index);
+}
+
+#define NO_NODE UINT32_MAX
+
+// the walk state of computeDominators(), by node
+static uint32_t *semi = NULL;
+static uint32_t *label = NULL;
+static uint32_t *ancestor = NULL;
+
+// the node of least semidominator on the forest path up from n, the path
+// compressed on the way
+static uint32_t eval(uint32_t n, uint32_t *path) {
+  if (ancestor[n] == NO_NODE)
+    return n;
+  int length = 0;
+  for (uint32_t v = n; ancestor[ancestor[v]] != NO_NODE; v = ancestor[v]) {
+    path[length++] = v;
+  }
+  while (length-- > 0) {
+    uint32_t v = path[length];
+    if (semi[label[ancestor[v]]] < semi[label[v]])
+      label[v] = label[ancestor[v]];
+    ancestor[v] = ancestor[ancestor[v]];
+  }
+  return label[n];
+}
+
+// dominators after Lengauer and Tarjan, "A Fast Algorithm for Finding
+// Dominators in a Flowgraph", the simple version with path compression.
+// every object of a snapshot is reachable from its roots.
+static void computeDominators() {
+  uint32_t *vertex = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  uint32_t *parent = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  uint32_t *stack = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  uint32_t *next = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  semi = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    semi[n] = NO_NODE;
+  }
+
+  // number the nodes in preorder
+  uint32_t visited = 0;
+  int depth = 0;
+  stack[depth++] = 0;
+  semi[0] = visited;
+  vertex[visited++] = 0;
+  while (depth > 0) {
+    uint32_t n = stack[depth - 1];
+    if (next[n] == successorCount(n)) {
+      depth--;
+      continue;
+    }
+    uint32_t s = successor(n, next[n]++);
+    if (semi[s] == NO_NODE) {
+      semi[s] = visited;
+      vertex[visited++] = s;
+      parent[s] = n;
+      stack[depth++] = s;
+    }
+  }
+  if (visited != nodeCount)
+    invalid("unreachable objects");
+
+  // the predecessors of every node
+  uint32_t *predStart = (uint32_t *)allocate(nodeCount + 1, sizeof(uint32_t));
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    for (uint32_t i = 0; i < successorCount(n); i++) {
+      predStart[successor(n, i) + 1]++;
+    }
+  }
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    predStart[n + 1] += predStart[n];
+  }
+  uint32_t *preds =
+      (uint32_t *)allocate(predStart[nodeCount], sizeof(uint32_t));
+  memset(next, 0, sizeof(uint32_t) * nodeCount);
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    for (uint32_t i = 0; i < successorCount(n); i++) {
+      uint32_t s = successor(n, i);
+      preds[predStart[s] + next[s]++] = n;
+    }
+  }
+
+  // the nodes waiting for their dominator under their semidominator, the
+  // stack is free for the paths of eval()
+  uint32_t *bucket = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  uint32_t *bucketNext = next;
+  label = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  ancestor = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  idom = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    bucket[n] = NO_NODE;
+    label[n] = n;
+    ancestor[n] = NO_NODE;
+  }
+
+  for (uint32_t i = nodeCount - 1; i > 0; i--) {
+    uint32_t w = vertex[i];
+    for (uint32_t p = predStart[w]; p < predStart[w + 1]; p++) {
+      uint32_t u = eval(preds[p], stack);
+      if (semi[u] < semi[w])
+        semi[w] = semi[u];
+    }
+    uint32_t s = vertex[semi[w]];
+    bucketNext[w] = bucket[s];
+    bucket[s] = w;
+    ancestor[w] = parent[w];
+
+    for (uint32_t v = bucket[parent[w]]; v != NO_NODE; v = bucketNext[v]) {
+      uint32_t u = eval(v, stack);
+      idom[v] = semi[u] < semi[v] ? u : parent[w];
+    }
+    bucket[parent[w]] = NO_NODE;
+  }
+  idom[0] = 0;
+  for (uint32_t i = 1; i < nodeCount; i++) {
+    uint32_t w = vertex[i];
+    if (idom[w] != vertex[semi[w]])
+      idom[w] = idom[idom[w]];
+  }
+
+  // a dominator comes before the nodes it dominates in preorder
+  retained = (uint64_t *)allocate(nodeCount, sizeof(uint64_t));
+  for (uint32_t i = nodeCount - 1; i > 0; i--) {
+    uint32_t n = vertex[i];
+    retained[n] += nodes[n].size;
+    retained[idom[n]] += retained[n];
+  }
+
+  childStart = (uint32_t *)allocate(nodeCount + 1, sizeof(uint32_t));
+  for (uint32_t n = 1; n < nodeCount; n++) {
+    childStart[idom[n] + 1]++;
+  }
+  for (uint32_t n = 0; n < nodeCount; n++) {
+    childStart[n + 1] += childStart[n];
+  }
+  children = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  memset(next, 0, sizeof(uint32_t) * nodeCount);
+  for (uint32_t n = 1; n < nodeCount; n++) {
+    children[childStart[idom[n]] + next[idom[n]]++] = n;
+  }
+
+  free(vertex);
+  free(parent);
+  free(stack);
+  free(next);
+  free(semi);
+  free(label);
+  free(ancestor);
+  free(bucket);
+  free(predStart);
+  free(preds);
+}
+
+static const char *rootKindName(int kind) {
+  switch ((RootKind)kind) {
+  case ROOT_STACK:
+    return "stack";
+  case ROOT_FRAME:
+    return "frame";
+  case ROOT_UPVALUE:
+    return "open upvalue";
+  case ROOT_GLOBAL:
+    return "global";
+  case ROOT_VM:
+    return "vm";
+  }
+  return "?";
+}
+
+// a name of the snapshot may hold any bytes
+static void printChars(const char *chars, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    putchar((uint8_t)chars[i] < ' ' ? '.' : chars[i]);
+  }
+}
+
+static void printNode(uint32_t n) {
+  const Node *node = &nodes[n];
+  printf("%s", objTypeName((ObjType)node->type));
+  if (node->type == OBJ_STRING) {
+    printf(" \"");
+    printChars(node->name, node->nameLength);
+    printf(node->nameLength >= SNAPSHOT_NAME_MAX ? "\"..." : "\"");
+  } else if (node->nameLength > 0) {
+    putchar(' ');
+    printChars(node->name, node->nameLength);
+  } else if (node->type == OBJ_FUNCTION || node->type == OBJ_CLOSURE) {
+    printf(" <script>");
+  }
+  if (node->rootName != NULL) {
+    printf(" (%s", rootKindName(node->rootKind));
+    if (node->rootNameLength > 0) {
+      putchar(' ');
+      printChars(node->rootName, node->rootNameLength);
+    }
+    putchar(')');
+  }
+  printf(" @%u\n", n - 1);
+}
+
+static int compareRetained(const void *a, const void *b) {
+  uint64_t left = retained[*(const uint32_t *)a];
+  uint64_t right = retained[*(const uint32_t *)b];
+  if (left != right)
+    return left < right ? 1 : -1;
+  return *(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1;
+}
+
+static void printSummary() {
+  uint64_t count[OBJ_TYPE_COUNT] = {0};
+  uint64_t bytes[OBJ_TYPE_COUNT] = {0};
+  for (uint32_t n = 1; n < nodeCount; n++) {
+    count[nodes[n].type]++;
+    bytes[nodes[n].type] += nodes[n].size;
+  }
+
+  printf("%-14s %10s %12s\n", "type", "objects", "bytes");
+  for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    if (count[type] == 0)
+      continue;
+    printf("%-14s %10" PRIu64 " %12" PRIu64 "\n", objTypeName((ObjType)type),
+           count[type], bytes[type]);
+  }
+  printf("%-14s %10u %12" PRIu64 "\n\n", "total", nodeCount - 1, retained[0]);
+}
+
+static void printTop(int top) {
+  uint32_t *sorted = (uint32_t *)allocate(nodeCount, sizeof(uint32_t));
+  for (uint32_t n = 1; n < nodeCount; n++) {
+    sorted[n - 1] = n;
+  }
+  qsort(sorted, nodeCount - 1, sizeof(uint32_t), compareRetained);
+
+  printf("%12s %10s  %s\n", "retained", "self", "object");
+  for (uint32_t i = 0; i < nodeCount - 1 && i < (uint32_t)top; i++) {
+    uint32_t n = sorted[i];
+    printf("%12" PRIu64 " %10u  ", retained[n], nodes[n].size);
+    printNode(n);
+  }
+  free(sorted);
+}
+
+// the top children of n by retained size, down to depth
+static void printTree(uint32_t n, int level, int depth, int top) {
+  uint32_t start = childStart[n];
+  uint32_t count = childStart[n + 1] - start;
+  qsort(children + start, count, sizeof(uint32_t), compareRetained);
+  for (uint32_t i = 0; i < count; i++) {
+    if (i == (uint32_t)top) {
+      printf("%12s %10s  %*s... %u more\n", "", "", level * 2, "",
+             count - i);
+      break;
+    }
+    uint32_t child = children[start + i];
+    printf("%12" PRIu64 " %10u  %*s", retained[child], nodes[child].size,
+           level * 2, "");
+    printNode(child);
+    if (level + 1 < depth)
+      printTree(child, level + 1, depth, top);
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: ysheap [options] <snapshot>\n"
+                  "Options:\n"
+                  "  --top <n>           objects to list by retained size, "
+                  "20 by default\n"
+                  "  --tree <depth>      print the dominator tree down to "
+                  "depth\n");
+  exit(64);
+}
+
+int main(int argc, const char *argv[]) {
+  const char *path = NULL;
+  int top = 20;
+  int depth = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      top = atoi(argv[++i]);
+      if (top < 0)
+        usage();
+    } else if (strcmp(argv[i], "--tree") == 0 && i + 1 < argc) {
+      depth = atoi(argv[++i]);
+      if (depth <= 0)
+        usage();
+    } else if (argv[i][0] == '-' || path != NULL) {
+      usage();
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == NULL)
+    usage();
+
+  size_t size;
+  uint8_t *buffer = readFile(path, &size);
+  Reader reader = {buffer, buffer, buffer + size};
+  readSnapshot(&reader);
+  computeDominators();
+
+  printSummary();
+  if (depth > 0) {
+    printf("%12s %10s  %s\n", "retained", "self", "dominator tree");
+    printTree(0, 0, depth, top);
+  } else {
+    printTop(top);
+  }
+
+  free(buffer);
+  free(nodes);
+  free(rootNodes);
+  free(idom);
+  free(retained);
+  free(childStart);
+  free(children);
+  return 0;
+}
@@ -0,0 +1,296 @@
+/**
+ * Copyright 2023 Develop Group Participants; All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0(the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/chunk.h"
+#include "common/config.h"
+#include "disassembler/disassembler.h"
+#include "vm/interp/interp.h"
+#include "vm/interp/tracer.h"
+
+typedef struct {
+  const uint8_t *start;
+  const uint8_t *current;
+  const uint8_t *end;
+} Reader;
+
+// the functions of the trace by id, rebuilt from their 'F' blocks
+static ObjFunction **functions = NULL;
+static uint32_t functionCount = 0;
+// holds the rebuilt functions in its constants, so the GC keeps them
+static ObjFunction *root = NULL;
+
+static void invalid(const char *what) {
+  fprintf(stderr, "Invalid trace file: %s.\n", what);
+  exit(65);
+}
+
+static uint8_t *readFile(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t fileSize = ftell(file);
+  rewind(file);
+  uint8_t *buffer = (uint8_t *)malloc(fileSize + 1);
+  if (buffer == NULL) {
+    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    exit(74);
+  }
+  size_t bytesRead = fread(buffer, 1, fileSize, file);
+  if (bytesRead < fileSize) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  fclose(file);
+  *size = bytesRead;
+  return buffer;
+}
+
+static const uint8_t *readBytes(Reader *reader, size_t count) {
+  if ((size_t)(reader->end - reader->current) < count)
+    invalid("truncated");
+  const uint8_t *bytes = reader->current;
+  reader->current += count;
+  return bytes;
+}
+
+static uint8_t readU8(Reader *reader) { return *readBytes(reader, 1); }
+
+static uint32_t readU32(Reader *reader) {
+  uint32_t value;
+  memcpy(&value, readBytes(reader, sizeof(value)), sizeof(value));
+  return value;
+}
+
+// NULL for the empty name of the script
+static ObjString *readName(Reader *reader) {
+  uint32_t length = readU32(reader);
+  const char *chars = (const char *)readBytes(reader, length);
+  return length > 0 ? copyString(chars, (int)length) : NULL;
+}
+
+static Value readConstant(Reader *reader) {
+  switch (readU8(reader)) {
+  case TRACE_CONSTANT_NIL:
+    return NIL_VAL;
+  case TRACE_CONSTANT_BOOL:
+    return BOOL_VAL(readU8(reader) != 0);
+  case TRACE_CONSTANT_NUMBER: {
+    double number;
+    memcpy(&number, readBytes(reader, sizeof(number)), sizeof(number));
+    return NUMBER_VAL(number);
+  }
+  case TRACE_CONSTANT_STRING: {
+    uint32_t length = readU32(reader);
+    const char *chars = (const char *)readBytes(reader, length);
+    return OBJ_VAL(copyString(chars, (int)length));
+  }
+  case TRACE_CONSTANT_FUNCTION: {
+    // enough of the function for the disassembler to print OP_CLOSURE.
+    ObjFunction *function = newFunction();
+    push(OBJ_VAL(function));
+    function->upvalueCount = (int)readU32(reader);
+    function->name = readName(reader);
+    pop();
+    return OBJ_VAL(function);
+  }
+  default:
+    invalid("unknown constant");
+    return NIL_VAL;
+  }
+}
+
+static void readFunction(Reader *reader) {
+  uint32_t id = readU32(reader);
+  if (id != functionCount)
+    invalid("function ids out of order");
+
+  ObjFunction *function = newFunction();
+  push(OBJ_VAL(function));
+  function->line = (int)readU32(reader);
+  function->arity = (int)readU32(reader);
+  function->upvalueCount = (int)readU32(reader);
+  function->name = readName(reader);
+
+  uint32_t codeCount = readU32(reader);
+  const uint8_t *code = readBytes(reader, codeCount);
+  uint32_t lineCount = readU32(reader);
+  const uint8_t *lineStarts = readBytes(reader, lineCount * 8);
+  uint32_t run = 0;
+  int line = 0;
+  for (uint32_t offset = 0; offset < codeCount; offset++) {
+    uint32_t start[2];
+    while (run < lineCount &&
+           (memcpy(start, lineStarts + run * 8, sizeof(start)),
+            start[0] <= offset)) {
+      line = (int)start[1];
+      run++;
+    }
+    writeChunk(&function->chunk, code[offset], line);
+  }
+
+  uint32_t constantCount = readU32(reader);
+  for (uint32_t i = 0; i < constantCount; i++) {
+    Value constant = readConstant(reader);
+    push(constant);
+    addConstant(&function->chunk, constant);
+    pop();
+  }
+
+  addConstant(&root->chunk, OBJ_VAL(function));
+  pop();
+  functions = (ObjFunction **)realloc(
+      functions, sizeof(ObjFunction *) * (functionCount + 1));
+  if (functions == NULL)
+    exit(1);
+  functions[functionCount++] = function;
+}
+
+static void label(ObjFunction *function, char *buffer, size_t size) {
+  if (function->name == NULL) {
+    snprintf(buffer, size, "script");
+  } else {
+    snprintf(buffer, size, "%s:%d", function->name->chars, function->line);
+  }
+}
+
+static ObjFunction *recordFunction(const TraceRecord *record) {
+  if (record->function >= functionCount)
+    invalid("record before its function");
+  ObjFunction *function = functions[record->function];
+  if (record->offset >= (uint32_t)function->chunk.count ||
+      function->chunk.code[record->offset] != record->opcode)
+    invalid("record does not match the code");
+  return function;
+}
+
+static void printRecord(uint64_t index, const TraceRecord *record) {
+  ObjFunction *function = recordFunction(record);
+  char name[64];
+  label(function, name, sizeof(name));
+  printf("%10" PRIu64 " %3u %5u  %-16s ", index, record->frames,
+         record->stack, name);
+  disassembleInstruction(&function->chunk, (int)record->offset);
+}
+
+// the open calls of the chrome trace, by frame depth
+static ObjFunction *openCalls[UINT8_COUNT];
+static int openCount = 0;
+static bool firstEvent = true;
+
+static void chromeEvent(ObjFunction *function, char phase, uint64_t ts) {
+  char name[64];
+  label(function, name, sizeof(name));
+  printf("%s\n  {\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %" PRIu64
+         ", \"pid\": 1, \"tid\": 1}",
+         firstEvent ? "" : ",", name, phase, ts);
+  firstEvent = false;
+}
+
+// a span per call, one instruction counts as one microsecond
+static void chromeRecord(uint64_t index, const TraceRecord *record) {
+  ObjFunction *function = recordFunction(record);
+  while (openCount > record->frames ||
+         (openCount == record->frames &&
+          openCalls[openCount - 1] != function)) {
+    openCount--;
+    chromeEvent(openCalls[openCount], 'E', index);
+  }
+  // frames below the first traced one show up as they are returned to.
+  while (openCount < record->frames) {
+    openCalls[openCount++] = function;
+    chromeEvent(function, 'B', index);
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: ystrace [options] <trace>\n"
+                  "Options:\n"
+                  "  --chrome            write Chrome trace JSON instead of "
+                  "the listing\n");
+  exit(64);
+}
+
+int main(int argc, const char *argv[]) {
+  const char *path = NULL;
+  bool chrome = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--chrome") == 0) {
+      chrome = true;
+    } else if (argv[i][0] == '-' || path != NULL) {
+      usage();
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == NULL)
+    usage();
+
+  size_t size;
+  uint8_t *buffer = readFile(path, &size);
+  Reader reader = {buffer, buffer, buffer + size};
+  size_t magicLength = strlen(TRACE_MAGIC);
+  if (memcmp(readBytes(&reader, magicLength), TRACE_MAGIC, magicLength) != 0)
+    invalid("bad magic");
+
+  initVM();
+  root = newFunction();
+  push(OBJ_VAL(root));
+
+  if (chrome)
+    printf("{\"traceEvents\": [");
+  uint64_t index = 0;
+  while (reader.current < reader.end) {
+    uint8_t tag = readU8(&reader);
+    if (tag == 'F') {
+      readFunction(&reader);
+    } else if (tag == 'I') {
+      uint32_t count = readU32(&reader);
+      const uint8_t *records = readBytes(&reader, count * sizeof(TraceRecord));
+      for (uint32_t i = 0; i < count; i++, index++) {
+        TraceRecord record;
+        memcpy(&record, records + i * sizeof(TraceRecord), sizeof(record));
+        if (chrome) {
+          chromeRecord(index, &record);
+        } else {
+          printRecord(index, &record);
+        }
+      }
+    } else {
+      invalid("unknown block");
+    }
+  }
+  if (chrome) {
+    while (openCount > 0) {
+      openCount--;
+      chromeEvent(openCalls[openCount], 'E', index);
+    }
+    printf("\n]}\n");
+  }
+
+  free(buffer);
+  free(functions);
+  freeVM();
+  return 0;
+}